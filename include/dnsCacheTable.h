@@ -0,0 +1,53 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_CACHE_TABLE_H
+#define _DNS_CACHE_TABLE_H
+
+
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+
+
+#define DNS_CACHE_TABLE_MIN_SIZE	16
+#define DNS_MAX_WIRE_NAME_SIZE		(DNS_MAX_NAME_SIZE + 1)		//the text form without its terminating 0, plus the first label size and the terminating 0
+
+
+//the key of a cache entry.  qName is stored in the lower case wire format, i.e., "\3www\7example\3com\0"
+typedef struct {
+	uint64_t hash;
+	uint16_t qType;
+	uint8_t nameLen;
+	uint8_t name[DNS_MAX_WIRE_NAME_SIZE];
+} dnsCacheKey_t;
+
+
+typedef struct {
+	uint64_t hash;		//0 means the slot is empty
+	void* pData;		//the data shall contain a dnsCacheKey_t at dnsCacheTable_t.keyOffset
+} dnsCacheSlot_t;
+
+
+//open addressing hash table with linear probing.  A lookup compares the full 64 bit hash in the slot first,
+//and only compares the key stored in the data when the hash matches
+typedef struct {
+	dnsCacheSlot_t* pSlot;
+	uint32_t mask;		//number of slots - 1, the number of slots is power of 2
+	uint32_t num;		//number of used slots
+	size_t keyOffset;	//offset of the dnsCacheKey_t inside the data
+} dnsCacheTable_t;
+
+
+osStatus_e dnsCacheKey_build(osPointerLen_t* qName, dnsQType_e qType, dnsCacheKey_t* pKey);
+bool dnsCacheKey_isEqual(const dnsCacheKey_t* pKey1, const dnsCacheKey_t* pKey2);
+
+osStatus_e dnsCacheTable_init(dnsCacheTable_t* pTable, uint32_t size, size_t keyOffset);
+void* dnsCacheTable_lookup(dnsCacheTable_t* pTable, const dnsCacheKey_t* pKey);
+//the table does not check if the key already exists
+osStatus_e dnsCacheTable_add(dnsCacheTable_t* pTable, void* pData);
+//remove the slot that points to pData, return false if pData is not in the table
+bool dnsCacheTable_delete(dnsCacheTable_t* pTable, void* pData);
+
+
+#endif
@@ -8,6 +8,15 @@
 
 #define DNS_MAX_SERVER_NUM      3
 
+//a dns specific value of osNodeSelMode_e.  Among the servers of the best priority, the one with the lower rtt ewma, timeout rate and
+//queries in flight of two picked at random is selected
+#define DNS_SERVER_SELECT_MODE_LATENCY	16
+
+
+typedef enum {
+	DNS_RR_CACHE_MODE_PER_THREAD,	//each thread that calls dnsResolver_init() keeps its own rr cache
+	DNS_RR_CACHE_MODE_SHARED,		//one rr cache for the whole process, split into rrCacheShardNum shards
+} dnsRRCacheMode_e;
 
 typedef struct {
     osIpPort_t ipPort;
@@ -22,6 +31,9 @@ typedef struct {
 	struct sockaddr_in localSockAddr;
 	uint32_t rrHashSize;
 	uint32_t qHashSize;
+	dnsRRCacheMode_e rrCacheMode;
+	uint32_t rrCacheShardNum;	//only applicable if rrCacheMode=DNS_RR_CACHE_MODE_SHARED
+	uint64_t rrCacheMaxSize;	//in bytes, per thread for DNS_RR_CACHE_MODE_PER_THREAD, for the whole process for DNS_RR_CACHE_MODE_SHARED.  0 means no limit
 } dnsConfig_t;
 
 
@@ -32,29 +44,73 @@ typedef enum {
 	DNS_XML_RESOLVER_IP,
     DNS_XML_Q_HASH_SIZE,
     DNS_XML_RR_HASH_SIZE,
+	DNS_XML_UDP_BATCH_IO,
+	DNS_XML_HEDGE_BUDGET,
+	DNS_XML_RR_CACHE_MODE,
+	DNS_XML_MIN_RTO_TIMER,
+	DNS_XML_MAX_RTO_TIMER,
 	DNS_XML_MAX_SERVER_NUM,
 	DNS_XML_WAIT_RSP_TIMER,
+	DNS_XML_TCP_IDLE_TIMER,
+	DNS_XML_UDP_SOCKET_NUM,
     DNS_XML_SERVER_PRIORITY,
     DNS_XML_SERVER_SEL_MODE,
+	DNS_XML_RR_STALE_WINDOW,
 	DNS_XML_QUARANTINE_TIMER,	
+	DNS_XML_CLIENT_RSP_TIMER,
+	DNS_XML_RR_CACHE_MAX_SIZE,
+	DNS_XML_EDNS_PAYLOAD_SIZE,
+	DNS_XML_RR_CACHE_SHARD_NUM,
+	DNS_XML_RR_CACHE_ADMIT_FREQ,
+	DNS_XML_RR_PREFETCH_PERCENT,
+	DNS_XML_RR_CACHE_SWEEP_TIMER,
 	DNS_XML_QUARANTINE_THRESHOLD,
+	DNS_XML_UDP_SOCKET_MAX_QUERY,
 	DNS_XML_MAX_ALLOWED_SERVER_PER_QUERY,
 	DNS_XML_MAX_DATA_NAME_NUM,
 } dnsConfig_xmlDataName_e;
 
 
 #define DNS_MAX_ALLOWED_SERVER_NUM_PER_QUERY dnsConfig_getMaxAllowedServerPerQuery()	//default 2
-#define DNS_WAIT_RESPONSE_TIMEOUT   dnsConfig_getWaitRspTimeout()		//default 3000
+#define DNS_WAIT_RESPONSE_TIMEOUT   dnsConfig_getWaitRspTimeout()		//default 3000, also the wait response timeout of a server that has no rtt sample yet
+#define DNS_MIN_RTO					dnsConfig_getMinRto()				//default 50 msec, the lower clamp of the wait response timeout computed from a server's rtt
+#define DNS_MAX_RTO					dnsConfig_getMaxRto()				//default 3000 msec, the upper clamp, 0 means DNS_WAIT_RESPONSE_TIMEOUT is used for every server
 #define DNS_QUARANTINE_TIMEOUT      dnsConfig_getQuarantineTimeout()	//default 300000
 #define DNS_MAX_SERVER_QUARANTINE_NO_RESPONSE_NUM   dnsConfig_getQuarantineThreshold()	//default 3
+#define DNS_RR_CACHE_ADMIT_FREQ		dnsConfig_getRRCacheAdmitFreq()		//default 2, only applies when the rr cache shard is full
+#define DNS_RR_CACHE_SWEEP_TIMEOUT	dnsConfig_getRRCacheSweepTimeout()	//default 1000
+#define DNS_RR_PREFETCH_PERCENT		dnsConfig_getRRPrefetchPercent()	//default 10, 0 means no prefetch
+#define DNS_RR_STALE_WINDOW			dnsConfig_getRRStaleWindow()		//default 0 sec, 0 means the expired rr is never served
+#define DNS_CLIENT_RSP_TIMEOUT		dnsConfig_getClientRspTimeout()		//default 1800 msec, when a stale rr is served if the query has not been responded
+#define DNS_UDP_SOCKET_NUM			dnsConfig_getUdpSocketNum()			//default 4, udp sockets per server per thread
+#define DNS_UDP_SOCKET_MAX_QUERY	dnsConfig_getUdpSocketMaxQuery()	//default 1000, a socket is replaced by one with a new port after it, 0 means never
+#define DNS_UDP_BATCH_IO			dnsConfig_getUdpBatchIo()			//default 0, 1 means queries and responses are sent and received with sendmmsg()/recvmmsg()
+#define DNS_TCP_IDLE_TIMEOUT		dnsConfig_getTcpIdleTimeout()		//default 10000 msec, a tcp connection is closed after it has been idle, 0 means it is not reused
+#define DNS_EDNS_PAYLOAD_SIZE		dnsConfig_getEdnsPayloadSize()		//default 0 (no edns), advertised in the OPT rr of the queries, unless DNS_UDP_BATCH_IO or io_uring is used, shall not be larger than the udp receive buffer of the tp
+#define DNS_HEDGE_BUDGET			dnsConfig_getHedgeBudget()			//default 0, the max queries per second per thread that are hedged to another server after the p95 rtt of the first one, 0 means no hedging
+//the resolver's receive buffers, the tp's udp receive buffer shall not be smaller either
+#define DNS_UDP_RECV_BUF_SIZE		(DNS_EDNS_PAYLOAD_SIZE ? DNS_EDNS_PAYLOAD_SIZE : DNS_MAX_MSG_SIZE)
 
 
 const dnsConfig_t* dns_getConfig();
 
 const int dnsConfig_getMaxAllowedServerPerQuery();
 const int dnsConfig_getWaitRspTimeout();
+const int dnsConfig_getMinRto();
+const int dnsConfig_getMaxRto();
 const int dnsConfig_getQuarantineTimeout();
 const int dnsConfig_getQuarantineThreshold();
+const int dnsConfig_getRRCacheAdmitFreq();
+const int dnsConfig_getRRCacheSweepTimeout();
+const int dnsConfig_getRRPrefetchPercent();
+const int dnsConfig_getRRStaleWindow();
+const int dnsConfig_getClientRspTimeout();
+const int dnsConfig_getUdpSocketNum();
+const int dnsConfig_getUdpSocketMaxQuery();
+const int dnsConfig_getUdpBatchIo();
+const int dnsConfig_getEdnsPayloadSize();
+const int dnsConfig_getTcpIdleTimeout();
+const int dnsConfig_getHedgeBudget();
 
 struct sockaddr_in dnsConfig_getLocalSockAddr();
 
@@ -0,0 +1,41 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_EVENT_H
+#define _DNS_EVENT_H
+
+
+#include <stdint.h>
+
+#include "osTypes.h"
+
+
+#define DNS_EVENT_MAX_NUM			16		//events dispatched per epoll_wait()
+#define DNS_EVENT_POLL_TIMEOUT		1		//msec, the epoll fd is polled at this interval while it has fds, if the app does not watch it
+
+
+//events is EPOLLIN/EPOLLOUT/EPOLLERR/EPOLLHUP of the fd
+typedef void (*dnsEvent_callback_h)(int fd, uint32_t events, void* pData);
+
+//kept by the owner of the fd as long as the fd is in the epoll set
+typedef struct {
+	int fd;
+	dnsEvent_callback_h callback;
+	void* pData;
+} dnsEventHandler_t;
+
+
+//shall be called per thread from dnsResolver_init()
+osStatus_e dnsEvent_init();
+//events are level triggered.  pHandler->fd, callback and pData shall be set by the caller
+osStatus_e dnsEvent_add(dnsEventHandler_t* pHandler, uint32_t events);
+osStatus_e dnsEvent_modify(dnsEventHandler_t* pHandler, uint32_t events);
+//shall be called before pHandler->fd is closed
+void dnsEvent_remove(dnsEventHandler_t* pHandler);
+//see dnsResolver_getEventFd()
+int dnsEvent_getFd();
+//dispatches the ready events without blocking
+void dnsEvent_process();
+
+
+#endif
@@ -0,0 +1,34 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_FREQ_SKETCH_H
+#define _DNS_FREQ_SKETCH_H
+
+
+#include "osTypes.h"
+
+
+#define DNS_FREQ_SKETCH_DEPTH		4
+#define DNS_FREQ_SKETCH_MAX_FREQ	15
+#define DNS_FREQ_SKETCH_MIN_WIDTH	64
+
+
+//count-min sketch of how often a key is seen recently.  Each key maps to one counter in each of the
+//DNS_FREQ_SKETCH_DEPTH rows, the estimate is the smallest of them.  All counters are halved every
+//sampleSize increments, so that old popularity fades out.  The counters are accessed atomically,
+//a sketch can be shared by threads without lock, an increment may be lost under contention
+typedef struct {
+	uint8_t* pCounter;		//DNS_FREQ_SKETCH_DEPTH rows of (mask+1) counters
+	uint32_t mask;			//counters per row - 1, the number of counters per row is power of 2
+	uint32_t sampleSize;
+	uint32_t addNum;		//increments since the last halving
+} dnsFreqSketch_t;
+
+
+//size is the number of keys expected to be tracked
+osStatus_e dnsFreqSketch_init(dnsFreqSketch_t* pSketch, uint32_t size);
+void dnsFreqSketch_increment(dnsFreqSketch_t* pSketch, uint64_t hash);
+uint8_t dnsFreqSketch_estimate(dnsFreqSketch_t* pSketch, uint64_t hash);
+
+
+#endif
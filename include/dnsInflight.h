@@ -0,0 +1,65 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_INFLIGHT_H
+#define _DNS_INFLIGHT_H
+
+
+#include <pthread.h>
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsCacheTable.h"
+
+
+typedef enum {
+	DNS_INFLIGHT_ROLE_OWNER,	//the thread performs the query, and passes the result to the waiters
+	DNS_INFLIGHT_ROLE_WAITER,	//another thread is performing the query, the thread waits for the result
+} dnsInflightRole_e;
+
+
+struct dnsInflightMailbox;
+
+typedef struct dnsInflightWaiter {
+	struct dnsInflightWaiter* next;		//links the waiter in dnsInflight_t.pWaiter, and later in the waiter thread's mailbox
+	struct dnsInflightMailbox* pMailbox;
+	dnsQCacheInfo_t* pQCache;			//only accessed by the waiter thread, or under the shard lock
+	dnsResStatus_e rrStatus;			//filled by the owner thread
+	dnsMessage_t* pDnsMsg;				//filled by the owner thread, referred for the waiter
+} dnsInflightWaiter_t;
+
+
+typedef struct dnsInflightMailbox {
+	dnsInflightWaiter_t* pHead;			//lock free stack, pushed by the owner threads, popped at once by the waiter thread
+	int eventFd;						//written by the owner thread whose push finds pHead empty, read by the waiter thread
+} dnsInflightMailbox_t;
+
+
+typedef struct {
+	pthread_mutex_t lock;
+	dnsCacheTable_t table;				//each slot points to a dnsInflight_t
+} dnsInflightShard_t;
+
+
+typedef struct dnsInflight {
+	dnsCacheKey_t key;
+	dnsInflightShard_t* pShard;
+	dnsInflightWaiter_t* pWaiter;		//waiters from other threads
+} dnsInflight_t;
+
+
+//called in the waiter thread when the owner thread passes back the query result.  pDnsMsg is only valid during the callback
+typedef void (*dnsInflight_resultCallback_h)(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
+
+
+//shall be called per thread from dnsResolver_init(), only when the rr cache is shared
+osStatus_e dnsInflight_init(dnsInflight_resultCallback_h resultCallback);
+//sets pQCache->pInflight for DNS_INFLIGHT_ROLE_OWNER, or pQCache->pInflightWaiter for DNS_INFLIGHT_ROLE_WAITER
+dnsInflightRole_e dnsInflight_join(dnsQCacheInfo_t* pQCache);
+//called by the owner thread when the query is done, pDnsMsg can be NULL
+void dnsInflight_complete(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
+//called by the waiter thread when it gives up waiting
+void dnsInflight_leave(dnsQCacheInfo_t* pQCache);
+
+
+#endif
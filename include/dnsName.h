@@ -0,0 +1,25 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_NAME_H
+#define _DNS_NAME_H
+
+
+#include "osTypes.h"
+#include "osPL.h"
+
+
+#define DNS_NAME_MAX_HOP		16		//the compression pointers followed for one name before it is taken as malformed
+#define DNS_NAME_MAX_WIRE_LEN	255		//octets of a name in the wire, the label sizes and the terminating 0 included, rfc1035 section 2.3.4
+
+
+//decodes the name at wire[*pPos] into name in lowercase, "a.b.c" without the trailing dot, "" for <Root>.  The wire is not modified.
+//name shall have DNS_MAX_NAME_SIZE bytes, which every valid name of up to DNS_NAME_MAX_WIRE_LEN octets fits in, or be NULL if the
+//name is only validated and skipped.  *pPos is moved past the name in place, i.e., past the first compression pointer if there
+//is one.  *pNameLen may be NULL
+osStatus_e dnsName_decode(const uint8_t* wire, size_t wireLen, size_t* pPos, char* name, size_t* pNameLen);
+//case insensitive compare of the name at wire[pos] with pName, false if they differ or the name is malformed
+bool dnsName_isEqual(const uint8_t* wire, size_t wireLen, size_t pos, const osPointerLen_t* pName);
+
+
+#endif
@@ -0,0 +1,89 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_RR_CACHE_H
+#define _DNS_RR_CACHE_H
+
+
+#include <pthread.h>
+
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsConfig.h"
+#include "dnsCacheTable.h"
+#include "dnsFreqSketch.h"
+
+
+#define DNS_RR_CACHE_MAX_SHARD_NUM	256
+
+
+typedef struct {
+	pthread_rwlock_t lock;		//only used when the rr cache is shared by all threads
+	dnsCacheTable_t table;		//each slot points to a dnsRRCacheInfo_t
+	dnsFreqSketch_t sketch;		//how often the keys of this shard are looked up, updated without the write lock
+	uint64_t nextSweepTime;		//msec, when the expired rr of this shard are to be removed next time
+	uint64_t size;				//bytes used by the rr stored in this shard
+	uint32_t clockHand;			//the table slot the CLOCK eviction starts from
+	uint64_t evictNum;			//rr removed to keep the shard under its size budget
+	uint64_t expireNum;			//rr removed when their ttl expired
+	uint64_t rejectNum;			//responses not cached by the admission filter
+} dnsRRCacheShard_t;
+
+
+typedef struct {
+	bool isShared;
+	uint32_t shardNum;			//power of 2
+	uint64_t shardMaxSize;		//the size budget of each shard in bytes, 0 means no limit
+	dnsRRCacheShard_t* pShard;
+} dnsRRCache_t;
+
+
+typedef struct {
+	dnsCacheKey_t key;
+    dnsMessage_t* pDnsMsg;		//NULL for a NXDOMAIN response, only negRcode is kept
+	bool isNegative;			//a NXDOMAIN or NODATA response, it is neither prefetched nor served stale
+	dnsRcode_e negRcode;		//DNS_RCODE_NAME_ERROR for NXDOMAIN, DNS_RCODE_NO_ERROR for NODATA
+	uint64_t expireTime;		//msec of the monotonic clock
+	uint64_t prefetchTime;		//msec of the monotonic clock, a lookup after it starts a refresh of the rr
+	uint64_t staleTime;			//msec of the monotonic clock, expireTime + DNS_RR_STALE_WINDOW, the rr is removed after it
+	uint32_t size;				//bytes counted against the shard budget
+	bool isReferenced;			//CLOCK reference bit, set by lookup, cleared when the clock hand passes
+	bool isPrefetching;			//a refresh has been started
+} dnsRRCacheInfo_t;
+
+
+typedef struct {
+	uint64_t size;
+	uint32_t rrNum;
+	uint64_t evictNum;
+	uint64_t expireNum;
+	uint64_t rejectNum;
+} dnsRRCacheStats_t;
+
+
+//shall be called per thread from dnsResolver_init().  In DNS_RR_CACHE_MODE_SHARED mode, the first caller creates the shared cache
+osStatus_e dnsRRCache_init(const dnsConfig_t* pDnsConfig);
+//if found, the returned dnsMsg has been referred for the caller, caller shall dnsMessage_free() it when done.
+//*pIsPrefetch is set to true when the rr is close to expire and the caller shall refresh it.
+//when a NXDOMAIN is found, NULL is returned with *pIsNegative = true and *pNegRcode set.  A NODATA is returned as its dnsMsg,
+//the same as a NODATA response from the dns server
+dnsMessage_t* dnsRRCache_lookup(const dnsCacheKey_t* pKey, bool* pIsPrefetch, bool* pIsNegative, dnsRcode_e* pNegRcode);
+//the rr cache refers pDnsMsg, caller keeps its own reference.  A rr of the same key that expires earlier is replaced.  The rr is cached if the shard has room.  When the
+//shard is full, it is only cached if the key has been looked up DNS_RR_CACHE_ADMIT_FREQ times recently, and more often than the rr it would evict
+osStatus_e dnsRRCache_add(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, uint32_t ttl);
+//caches a NXDOMAIN (negRcode = DNS_RCODE_NAME_ERROR) or NODATA (negRcode = DNS_RCODE_NO_ERROR) response per rfc2308.  The rr cache
+//refers pDnsMsg of a NODATA, no dnsMsg is kept for a NXDOMAIN.  same replacement and admission rules as dnsRRCache_add()
+osStatus_e dnsRRCache_addNegative(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, dnsRcode_e negRcode, uint32_t ttl);
+//same as dnsRRCache_lookup(), except that a rr expired less than DNS_RR_STALE_WINDOW ago is also returned, with pDnsMsg->isStale set.
+//a negative response is never served stale.
+//shall only be called when the dns servers fail or are slow to respond, the lookup is not counted for the admission
+dnsMessage_t* dnsRRCache_lookupStale(const dnsCacheKey_t* pKey);
+//the refresh the caller was told to do by dnsRRCache_lookup() is over, a later lookup may tell a caller to refresh the rr again
+void dnsRRCache_clearPrefetch(const dnsCacheKey_t* pKey);
+bool dnsRRCache_isShared();
+//sums the counters of all shards of the rr cache used by the calling thread
+void dnsRRCache_getStats(dnsRRCacheStats_t* pStats);
+
+
+#endif
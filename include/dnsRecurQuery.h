@@ -12,6 +12,7 @@ typedef struct {
     dnsResResponse_t* pResResponse;
     dnsQAppInfo_t origAppData;
     osList_t qCacheList;    //each element contains dnsQCacheInfo_t for ongoing query
+    osVPointerLen_t qName;  //a copy of the app's qName, the status.pQName of a failed query points to it
 } dnsNextQInfo_t;
 
 
@@ -8,6 +8,8 @@
 
 #include "dnsResolverIntf.h"
 #include "dnsConfig.h"
+#include "dnsCacheTable.h"
+#include "dnsTimerWheel.h"
 
 
 typedef struct {
@@ -16,46 +18,125 @@ typedef struct {
 } dnsQAppInfo_t;
 
 
+#define DNS_RTT_SAMPLE_NUM			64		//the latest rtt samples of a server its p95 is computed from
+#define DNS_RTT_P95_INTERVAL		16		//the p95 is recomputed every DNS_RTT_P95_INTERVAL samples
+#define DNS_HEDGE_MIN_SAMPLE_NUM	32		//a query to a server is not hedged until the server has this many rtt samples
+#define DNS_TIMEOUT_RATE_ONE		65536	//the fixed point 1.0 of dnsServerInfo_t.timeoutRate
+#define DNS_TIMEOUT_RATE_SHIFT		4		//the timeoutRate ewma weighs each new query outcome 1/16
+
+
+typedef struct {
+    uint32_t sample[DNS_RTT_SAMPLE_NUM];    //usec, a ring of the latest rtt of the udp queries
+    uint32_t sampleNum;     //the total number of samples
+    uint32_t p95;           //usec, the 95th percentile of the samples in the ring
+    uint32_t srtt;          //usec, the smoothed rtt, Jacobson/Karels, rfc6298
+    uint32_t rttvar;        //usec, the rtt variation
+    uint32_t rto;           //msec, srtt + 4*rttvar, doubled for each query timeout until the next sample.  0 until the first sample
+} dnsServerRtt_t;
+
+
+struct dnsUdpActiveFdInfo;
+struct dnsTcpConn;
+
 typedef struct {
     struct sockaddr_in socketAddr;
     uint8_t priority;
     uint8_t noRspCount;     //the continuous query no response count, the count will be reset to 0 any time got a response. e.g., if query A, B, C, D, A no response, count=1, B no response, count=2, C response, count=0, D no response, count=1, etc.
     uint64_t quarantineTimerId; //!=0 when the server is quarantined
+    struct dnsUdpActiveFdInfo* pUdpFd;  //udpFdNum sockets connected to the server, see dnsUdpPool.c
+    int udpFdNum;
+    struct dnsTcpConn* pTcpConn;    //the persistent tcp connection to the server, NULL until a truncated response is received, see dnsTcp.c
+    dnsServerRtt_t rtt;
+    uint32_t timeoutRate;   //ewma of the query timeouts over the query outcomes, in 1/DNS_TIMEOUT_RATE_ONE
+    uint32_t inflightNum;   //the sends to the server that are waiting for a response, see dnsQPendingId_t.isWaiting
 } dnsServerInfo_t;
 
 
+struct dnsInflight;
+struct dnsInflightWaiter;
+
+
+//a query is sent on fd with trId, see dnsUdpPool.c.  fd may be a tcp connection
+typedef struct {
+    int fd;
+    uint16_t trId;
+    dnsServerInfo_t* pServerInfo;   //the server the query is sent to
+    uint64_t sendTime;      //usec, 0 if the rtt of the send is not sampled
+    bool isWaiting;         //the send has neither been answered, timed out nor been abandoned, it counts in the inflightNum of pServerInfo
+    uint32_t tcpConnId;     //the connId of the tcp connection while the send counts in its outstandingNum, 0 otherwise, see dnsTcp_complete()
+} dnsQPendingId_t;
+
+
 typedef struct {
+    dnsCacheKey_t key;          //the key in qCache
     osVPointerLen_t qName;
     dnsQType_e qType;
     bool isCacheRR;
-    uint16_t qTrId;
+    uint16_t qTrId;             //the trId of the latest send
+    bool isTcp;                 //the latest send is over tcp, after a truncated udp response
+    uint8_t pendingNum;
+    dnsQPendingId_t pendingId[DNS_MAX_SERVER_NUM];  //a response to any send of the query is accepted, oldest first
     uint8_t serverQueried;      //how many servers has this query used due to earlier query failure
     osMBuf_t* pBuf;             //query mBuf
     dnsServerInfo_t* pServerInfo;
-    uint64_t waitForRespTimerId;
+    dnsTimerNode_t waitForRespTimer;    //in the per thread timer wheel
+    dnsTimerNode_t clientRspTimer;      //in the per thread timer wheel, when a stale rr is served to the apps still waiting, see DNS_CLIENT_RSP_TIMEOUT
+    dnsTimerNode_t hedgeTimer;          //in the per thread timer wheel, when the query is also sent to another server, see DNS_HEDGE_BUDGET
     osList_t appDataList;       //each element contains dnsQAppInfo_t, list of app Data received when app requesting dns service, need to pass back in rrCallback. one element per request
-    osListElement_t* pHashElement;  //points to the qCache element stores this node
+    bool isInQCache;            //whether this node is stored in qCache
+    struct dnsInflight* pInflight;  //!=NULL when the rr cache is shared and this thread owns the query for all threads
+    struct dnsInflightWaiter* pInflightWaiter;  //!=NULL when the rr cache is shared and another thread owns the query
 } dnsQCacheInfo_t;
 
 
-typedef struct {
-    dnsMessage_t* pDnsMsg;
-    uint64_t ttlTimerId;
-    osListElement_t* pHashElement;
-} dnsRRCacheInfo_t;
-
-
 typedef struct {
     osNodeSelMode_e serverSelMode;
     dnsServerInfo_t serverInfo[DNS_MAX_SERVER_NUM];
     int serverNum;
     uint64_t curNodeSelIdx;     //only applicable if serverSelMode=OS_NODE_SELECT_MODE_ROUND_ROBIN
+    uint32_t randomState;       //only applicable if serverSelMode=DNS_SERVER_SELECT_MODE_LATENCY
 } dnsServerSelInfo_t;
 
 
-dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsMessage_t** qResponse, dnsQCacheInfo_t** ppQCache, dnsResolver_callback_h rrCallback, void* pData);
+#define DNS_MIN_RR_SIZE		11		//a <Root> name, type, class, ttl and rdlength, the bound of the rr a datagram can hold
+
+
+typedef enum {
+	DNS_SECTION_STATE_INDEXED,		//the rr offsets are known, the rr are not decoded
+	DNS_SECTION_STATE_DECODING,
+	DNS_SECTION_STATE_DECODED,
+	DNS_SECTION_STATE_FAILED,
+} dnsSectionState_e;
+
+
+typedef struct {
+    uint64_t msgNum;            //responses parsed
+    uint64_t allocNum;          //memory allocations made to parse them
+    uint64_t sectionNum;        //sections decoded on demand, by the thread that reads them
+} dnsParseStats_t;
+
+
+//when DNS_QUERY_STATUS_DONE is returned with *qResponse == NULL, a cached negative response is found, *pNegRcode is set
+dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsMessage_t** qResponse, dnsRcode_e* pNegRcode, dnsQCacheInfo_t** ppQCache, dnsResolver_callback_h rrCallback, void* pData);
+/* parses a response in pBuf->buf[pBuf->pos, pBuf->size), see dnsMessage.c.  Returns NULL if it is malformed, or its question does
+ * not match pExpectKey.  pExpectKey may be NULL.  The returned message is referred once
+ */
+dnsMessage_t* dnsMessage_parse(osMBuf_t* pBuf, const dnsCacheKey_t* pExpectKey, dnsRcode_e* replyCode);
+//true if pBuf is a response to the query of pExpectKey, only its header and question are checked.  pBuf->pos is not moved
+bool dnsMessage_isQuestionMatch(const osMBuf_t* pBuf, const dnsCacheKey_t* pExpectKey);
+/* a dnsMessage_t is referred and released from any thread, by the rr cache readers, the app threads and the inflight waiters.
+ * its refNum is atomic, the os allocator only sees the osmalloc() and the osfree() of the last reference.  Never use
+ * osmemref()/osfree() on a dnsMessage_t
+ */
+dnsMessage_t* dnsMessage_ref(dnsMessage_t* pDnsMsg);
+//returns NULL
+dnsMessage_t* dnsMessage_free(dnsMessage_t* pDnsMsg);
+//releases every dnsMessage_t in pList and clears pList
+void dnsMessage_freeList(osList_t* pList);
 void dnsResResponse_memref(dnsResResponse_t* pDnsRsp);
 void dnsResResponse_cleanup(void* pData);
+//per thread, for benchmarking the message parsing
+void dnsResolver_getParseStats(dnsParseStats_t* pStats);
 
 #endif
 
@@ -18,7 +18,7 @@
 
 //implement RFC1035
 //only support DNS_CLASS_IN=1 for CLASS and QCLASS
-//support UDP only
+//support UDP, and TCP for the truncated responses, rfc7766
 
 #define DNS_QR_POS		15
 #define DNS_OPCODE_POS	11
@@ -42,8 +42,9 @@
 
 #define DNS_CLASS_IN  1
 
-#define DNS_MAX_MSG_SIZE	512
-#define DNS_MAX_NAME_SIZE    125		//max domain name size
+#define DNS_MAX_MSG_SIZE	512		//without edns, and the max size of a query
+#define DNS_MAX_EDNS_PAYLOAD_SIZE	4096	//the max udp payload size that can be advertised, rfc6891
+#define DNS_MAX_NAME_SIZE    254		//max domain name size, 253 octets in the text form and the terminating 0, rfc1035 section 2.3.4
 #define DNS_MAX_DOMAIN_NAME_LABEL_SIZE	63
 #define DNS_MAX_NAPTR_SERVICE_SIZE	64
 
@@ -78,8 +79,10 @@ typedef enum {
 typedef enum {
     DNS_QTYPE_OTHER = -1,
     DNS_QTYPE_A = 1,
+    DNS_QTYPE_SOA = 6,		//only parsed in the authority section of a negative response, can not be queried
     DNS_QTYPE_SRV = 33,
     DNS_QTYPE_NAPTR = 35,
+    DNS_QTYPE_OPT = 41,		//edns0 pseudo rr in the additional section, rfc6891, can not be queried
 } dnsQType_e;
 
 
@@ -99,25 +102,44 @@ typedef struct {
 } dnsResStatusInfo_t;
 
 
+//the xxxOff fields are offsets in the wire of the message the rr belongs to, use dnsRR_getSrvTarget(), etc. to get them
 typedef struct {
-	uint32_t priority;
-	uint32_t weight;
-	uint32_t port;
-	char target[DNS_MAX_NAME_SIZE];
+	uint16_t priority;
+	uint16_t weight;
+	uint16_t port;
+	uint16_t targetOff;
 } dnsSrv_t;
 
 
 typedef struct {
 	uint16_t order;
 	uint16_t pref;
-	dnsNaptrFlags_e flags;
-	osPointerLen_t service;
-	osPointerLen_t regexp;
-//	osPointerLen_t replacement;
-	char replacement[DNS_MAX_NAME_SIZE];
+	uint8_t flags;			//dnsNaptrFlags_e
+	uint16_t serviceOff;
+	uint16_t regexpOff;
+	uint16_t replacementOff;
 } dnsNaptr_t;
 
 
+//the OPT rr reuses the class and ttl fields, rfc6891 section 6.1.3.  the options in rdata are not kept
+typedef struct {
+	uint16_t udpPayloadSize;
+	uint8_t extRcode;		//the upper 8 bits of the 12 bits rcode
+	uint8_t version;
+	uint16_t flags;			//the DO bit and Z
+} dnsOpt_t;
+
+
+//mName and rName are not kept, only the timers are used, for negative caching per rfc2308
+typedef struct {
+	uint32_t serial;
+	uint32_t refresh;
+	uint32_t retry;
+	uint32_t expire;
+	uint32_t minimum;
+} dnsSoa_t;
+
+
 typedef struct {
     uint16_t trId;
     uint16_t flags;
@@ -128,6 +150,14 @@ typedef struct {
 } dnsHdr_t;
 
 
+typedef enum {
+	DNS_SECTION_ANSWER,
+	DNS_SECTION_AUTH,
+	DNS_SECTION_ADDTL_ANSWER,
+	DNS_SECTION_NUM,
+} dnsSection_e;
+
+
 typedef struct dnsQuestion {
 	char qName[DNS_MAX_NAME_SIZE];
 	uint16_t qType;
@@ -135,17 +165,20 @@ typedef struct dnsQuestion {
 } dnsQuestion_t;
 
 
+//the rdata is packed at its real size, the names and other variable length fields are views into the wire of the message
 typedef struct dnsRR {
-	char name[DNS_MAX_NAME_SIZE];
+	uint16_t nameOff;		//use dnsRR_getName()
 	uint16_t type;
-	uint16_t rrClass;
 	uint32_t ttl;
+	uint16_t rrClass;
 	uint16_t rDataLen;
 	union {
 		struct in_addr ipAddr;
 		dnsSrv_t srv;
 		dnsNaptr_t naptr;
-		osPointerLen_t other;
+		dnsSoa_t soa;
+		dnsOpt_t opt;
+		uint16_t otherOff;	//the raw rdata of rDataLen bytes of an unhandled type, use dnsRR_getRData()
 	};
 } dnsRR_t;
 
@@ -165,12 +198,30 @@ typedef struct dnsRR {
     |      Additional     | RRs holding additional information
     +---------------------+
 */
+/* a parsed message is one allocation, the rr arrays, the rr index and then a copy of the wire are carved from the arena that
+ * follows the dnsMessage_t.  osfree() frees all of it.  When a response is received, only its header and question are parsed,
+ * and the rr are indexed by their offsets in the wire.  The rr of a section are decoded the first time the section is read by
+ * dnsMessage_getSection().  The variable length fields of the rr are views into the wire, a name is only decoded when it is read
+ */
 typedef struct dnsMessage {
     dnsHdr_t hdr;
     dnsQuestion_t query;
-    osList_t answerList;        //dnsRR_t, list of answer rr
-    osList_t authList;          //dnsRR_t, list of auth rr
-    osList_t addtlAnswerList;   //dnsRR_t, list of additional answer rr
+    dnsRR_t* answer;            //answerNum answer rr, use dnsMessage_getSection()
+    dnsRR_t* auth;              //authNum auth rr, use dnsMessage_getSection()
+    dnsRR_t* addtlAnswer;       //addtlAnswerNum additional answer rr, the OPT rr is not included, use dnsMessage_getSection()
+    uint16_t answerNum;
+    uint16_t authNum;
+    uint16_t addtlAnswerNum;
+    uint8_t sectionState[DNS_SECTION_NUM];	//dnsSectionState_e
+    uint16_t* rrOff;            //the wire offset of each rr, the answer rr, then the auth rr, then the additional answer rr
+    uint32_t arenaSize;         //the bytes following the dnsMessage_t in its allocation
+    uint32_t arenaUsed;
+    uint8_t* wire;              //the response as received, in the arena
+    uint32_t wireLen;
+    bool isEdns;                //the response has an OPT rr, it is in opt
+    dnsOpt_t opt;
+    bool isStale;               //served from the rr cache after its ttl expired, see rfc8767
+    uint32_t refNum;            //atomic, see dnsMessage_ref()
 } dnsMessage_t;
 
 
@@ -188,15 +239,47 @@ typedef struct {
         osList_t dnsRspList;    //when rrType == DNS_RR_DATA_TYPE_MSGLIST, each element contains dnsMessage_t*
 		dnsResStatusInfo_t status;	//hen rrType == DNS_RR_DATA_TYPE_STATUS
     };
+	bool isStale;			//some dnsMsg is served from the rr cache after its ttl expired, as the dns servers failed or were slow to respond
 } dnsResResponse_t;
 
 
+//the rr of a section are decoded the first time the section is read, from any thread.  Returns the rr number of the section,
+//*ppRR points to them.  0 is returned if the section is empty or its rr can not be decoded
+uint16_t dnsMessage_getSection(dnsMessage_t* pDnsMsg, dnsSection_e section, dnsRR_t** ppRR);
+//a name may be compressed in the wire, it is decoded into name, which shall have DNS_MAX_NAME_SIZE bytes, the returned view
+//points to name, and name is 0 terminated
+osPointerLen_t dnsRR_getName(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name);
+osPointerLen_t dnsRR_getSrvTarget(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name);
+osPointerLen_t dnsRR_getNaptrReplacement(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name);
+//compares a name in the wire of pDnsMsg, e.g., pRR->nameOff, with pName case insensitively, without decoding it
+bool dnsMessage_isNameEqual(const dnsMessage_t* pDnsMsg, uint16_t nameOff, const osPointerLen_t* pName);
+//views into the wire of pDnsMsg, valid as long as pDnsMsg is referred, they are not 0 terminated
+osPointerLen_t dnsRR_getNaptrService(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR);
+osPointerLen_t dnsRR_getNaptrRegexp(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR);
+osPointerLen_t dnsRR_getRData(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR);
+
+
 //the callback receiver shall not free memory for qName and pDnsMsg
 typedef void (*dnsResolver_callback_h)(dnsResResponse_t* pRR, void* pData);
 
 
 osStatus_e dnsConfig_init(char* dnsFileFolder, char* dnsXsdFileName, char* dnsXmlFileName);
 osStatus_e dnsResolver_init();
+/* alternative to dnsResolver_init(), with one or a few dedicated resolver threads.  Each resolver thread calls
+ * dnsResolver_initService(), then each app thread calls dnsResolver_initClient().  dnsQuery() in an app thread always
+ * returns DNS_QUERY_STATUS_ONGOING, and rrCallback is called in the app thread.  pRR->status.pQName is only valid
+ * during the callback
+ */
+osStatus_e dnsResolver_initService();
+osStatus_e dnsResolver_initClient();
+/* the tcp connections of the resolver, the request ring of a resolver thread, the inflight mailbox and the completion rings
+ * of an app thread, are not in the tp.  The app adds the returned fd to the event loop of a thread that called
+ * dnsResolver_init(), dnsResolver_initService() or dnsResolver_initClient(), and calls
+ * dnsResolver_onEvent() in the thread when the fd is readable.  If the app does not, the resolver polls its fds with a
+ * timer, a resolver thread then polls all the time
+ */
+int dnsResolver_getEventFd();
+void dnsResolver_onEvent();
 dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolveAll, bool isCacheRR, dnsResResponse_t** ppResResponse, dnsResolver_callback_h rrCallback, void* pData);
 bool dnsResolver_isRspNoError(dnsResResponse_t* pRR);
 
@@ -0,0 +1,69 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_SERVICE_H
+#define _DNS_SERVICE_H
+
+
+#include "osTypes.h"
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+
+
+#define DNS_SERVICE_MAX_THREAD_NUM	8
+#define DNS_SERVICE_RING_SIZE		1024	//power of 2, also the max requests an app thread can have outstanding per resolver thread
+#define DNS_SERVICE_CACHE_LINE		64
+
+
+struct dnsServiceCompletionRing;
+
+typedef struct dnsServiceRequest {
+	char qNameBuf[DNS_MAX_NAME_SIZE];
+	osPointerLen_t qName;				//points to qNameBuf
+	dnsQType_e qType;
+	bool isResolveAll;
+	bool isCacheRR;
+	dnsResolver_callback_h rrCallback;	//called in the app thread
+	void* pData;
+	dnsResResponse_t* pResResponse;		//filled by the resolver thread, owned by the app once rrCallback is called
+	struct dnsServiceCompletionRing* pCompletion;
+} dnsServiceRequest_t;
+
+
+typedef struct {
+	uint32_t seq;						//== pos when the slot is free for the producer at pos, == pos+1 when it is filled
+	dnsServiceRequest_t* pReq;
+} dnsServiceSlot_t;
+
+
+//bounded lock free MPSC ring, the app threads enqueue, the resolver thread dequeues
+typedef struct {
+	uint32_t enqueuePos __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));
+	uint32_t dequeuePos __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));
+	uint32_t isIdle __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));	//set by the resolver thread when it finds the ring empty, the app thread that clears it writes eventFd
+	int eventFd;						//an eventfd in the epoll set of the resolver thread, see dnsEvent.c
+	dnsServiceSlot_t slot[DNS_SERVICE_RING_SIZE];
+} dnsServiceRequestRing_t;
+
+
+//SPSC ring per (app thread, resolver thread), the resolver thread produces, the app thread consumes
+typedef struct dnsServiceCompletionRing {
+	uint32_t head __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));		//written by the app thread
+	uint32_t tail __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));		//written by the resolver thread
+	uint32_t isIdle __attribute__((aligned(DNS_SERVICE_CACHE_LINE)));	//set by the app thread when it finds the ring empty, the resolver thread that clears it writes eventFd
+	int eventFd;						//an eventfd in the epoll set of the app thread while it has requests outstanding on the ring
+	dnsServiceRequest_t* pReq[DNS_SERVICE_RING_SIZE];
+} dnsServiceCompletionRing_t;
+
+
+//shall be called in a dedicated resolver thread, after dnsResolver_init() in the same thread
+osStatus_e dnsService_init();
+//shall be called in an app thread after all resolver threads have called dnsService_init()
+osStatus_e dnsService_initClient();
+bool dnsService_isClient();
+//passes the query to a resolver thread, always returns DNS_QUERY_STATUS_ONGOING unless the query can not be passed
+dnsQueryStatus_e dnsService_query(osPointerLen_t* qName, dnsQType_e qType, bool isResolveAll, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData);
+
+
+#endif
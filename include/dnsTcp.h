@@ -0,0 +1,58 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_TCP_H
+#define _DNS_TCP_H
+
+
+#include "osTypes.h"
+#include "osMBuf.h"
+
+#include "dnsResolver.h"
+#include "dnsTimerWheel.h"
+#include "dnsEvent.h"
+#include "dnsUdpPool.h"
+
+
+#define DNS_TCP_MAX_MSG_SIZE		65535	//the 2 bytes length prefix, rfc1035 section 4.2.2
+#define DNS_TCP_SEND_BUF_SIZE		16384	//queries queued on a connection that have not been written
+
+
+typedef enum {
+	DNS_TCP_CONN_STATE_CLOSED,
+	DNS_TCP_CONN_STATE_CONNECTING,
+	DNS_TCP_CONN_STATE_CONNECTED,
+} dnsTcpConnState_e;
+
+
+//one persistent connection per server per thread, the queries are pipelined on it, rfc7766 section 6.2.1
+typedef struct dnsTcpConn {
+	int fd;							//-1 when the connection is closed
+	uint32_t connId;				//changes each time the connection is opened, a query sent on an earlier connection is not counted in outstandingNum
+	dnsTcpConnState_e state;
+	dnsServerInfo_t* pServerInfo;
+	uint32_t outstandingNum;		//queries sent and not yet answered or abandoned, see dnsTcp_complete()
+	uint8_t* sendBuf;				//DNS_TCP_SEND_BUF_SIZE, the length prefixed queries in [sendPos, sendLen) are not written yet
+	size_t sendPos;
+	size_t sendLen;
+	uint8_t* recvBuf;				//2 + DNS_TCP_MAX_MSG_SIZE, holds a partially received response
+	size_t recvLen;
+	dnsTimerNode_t idleTimer;
+	dnsEventHandler_t eventHandler;	//in the per thread epoll set while the connection is open
+	uint32_t events;				//EPOLLIN, plus EPOLLOUT while connecting or having queries to write
+} dnsTcpConn_t;
+
+
+//shall be called per thread from dnsResolver_init().  recvCallback is called for each response received, pBuf is only valid during the callback
+osStatus_e dnsTcp_init(dnsUdpPool_recvCallback_h recvCallback);
+//returns the connection to the server, it is connected if it is not, NULL if the socket can not be created
+dnsTcpConn_t* dnsTcp_getConn(dnsServerInfo_t* pServerInfo);
+//queues pBuf->buf[0, pBuf->pos) with its length prefix, it is written once the connection is established
+osStatus_e dnsTcp_send(dnsTcpConn_t* pConn, osMBuf_t* pBuf);
+/* shall be called once for each query sent by dnsTcp_send(), when it is answered, or when it is abandoned, i.e., it
+ * times out or the query is freed.  connId is pConn->connId when the query is sent
+ */
+void dnsTcp_complete(dnsServerInfo_t* pServerInfo, uint32_t connId);
+
+
+#endif
@@ -0,0 +1,35 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_TIMER_WHEEL_H
+#define _DNS_TIMER_WHEEL_H
+
+
+#include "osTypes.h"
+
+
+#define DNS_TIMER_WHEEL_SLOT_NUM	512		//power of 2
+#define DNS_TIMER_WHEEL_TICK		10		//msec
+
+
+typedef void (*dnsTimerWheel_callback_h)(void* pData);
+
+
+//embedded in the object that needs a timer, the object shall be zero initialized
+typedef struct dnsTimerNode {
+	struct dnsTimerNode* prev;		//NULL when the timer is not running
+	struct dnsTimerNode* next;
+	uint64_t expireTick;
+	dnsTimerWheel_callback_h callback;
+	void* pData;
+} dnsTimerNode_t;
+
+
+//the wheel is per thread, a timer shall be started, stopped and fired in the same thread.  A running timer is restarted
+void dnsTimerWheel_start(dnsTimerNode_t* pNode, uint32_t msec, dnsTimerWheel_callback_h callback, void* pData);
+//no-op if the timer is not running
+void dnsTimerWheel_stop(dnsTimerNode_t* pNode);
+bool dnsTimerWheel_isRunning(dnsTimerNode_t* pNode);
+
+
+#endif
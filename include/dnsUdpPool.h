@@ -0,0 +1,86 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_UDP_POOL_H
+#define _DNS_UDP_POOL_H
+
+
+#include "osTypes.h"
+
+#include "dnsResolver.h"
+#include "dnsTimerWheel.h"
+
+
+#define DNS_UDP_PENDING_MIN_SIZE	1024	//power of 2
+#define DNS_UDP_TRID_MAX_TRY		16		//random IDs tried before giving up when they are all pending on a socket
+#define DNS_UDP_BATCH_SIZE			32		//messages per sendmmsg() or recvmmsg() when DNS_UDP_BATCH_IO is set
+
+
+typedef struct dnsUdpActiveFdInfo {
+	int fd;						//-1 when the socket has not been opened
+	uint32_t queryNum;			//queries sent on the socket since it was opened
+	bool isTpRegistered;		//the tp receives on the socket after the first message is sent through the tp
+	bool isUringArmed;			//the socket is received by the io_uring engine, see dnsUring.h
+} dnsUdpActiveFdInfo_t;
+
+
+//a query waiting to be flushed in batch
+typedef struct {
+	int fd;
+	uint16_t len;
+	uint8_t buf[DNS_MAX_MSG_SIZE];
+} dnsUdpSendSlot_t;
+
+
+typedef struct {
+	uint64_t sentNum;			//queries sent
+	uint64_t sendCallNum;		//sendmmsg(), transport_localSend() and io_uring_submit() calls used to send them
+	uint64_t recvNum;			//responses received
+	uint64_t recvCallNum;		//recvmmsg() calls, plus one read by the tp per response it passes.  The io_uring engine makes no receive call
+} dnsUdpIoStats_t;
+
+
+typedef void (*dnsUdpPool_recvCallback_h)(int fd, osMBuf_t* pBuf);
+
+
+//a socket that has been replaced, kept open until the responses of the queries sent on it are no longer waited for
+typedef struct {
+	int fd;
+	bool isUringArmed;
+	bool isTpRegistered;
+	dnsTimerNode_t closeTimer;
+} dnsUdpRetiredFdInfo_t;
+
+
+//open addressing with linear probing, indexed by (fd, trId), so that a response is matched from its first 2 bytes
+typedef struct {
+	uint32_t key;				//(fd << 16) | trId
+	dnsQCacheInfo_t* pQCache;	//NULL means the slot is empty
+} dnsUdpPendingSlot_t;
+
+
+//shall be called per thread from dnsResolver_init() for each server, after pServerInfo->socketAddr is set.  recvCallback is
+//called for the responses that are not received through the tp
+osStatus_e dnsUdpPool_init(dnsServerInfo_t* pServerInfo, dnsUdpPool_recvCallback_h recvCallback);
+//returns a random one of the sockets connected to the server, NULL if no socket can be opened
+dnsUdpActiveFdInfo_t* dnsUdpPool_getFd(dnsServerInfo_t* pServerInfo);
+//sends pBuf->buf[0, pBuf->pos) on the socket.  With DNS_UDP_BATCH_IO, the message is copied and flushed with other messages
+//sent in the same event loop iteration
+osStatus_e dnsUdpPool_send(dnsServerInfo_t* pServerInfo, dnsUdpActiveFdInfo_t* pFdInfo, osMBuf_t* pBuf);
+//shall be called after a response received on fd is processed.  With DNS_UDP_BATCH_IO, the other responses queued on the fd are
+//read in batch, and passed to recvCallback one by one, pBuf is only valid during the callback
+void dnsUdpPool_drain(int fd, dnsUdpPool_recvCallback_h recvCallback);
+void dnsUdpPool_getStats(dnsUdpIoStats_t* pStats);
+//the number of queries that are waiting for response in this thread
+uint32_t dnsUdpPool_getPendingNum();
+//allocates a random trId that is not pending on fd, and records pQCache as pending on (fd, *pTrId)
+osStatus_e dnsUdpPool_addPending(int fd, dnsQCacheInfo_t* pQCache, uint16_t* pTrId);
+//returns the query pending on (fd, trId), NULL if there is none.  The entry stays until dnsUdpPool_deletePending()
+dnsQCacheInfo_t* dnsUdpPool_lookupPending(int fd, uint16_t trId);
+//the entry is only deleted if it is still pQCache's, the fd may have been closed and reused by a new socket
+void dnsUdpPool_deletePending(int fd, uint16_t trId, dnsQCacheInfo_t* pQCache);
+//removes every entry pending on fd, shall be called before a udp or tcp fd is closed, the queries then time out
+void dnsUdpPool_purgePending(int fd);
+
+
+#endif
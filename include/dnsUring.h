@@ -0,0 +1,43 @@
+/* Copyright 2020, Sean Dai
+ */
+
+#ifndef _DNS_URING_H
+#define _DNS_URING_H
+
+
+#include "osTypes.h"
+#include "osMBuf.h"
+
+#include "dnsUdpPool.h"
+
+
+#define DNS_URING_QUEUE_DEPTH		256		//sqe and cqe entries of the ring
+#define DNS_URING_RECV_BUF_NUM		256		//power of 2, buffers provided to the multishot receives
+#define DNS_URING_SEND_SLOT_NUM		256		//sends that can be in flight at the same time
+#define DNS_URING_BUF_GROUP_ID		0
+
+
+typedef enum {
+	DNS_URING_OP_RECV = 1,
+	DNS_URING_OP_SEND,
+	DNS_URING_OP_CANCEL,
+} dnsUringOp_e;
+
+
+/* per thread.  Only available when the library is built with DNS_IO_URING=true, and the kernel supports the provided buffer
+ * ring and the multishot receive.  returns false if the engine is not used, the queries then go through the tp
+ * recvCallback is called for each response received, pBuf is only valid during the callback
+ */
+bool dnsUring_init(dnsUdpPool_recvCallback_h recvCallback);
+bool dnsUring_isActive();
+//arms a multishot receive on a newly opened socket
+osStatus_e dnsUring_addFd(int fd);
+//cancels the multishot receive, shall be called before the fd is closed, as the ring holds a reference of the socket
+void dnsUring_removeFd(int fd);
+//copies pBuf->buf[0, pBuf->pos), the sends of the same event loop iteration are submitted together
+osStatus_e dnsUring_send(int fd, osMBuf_t* pBuf);
+//io_uring_submit() calls, the only syscalls the engine makes per query
+uint64_t dnsUring_getSubmitNum();
+
+
+#endif
@@ -0,0 +1,263 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * implement a open addressing hash table used by the resolver's rr cache and query caches.  Each slot
+ * stores the 64 bit hash of the key inline next to the data pointer, so that a lookup walks a few
+ * adjacent slots, and only compares the normalized qName of the entry when the hash matches.  A slot
+ * is removed by shifting the following slots of the same probe chain backward, no tombstone is used.
+ */
+
+
+#include <string.h>
+
+#include "osMemory.h"
+#include "osPL.h"
+#include "osDebug.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsCacheTable.h"
+
+
+static uint64_t dnsCacheKey_hash(const uint8_t* name, uint8_t nameLen, uint16_t qType);
+static osStatus_e dnsCacheTable_resize(dnsCacheTable_t* pTable, uint32_t slotNum);
+static inline dnsCacheKey_t* dnsCacheTable_getKey(dnsCacheTable_t* pTable, void* pData);
+
+
+
+osStatus_e dnsCacheKey_build(osPointerLen_t* qName, dnsQType_e qType, dnsCacheKey_t* pKey)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	size_t nameLen = qName->l;
+	//a fully qualified name may end with '.'
+	if(nameLen && qName->p[nameLen-1] == '.')
+	{
+		nameLen--;
+	}
+
+	//the wire format, up to 255 octets, shall fit in pKey->nameLen
+	if(!nameLen || nameLen >= DNS_MAX_NAME_SIZE)
+	{
+		logError("qName(%r) size is 0 or not smaller than DNS_MAX_NAME_SIZE(%d).", qName, DNS_MAX_NAME_SIZE);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	size_t labelPos = 0;
+	size_t pos = 1;
+	for(int i=0; i<nameLen; i++)
+	{
+		char c = qName->p[i];
+		if(c == '.')
+		{
+			if(pos - labelPos == 1)
+			{
+				logError("qName(%r) has an empty label.", qName);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+			pKey->name[labelPos] = pos - labelPos - 1;
+			labelPos = pos++;
+			continue;
+		}
+
+		if(pos - labelPos > DNS_MAX_DOMAIN_NAME_LABEL_SIZE)
+		{
+			logError("qName(%r) has a label bigger than DNS_MAX_DOMAIN_NAME_LABEL_SIZE(%d).", qName, DNS_MAX_DOMAIN_NAME_LABEL_SIZE);
+			status = OS_ERROR_INVALID_VALUE;
+			goto EXIT;
+		}
+
+		pKey->name[pos++] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	}
+	pKey->name[labelPos] = pos - labelPos - 1;
+	pKey->name[pos++] = 0;
+
+	pKey->nameLen = pos;
+	pKey->qType = qType;
+	pKey->hash = dnsCacheKey_hash(pKey->name, pKey->nameLen, qType);
+
+EXIT:
+	return status;
+}
+
+
+osStatus_e dnsCacheTable_init(dnsCacheTable_t* pTable, uint32_t size, size_t keyOffset)
+{
+	uint32_t slotNum = DNS_CACHE_TABLE_MIN_SIZE;
+	while(slotNum < size)
+	{
+		slotNum <<= 1;
+	}
+
+	pTable->pSlot = NULL;
+	pTable->num = 0;
+	pTable->keyOffset = keyOffset;
+
+	return dnsCacheTable_resize(pTable, slotNum);
+}
+
+
+bool dnsCacheKey_isEqual(const dnsCacheKey_t* pKey1, const dnsCacheKey_t* pKey2)
+{
+	return pKey1->hash == pKey2->hash && pKey1->qType == pKey2->qType && pKey1->nameLen == pKey2->nameLen && memcmp(pKey1->name, pKey2->name, pKey1->nameLen) == 0;
+}
+
+
+void* dnsCacheTable_lookup(dnsCacheTable_t* pTable, const dnsCacheKey_t* pKey)
+{
+	uint32_t i = pKey->hash & pTable->mask;
+	while(pTable->pSlot[i].hash)
+	{
+		if(pTable->pSlot[i].hash == pKey->hash)
+		{
+			if(dnsCacheKey_isEqual(dnsCacheTable_getKey(pTable, pTable->pSlot[i].pData), pKey))
+			{
+				return pTable->pSlot[i].pData;
+			}
+		}
+
+		i = (i + 1) & pTable->mask;
+	}
+
+	return NULL;
+}
+
+
+osStatus_e dnsCacheTable_add(dnsCacheTable_t* pTable, void* pData)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	//keep the load factor under 3/4, so that the probe chains stay short
+	if((pTable->num + 1) * 4 > (pTable->mask + 1) * 3)
+	{
+		status = dnsCacheTable_resize(pTable, (pTable->mask + 1) * 2);
+		if(status != OS_STATUS_OK)
+		{
+			goto EXIT;
+		}
+	}
+
+	uint64_t hash = dnsCacheTable_getKey(pTable, pData)->hash;
+	uint32_t i = hash & pTable->mask;
+	while(pTable->pSlot[i].hash)
+	{
+		i = (i + 1) & pTable->mask;
+	}
+
+	pTable->pSlot[i].hash = hash;
+	pTable->pSlot[i].pData = pData;
+	pTable->num++;
+
+EXIT:
+	return status;
+}
+
+
+bool dnsCacheTable_delete(dnsCacheTable_t* pTable, void* pData)
+{
+	uint64_t hash = dnsCacheTable_getKey(pTable, pData)->hash;
+	uint32_t i = hash & pTable->mask;
+	while(pTable->pSlot[i].pData != pData)
+	{
+		if(!pTable->pSlot[i].hash)
+		{
+			return false;
+		}
+
+		i = (i + 1) & pTable->mask;
+	}
+
+	//shift back the following slots that would not be reachable from their home slot after slot i is emptied
+	uint32_t j = i;
+	while(true)
+	{
+		j = (j + 1) & pTable->mask;
+		if(!pTable->pSlot[j].hash)
+		{
+			break;
+		}
+
+		uint32_t home = pTable->pSlot[j].hash & pTable->mask;
+		//move slot j to i if home is not in the cyclic range (i, j]
+		if((j > i && (home <= i || home > j)) || (j < i && home <= i && home > j))
+		{
+			pTable->pSlot[i] = pTable->pSlot[j];
+			i = j;
+		}
+	}
+
+	pTable->pSlot[i].hash = 0;
+	pTable->pSlot[i].pData = NULL;
+	pTable->num--;
+
+	return true;
+}
+
+
+static osStatus_e dnsCacheTable_resize(dnsCacheTable_t* pTable, uint32_t slotNum)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	dnsCacheSlot_t* pSlot = oszalloc(sizeof(dnsCacheSlot_t) * slotNum, NULL);
+	if(!pSlot)
+	{
+		logError("fails to allocate %d slots.", slotNum);
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	uint32_t mask = slotNum - 1;
+	if(pTable->pSlot)
+	{
+		for(uint32_t i=0; i<=pTable->mask; i++)
+		{
+			if(!pTable->pSlot[i].hash)
+			{
+				continue;
+			}
+
+			uint32_t j = pTable->pSlot[i].hash & mask;
+			while(pSlot[j].hash)
+			{
+				j = (j + 1) & mask;
+			}
+			pSlot[j] = pTable->pSlot[i];
+		}
+
+		osfree(pTable->pSlot);
+	}
+
+	pTable->pSlot = pSlot;
+	pTable->mask = mask;
+
+EXIT:
+	return status;
+}
+
+
+static inline dnsCacheKey_t* dnsCacheTable_getKey(dnsCacheTable_t* pTable, void* pData)
+{
+	return (dnsCacheKey_t*)((char*)pData + pTable->keyOffset);
+}
+
+
+//FNV-1a over the wire name and qType, followed by a 64 bit finalizer so that the low bits used for the slot index are well mixed
+static uint64_t dnsCacheKey_hash(const uint8_t* name, uint8_t nameLen, uint16_t qType)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for(int i=0; i<nameLen; i++)
+	{
+		hash = (hash ^ name[i]) * 0x100000001b3ULL;
+	}
+	hash = (hash ^ qType) * 0x100000001b3ULL;
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	//0 is reserved for the empty slot
+	return hash ? hash : 1;
+}
@@ -11,6 +11,7 @@
 #include "osXmlParserIntf.h"
 #include "osConfig.h"
 
+#include "dnsResolverIntf.h"
 #include "dnsConfig.h"
 
 
@@ -23,12 +24,28 @@ osXmlData_t dnsConfig_xmlData[DNS_XML_MAX_DATA_NAME_NUM] = {
 	{DNS_XML_RESOLVER_IP,		{"DNS_RESOLVER_IP", sizeof("DNS_RESOLVER_IP")-1},		  OS_XML_DATA_TYPE_XS_STRING},
     {DNS_XML_Q_HASH_SIZE,       {"DNS_Q_HASH_SIZE", sizeof("DNS_Q_HASH_SIZE")-1},         OS_XML_DATA_TYPE_XS_LONG},
     {DNS_XML_RR_HASH_SIZE,      {"DNS_RR_HASH_SIZE", sizeof("DNS_RR_HASH_SIZE")-1},       OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_UDP_BATCH_IO,      {"DNS_UDP_BATCH_IO", sizeof("DNS_UDP_BATCH_IO")-1},       OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_HEDGE_BUDGET,      {"DNS_HEDGE_BUDGET", sizeof("DNS_HEDGE_BUDGET")-1},       OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_RR_CACHE_MODE,     {"DNS_RR_CACHE_MODE", sizeof("DNS_RR_CACHE_MODE")-1},     OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_MIN_RTO_TIMER,     {"DNS_MIN_RTO_TIMER", sizeof("DNS_MIN_RTO_TIMER")-1},     OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_MAX_RTO_TIMER,     {"DNS_MAX_RTO_TIMER", sizeof("DNS_MAX_RTO_TIMER")-1},     OS_XML_DATA_TYPE_XS_LONG},
     {DNS_XML_MAX_SERVER_NUM,    {"DNS_MAX_SERVER_NUM", sizeof("DNS_MAX_SERVER_NUM")-1},   OS_XML_DATA_TYPE_XS_SHORT},
     {DNS_XML_WAIT_RSP_TIMER,    {"DNS_WAIT_RSP_TIMER", sizeof("DNS_WAIT_RSP_TIMER")-1},   OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_TCP_IDLE_TIMER,    {"DNS_TCP_IDLE_TIMER", sizeof("DNS_TCP_IDLE_TIMER")-1},   OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_UDP_SOCKET_NUM,    {"DNS_UDP_SOCKET_NUM", sizeof("DNS_UDP_SOCKET_NUM")-1},   OS_XML_DATA_TYPE_XS_SHORT},
     {DNS_XML_SERVER_PRIORITY,   {"DNS_SERVER_PRIORITY", sizeof("DNS_SERVER_PRIORITY")-1}, OS_XML_DATA_TYPE_XS_SHORT},
 	{DNS_XML_SERVER_SEL_MODE,   {"DNS_SERVER_SEL_MODE", sizeof("DNS_SERVER_SEL_MODE")-1}, OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_RR_STALE_WINDOW,   {"DNS_RR_STALE_WINDOW", sizeof("DNS_RR_STALE_WINDOW")-1}, OS_XML_DATA_TYPE_XS_LONG},
     {DNS_XML_QUARANTINE_TIMER,      {"DNS_QUARANTINE_TIMER", sizeof("DNS_QUARANTINE_TIMER")-1}, OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_CLIENT_RSP_TIMER,      {"DNS_CLIENT_RSP_TIMER", sizeof("DNS_CLIENT_RSP_TIMER")-1}, OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_RR_CACHE_MAX_SIZE,     {"DNS_RR_CACHE_MAX_SIZE", sizeof("DNS_RR_CACHE_MAX_SIZE")-1}, OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_EDNS_PAYLOAD_SIZE,     {"DNS_EDNS_PAYLOAD_SIZE", sizeof("DNS_EDNS_PAYLOAD_SIZE")-1}, OS_XML_DATA_TYPE_XS_LONG},
+    {DNS_XML_RR_CACHE_SHARD_NUM,    {"DNS_RR_CACHE_SHARD_NUM", sizeof("DNS_RR_CACHE_SHARD_NUM")-1}, OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_RR_CACHE_ADMIT_FREQ,   {"DNS_RR_CACHE_ADMIT_FREQ", sizeof("DNS_RR_CACHE_ADMIT_FREQ")-1}, OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_RR_PREFETCH_PERCENT,   {"DNS_RR_PREFETCH_PERCENT", sizeof("DNS_RR_PREFETCH_PERCENT")-1}, OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_RR_CACHE_SWEEP_TIMER,  {"DNS_RR_CACHE_SWEEP_TIMER", sizeof("DNS_RR_CACHE_SWEEP_TIMER")-1}, OS_XML_DATA_TYPE_XS_LONG},
     {DNS_XML_QUARANTINE_THRESHOLD,  {"DNS_QUARANTINE_THRESHOLD", sizeof("DNS_QUARANTINE_THRESHOLD")-1}, OS_XML_DATA_TYPE_XS_SHORT},
+    {DNS_XML_UDP_SOCKET_MAX_QUERY,  {"DNS_UDP_SOCKET_MAX_QUERY", sizeof("DNS_UDP_SOCKET_MAX_QUERY")-1}, OS_XML_DATA_TYPE_XS_LONG},
     {DNS_XML_MAX_ALLOWED_SERVER_PER_QUERY,  {"DNS_MAX_ALLOWED_SERVER_PER_QUERY", sizeof("DNS_MAX_ALLOWED_SERVER_PER_QUERY")-1}, OS_XML_DATA_TYPE_XS_SHORT}};
 
 
@@ -39,6 +56,19 @@ static void dnsConfig_dbgList();
 
 static dnsConfig_t gDnsConfig;
 static int gMaxAllowedServerPerQuery, gWaitRspTimeout, gQuarantineTimeout, gQuarantineThreshold;
+static int gMinRto = 50;
+static int gMaxRto = 3000;
+static int gRRCacheAdmitFreq = 2;
+static int gRRCacheSweepTimeout = 1000;
+static int gRRPrefetchPercent = 10;
+static int gRRStaleWindow = 0;
+static int gClientRspTimeout = 1800;
+static int gUdpSocketNum = 4;
+static int gUdpSocketMaxQuery = 1000;
+static int gUdpBatchIo = 0;
+static int gEdnsPayloadSize = 0;
+static int gTcpIdleTimeout = 10000;
+static int gHedgeBudget = 0;
 
 
 
@@ -110,6 +140,21 @@ static void dnsConfig_xmlParseCB(osXmlData_t* pXmlValue, void* nsInfo, void* app
 
             mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
 			break;
+		case DNS_XML_RR_CACHE_MODE:
+			pDnsConfig->rrCacheMode = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+			break;
+		case DNS_XML_RR_CACHE_SHARD_NUM:
+			pDnsConfig->rrCacheShardNum = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+			break;
+		case DNS_XML_RR_CACHE_MAX_SIZE:
+			pDnsConfig->rrCacheMaxSize = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%ld", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pDnsConfig->rrCacheMaxSize);
+			break;
         case DNS_XML_Q_HASH_SIZE:
             pDnsConfig->qHashSize = pXmlValue->xmlInt;
 
@@ -187,6 +232,87 @@ debug("to-remove, fpServerIpPort->ip=%r", &fpServerIpPort->ip);
 		case DNS_XML_QUARANTINE_THRESHOLD:
             gQuarantineThreshold = pXmlValue->xmlInt;
 
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_RR_CACHE_ADMIT_FREQ:
+            gRRCacheAdmitFreq = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_RR_CACHE_SWEEP_TIMER:
+            gRRCacheSweepTimeout = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_RR_PREFETCH_PERCENT:
+			if(pXmlValue->xmlInt > 100)
+			{
+				logError("DNS_RR_PREFETCH_PERCENT(%d) is bigger than 100, ignored.", pXmlValue->xmlInt);
+				break;
+			}
+            gRRPrefetchPercent = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_RR_STALE_WINDOW:
+            gRRStaleWindow = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_CLIENT_RSP_TIMER:
+            gClientRspTimeout = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_UDP_SOCKET_NUM:
+			if(pXmlValue->xmlInt < 1)
+			{
+				logError("DNS_UDP_SOCKET_NUM(%d) is less than 1, ignored.", pXmlValue->xmlInt);
+				break;
+			}
+            gUdpSocketNum = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_UDP_SOCKET_MAX_QUERY:
+            gUdpSocketMaxQuery = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_UDP_BATCH_IO:
+            gUdpBatchIo = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_TCP_IDLE_TIMER:
+            gTcpIdleTimeout = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_MIN_RTO_TIMER:
+            gMinRto = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_MAX_RTO_TIMER:
+            gMaxRto = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_HEDGE_BUDGET:
+            gHedgeBudget = pXmlValue->xmlInt;
+
+            mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
+            break;
+		case DNS_XML_EDNS_PAYLOAD_SIZE:
+			//per rfc6891 section 6.2.5, a value less than 512 shall be treated as 512
+			if(pXmlValue->xmlInt && (pXmlValue->xmlInt < DNS_MAX_MSG_SIZE || pXmlValue->xmlInt > DNS_MAX_EDNS_PAYLOAD_SIZE))
+			{
+				logError("DNS_EDNS_PAYLOAD_SIZE(%d) is not within [%d, %d], ignored.", pXmlValue->xmlInt, DNS_MAX_MSG_SIZE, DNS_MAX_EDNS_PAYLOAD_SIZE);
+				break;
+			}
+            gEdnsPayloadSize = pXmlValue->xmlInt;
+
             mdebug(LM_DNS, "dataName=%r, value=%d", &dnsConfig_xmlData[pXmlValue->eDataName].dataName, pXmlValue->xmlInt);
             break;
 		case DNS_XML_MAX_ALLOWED_SERVER_PER_QUERY:
@@ -219,6 +345,18 @@ const int dnsConfig_getWaitRspTimeout()
 }
 
 
+const int dnsConfig_getMinRto()
+{
+	return gMinRto;
+}
+
+
+const int dnsConfig_getMaxRto()
+{
+	return gMaxRto;
+}
+
+
 const int dnsConfig_getQuarantineTimeout()
 {
 	return gQuarantineTimeout;
@@ -230,6 +368,73 @@ const int dnsConfig_getQuarantineThreshold()
 	return gQuarantineThreshold;
 }
 
+
+const int dnsConfig_getRRCacheAdmitFreq()
+{
+	return gRRCacheAdmitFreq;
+}
+
+
+const int dnsConfig_getRRCacheSweepTimeout()
+{
+	return gRRCacheSweepTimeout;
+}
+
+
+const int dnsConfig_getRRPrefetchPercent()
+{
+	return gRRPrefetchPercent;
+}
+
+
+const int dnsConfig_getRRStaleWindow()
+{
+	return gRRStaleWindow;
+}
+
+
+const int dnsConfig_getClientRspTimeout()
+{
+	return gClientRspTimeout;
+}
+
+
+const int dnsConfig_getUdpSocketNum()
+{
+	return gUdpSocketNum;
+}
+
+
+const int dnsConfig_getUdpSocketMaxQuery()
+{
+	return gUdpSocketMaxQuery;
+}
+
+
+const int dnsConfig_getUdpBatchIo()
+{
+	return gUdpBatchIo;
+}
+
+
+const int dnsConfig_getEdnsPayloadSize()
+{
+	return gEdnsPayloadSize;
+}
+
+
+const int dnsConfig_getTcpIdleTimeout()
+{
+	return gTcpIdleTimeout;
+}
+
+
+const int dnsConfig_getHedgeBudget()
+{
+	return gHedgeBudget;
+}
+
+
 struct sockaddr_in dnsConfig_getLocalSockAddr()
 {
 	return gDnsConfig.localSockAddr;
@@ -241,8 +446,13 @@ static void dnsConfig_dbgList()
 	mdebug(LM_DNS, "DNS resolver configuration:");
 	mdebug1(LM_DNS, "local address=%A\n", &gDnsConfig.localSockAddr);
 	mdebug1(LM_DNS, "rr hash size=%d\nq hash size=%d.\n", gDnsConfig.rrHashSize, gDnsConfig.qHashSize);
+	mdebug1(LM_DNS, "rr cache mode=%d\nrr cache shard num=%d\n", gDnsConfig.rrCacheMode, gDnsConfig.rrCacheShardNum);
+	mdebug1(LM_DNS, "rr cache max size=%ld bytes\nrr cache admission frequency=%d\n", gDnsConfig.rrCacheMaxSize, gRRCacheAdmitFreq);
+	mdebug1(LM_DNS, "rr cache sweep timeout=%d msec\nrr prefetch percent=%d\n", gRRCacheSweepTimeout, gRRPrefetchPercent);
+	mdebug1(LM_DNS, "rr stale window=%d sec\nclient response timeout=%d msec\n", gRRStaleWindow, gClientRspTimeout);
+	mdebug1(LM_DNS, "udp socket num per server=%d\nudp socket max query=%d\nudp batch io=%d\nedns payload size=%d\ntcp idle timeout=%d msec\n", gUdpSocketNum, gUdpSocketMaxQuery, gUdpBatchIo, gEdnsPayloadSize, gTcpIdleTimeout);
 	mdebug1(LM_DNS, "the max number of server the dns resolver will try for a query=%d.\n", gMaxAllowedServerPerQuery);
-	mdebug1(LM_DNS, "wait response timeout=%d msec\n", gWaitRspTimeout);
+	mdebug1(LM_DNS, "wait response timeout=%d msec\nmin rto=%d msec\nmax rto=%d msec\nhedge budget=%d per sec\n", gWaitRspTimeout, gMinRto, gMaxRto, gHedgeBudget);
 	mdebug1(LM_DNS, "server into quarantine threshold=%d\nquarantine timeout=%d sec\n", gQuarantineThreshold, gQuarantineTimeout); 	 
 	mdebug1(LM_DNS, "server selection mode=%d\nserver Num=%d\n", gDnsConfig.serverSelMode, gDnsConfig.serverNum);
 	for(int i=0; i<gDnsConfig.serverNum; i++)
@@ -0,0 +1,166 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * the fds the resolver owns and the tp does not receive on, the tcp connections, the request ring of a resolver
+ * thread, the inflight mailbox and the completion rings of an app thread, are in a per thread epoll set.  The event
+ * loop belongs to the os library, so the app adds the epoll fd, see dnsResolver_getEventFd(), to the event loop of
+ * the thread, and calls dnsResolver_onEvent() when it is readable.  If the app never asks for the epoll fd, it is
+ * polled every DNS_EVENT_POLL_TIMEOUT msec while it has fds, the way the library worked before.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "osDebug.h"
+#include "osTimer.h"
+
+#include "dnsEvent.h"
+
+
+static __thread int gEpollFd = -1;
+static __thread uint32_t gFdNum;
+static __thread bool gIsWatched;			//the app watches gEpollFd, no polling
+static __thread uint64_t gPollTimerId;
+
+static void dnsEvent_schedPoll();
+static void dns_onEventPollTimeout(uint64_t timerId, void* ptr);
+
+
+
+osStatus_e dnsEvent_init()
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	if(gEpollFd >= 0)
+	{
+		goto EXIT;
+	}
+
+	gEpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(gEpollFd < 0)
+	{
+		logError("fails to epoll_create1, errno=%d.", errno);
+		status = OS_ERROR_SYSTEM_FAILURE;
+		goto EXIT;
+	}
+
+EXIT:
+	return status;
+}
+
+
+osStatus_e dnsEvent_add(dnsEventHandler_t* pHandler, uint32_t events)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	struct epoll_event event = {.events = events, .data.ptr = pHandler};
+	if(epoll_ctl(gEpollFd, EPOLL_CTL_ADD, pHandler->fd, &event) != 0)
+	{
+		logError("fails to add fd(%d) to epoll fd(%d), errno=%d.", pHandler->fd, gEpollFd, errno);
+		status = OS_ERROR_SYSTEM_FAILURE;
+		goto EXIT;
+	}
+
+	gFdNum++;
+	dnsEvent_schedPoll();
+
+EXIT:
+	return status;
+}
+
+
+osStatus_e dnsEvent_modify(dnsEventHandler_t* pHandler, uint32_t events)
+{
+	struct epoll_event event = {.events = events, .data.ptr = pHandler};
+	if(epoll_ctl(gEpollFd, EPOLL_CTL_MOD, pHandler->fd, &event) != 0)
+	{
+		logError("fails to modify fd(%d) in epoll fd(%d), errno=%d.", pHandler->fd, gEpollFd, errno);
+		return OS_ERROR_SYSTEM_FAILURE;
+	}
+
+	return OS_STATUS_OK;
+}
+
+
+//an event already returned for pHandler in the current dnsEvent_process() is dropped, as its fd is -1
+void dnsEvent_remove(dnsEventHandler_t* pHandler)
+{
+	if(pHandler->fd < 0)
+	{
+		return;
+	}
+
+	if(epoll_ctl(gEpollFd, EPOLL_CTL_DEL, pHandler->fd, NULL) != 0)
+	{
+		logError("fails to remove fd(%d) from epoll fd(%d), errno=%d.", pHandler->fd, gEpollFd, errno);
+	}
+	else if(gFdNum)
+	{
+		gFdNum--;
+	}
+
+	pHandler->fd = -1;
+}
+
+
+int dnsEvent_getFd()
+{
+	gIsWatched = true;
+	if(gPollTimerId)
+	{
+		osStopTimer(gPollTimerId);
+		gPollTimerId = 0;
+	}
+
+	return gEpollFd;
+}
+
+
+void dnsEvent_process()
+{
+	struct epoll_event event[DNS_EVENT_MAX_NUM];
+	int eventNum = epoll_wait(gEpollFd, event, DNS_EVENT_MAX_NUM, 0);
+	if(eventNum < 0 && errno != EINTR)
+	{
+		logError("fails to epoll_wait on fd(%d), errno=%d.", gEpollFd, errno);
+	}
+
+	for(int i=0; i<eventNum; i++)
+	{
+		dnsEventHandler_t* pHandler = event[i].data.ptr;
+		if(pHandler->fd < 0)
+		{
+			continue;
+		}
+
+		pHandler->callback(pHandler->fd, event[i].events, pHandler->pData);
+	}
+}
+
+
+static void dnsEvent_schedPoll()
+{
+	if(gIsWatched || gPollTimerId || !gFdNum)
+	{
+		return;
+	}
+
+	gPollTimerId = osStartTimer(DNS_EVENT_POLL_TIMEOUT, dns_onEventPollTimeout, NULL);
+}
+
+
+static void dns_onEventPollTimeout(uint64_t timerId, void* ptr)
+{
+	if(gPollTimerId != timerId)
+	{
+		logError("gPollTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", gPollTimerId, timerId);
+		return;
+	}
+	gPollTimerId = 0;
+
+	dnsEvent_process();
+
+	dnsEvent_schedPoll();
+}
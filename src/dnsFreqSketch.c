@@ -0,0 +1,105 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * implement a count-min sketch used by the rr cache to decide whether a response is worth caching.
+ * The key hash is split into two 32 bit halves, the counter of row i is picked by (h1 + i*h2), so
+ * one 64 bit hash gives DNS_FREQ_SKETCH_DEPTH independent enough indexes.
+ */
+
+
+#include <string.h>
+
+#include "osMemory.h"
+#include "osDebug.h"
+
+#include "dnsFreqSketch.h"
+
+
+static inline uint32_t dnsFreqSketch_getIdx(dnsFreqSketch_t* pSketch, uint64_t hash, int row);
+static void dnsFreqSketch_halve(dnsFreqSketch_t* pSketch);
+
+
+
+osStatus_e dnsFreqSketch_init(dnsFreqSketch_t* pSketch, uint32_t size)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	uint32_t width = DNS_FREQ_SKETCH_MIN_WIDTH;
+	while(width < size)
+	{
+		width <<= 1;
+	}
+
+	pSketch->pCounter = oszalloc(DNS_FREQ_SKETCH_DEPTH * width, NULL);
+	if(!pSketch->pCounter)
+	{
+		logError("fails to allocate pCounter, width=%d.", width);
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	pSketch->mask = width - 1;
+	//remember about 10 times more keys than being tracked before fading the counters
+	pSketch->sampleSize = width * 10;
+	pSketch->addNum = 0;
+
+EXIT:
+	return status;
+}
+
+
+void dnsFreqSketch_increment(dnsFreqSketch_t* pSketch, uint64_t hash)
+{
+	for(int i=0; i<DNS_FREQ_SKETCH_DEPTH; i++)
+	{
+		uint8_t* pCounter = &pSketch->pCounter[dnsFreqSketch_getIdx(pSketch, hash, i)];
+		uint8_t count = __atomic_load_n(pCounter, __ATOMIC_RELAXED);
+		if(count < DNS_FREQ_SKETCH_MAX_FREQ)
+		{
+			__atomic_store_n(pCounter, count + 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	//only the thread that reaches the sample size does the halving
+	if(__atomic_add_fetch(&pSketch->addNum, 1, __ATOMIC_RELAXED) == pSketch->sampleSize)
+	{
+		dnsFreqSketch_halve(pSketch);
+	}
+}
+
+
+uint8_t dnsFreqSketch_estimate(dnsFreqSketch_t* pSketch, uint64_t hash)
+{
+	uint8_t freq = DNS_FREQ_SKETCH_MAX_FREQ;
+	for(int i=0; i<DNS_FREQ_SKETCH_DEPTH; i++)
+	{
+		uint8_t count = __atomic_load_n(&pSketch->pCounter[dnsFreqSketch_getIdx(pSketch, hash, i)], __ATOMIC_RELAXED);
+		if(count < freq)
+		{
+			freq = count;
+		}
+	}
+
+	return freq;
+}
+
+
+static inline uint32_t dnsFreqSketch_getIdx(dnsFreqSketch_t* pSketch, uint64_t hash, int row)
+{
+	uint32_t h1 = hash;
+	uint32_t h2 = (hash >> 32) | 1;
+
+	return ((h1 + row * h2) & pSketch->mask) + row * (pSketch->mask + 1);
+}
+
+
+static void dnsFreqSketch_halve(dnsFreqSketch_t* pSketch)
+{
+	uint32_t counterNum = DNS_FREQ_SKETCH_DEPTH * (pSketch->mask + 1);
+	for(uint32_t i=0; i<counterNum; i++)
+	{
+		uint8_t count = __atomic_load_n(&pSketch->pCounter[i], __ATOMIC_RELAXED);
+		__atomic_store_n(&pSketch->pCounter[i], count >> 1, __ATOMIC_RELAXED);
+	}
+
+	__atomic_store_n(&pSketch->addNum, 0, __ATOMIC_RELAXED);
+}
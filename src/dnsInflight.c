@@ -0,0 +1,365 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * coalesce the same query from different threads when the rr cache is shared.  The first thread that
+ * misses the rr cache owns the query and sends it to the dns server.  Other threads register as waiters
+ * of the owner's query.  When the query is done, the owner passes a referred dnsMsg to each waiter's
+ * mailbox, and the waiter thread picks it up in its own event loop.  The eventfd of the mailbox is in the epoll
+ * set of the waiter thread while it has waiters outstanding, see dnsEvent.c, and is only written by the owner
+ * thread that finds the mailbox empty.
+ */
+
+
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "osMemory.h"
+#include "osPL.h"
+#include "osDebug.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsConfig.h"
+#include "dnsCacheTable.h"
+#include "dnsRRCache.h"
+#include "dnsEvent.h"
+#include "dnsInflight.h"
+
+
+static dnsInflightShard_t* gInflightShard;
+static uint32_t gInflightShardNum;
+static pthread_once_t gInflightOnce = PTHREAD_ONCE_INIT;
+static osStatus_e gInflightStatus;
+
+static __thread dnsInflightMailbox_t* gpMailbox;
+static __thread dnsInflight_resultCallback_h gResultCallback;
+static __thread int gWaiterNum;				//waiters of this thread that have not been passed back
+static __thread dnsEventHandler_t gMailboxHandler;
+
+static void dnsInflight_initShared();
+static dnsInflightShard_t* dnsInflight_getShard(const dnsCacheKey_t* pKey);
+static void dnsInflight_postMailbox(dnsInflightWaiter_t* pWaiter);
+static void dnsInflight_watchMailbox(bool isWatch);
+static void dns_onMailboxEvent(int fd, uint32_t events, void* pData);
+
+
+
+osStatus_e dnsInflight_init(dnsInflight_resultCallback_h resultCallback)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	pthread_once(&gInflightOnce, dnsInflight_initShared);
+	if(gInflightStatus != OS_STATUS_OK)
+	{
+		logError("fails to create the shared inflight query table.");
+		status = gInflightStatus;
+		goto EXIT;
+	}
+
+	//the mailbox is accessed by other threads, it is never freed
+	gpMailbox = oszalloc(sizeof(dnsInflightMailbox_t), NULL);
+	if(!gpMailbox)
+	{
+		logError("fails to allocate gpMailbox.");
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	gpMailbox->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(gpMailbox->eventFd < 0)
+	{
+		logError("fails to create the eventfd of gpMailbox, errno=%d.", errno);
+		gpMailbox = osfree(gpMailbox);
+		status = OS_ERROR_SYSTEM_FAILURE;
+		goto EXIT;
+	}
+
+	//only in the epoll set while the thread has waiters, see dnsInflight_watchMailbox()
+	gMailboxHandler.fd = -1;
+	gMailboxHandler.callback = dns_onMailboxEvent;
+	gMailboxHandler.pData = gpMailbox;
+
+	gResultCallback = resultCallback;
+
+EXIT:
+	return status;
+}
+
+
+dnsInflightRole_e dnsInflight_join(dnsQCacheInfo_t* pQCache)
+{
+	dnsInflightRole_e role = DNS_INFLIGHT_ROLE_OWNER;
+
+	dnsInflightShard_t* pShard = dnsInflight_getShard(&pQCache->key);
+
+	pthread_mutex_lock(&pShard->lock);
+
+	dnsInflight_t* pInflight = dnsCacheTable_lookup(&pShard->table, &pQCache->key);
+	if(pInflight)
+	{
+		dnsInflightWaiter_t* pWaiter = oszalloc(sizeof(dnsInflightWaiter_t), NULL);
+		if(!pWaiter)
+		{
+			//perform the query by itself
+			logError("fails to allocate pWaiter, qName(%r), qType(%d).", &pQCache->qName.pl, pQCache->qType);
+			goto EXIT;
+		}
+
+		pWaiter->pMailbox = gpMailbox;
+		pWaiter->pQCache = pQCache;
+		pWaiter->next = pInflight->pWaiter;
+		pInflight->pWaiter = pWaiter;
+
+		pQCache->pInflightWaiter = pWaiter;
+		role = DNS_INFLIGHT_ROLE_WAITER;
+
+		//start watching the mailbox when the first waiter of this thread is added
+		if(gWaiterNum++ == 0)
+		{
+			dnsInflight_watchMailbox(true);
+		}
+		goto EXIT;
+	}
+
+	pInflight = oszalloc(sizeof(dnsInflight_t), NULL);
+	if(!pInflight)
+	{
+		//perform the query without sharing
+		logError("fails to allocate pInflight, qName(%r), qType(%d).", &pQCache->qName.pl, pQCache->qType);
+		goto EXIT;
+	}
+
+	pInflight->key = pQCache->key;
+	pInflight->pShard = pShard;
+	if(dnsCacheTable_add(&pShard->table, pInflight) != OS_STATUS_OK)
+	{
+		logError("fails to add pInflight to the table, qName(%r), qType(%d).", &pQCache->qName.pl, pQCache->qType);
+		osfree(pInflight);
+		goto EXIT;
+	}
+
+	pQCache->pInflight = pInflight;
+
+EXIT:
+	pthread_mutex_unlock(&pShard->lock);
+
+	debug("qName(%r), qType(%d), inflight role=%d.", &pQCache->qName.pl, pQCache->qType, role);
+	return role;
+}
+
+
+void dnsInflight_complete(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg)
+{
+	dnsInflight_t* pInflight = pQCache->pInflight;
+	if(!pInflight)
+	{
+		return;
+	}
+
+	pQCache->pInflight = NULL;
+
+	//fill the results under the lock, a waiter that times out at the same time checks the list under the same lock
+	dnsInflightShard_t* pShard = pInflight->pShard;
+	pthread_mutex_lock(&pShard->lock);
+
+	dnsCacheTable_delete(&pShard->table, pInflight);
+
+	dnsInflightWaiter_t* pWaiter = pInflight->pWaiter;
+	pInflight->pWaiter = NULL;
+	for(dnsInflightWaiter_t* pCur = pWaiter; pCur; pCur = pCur->next)
+	{
+		pCur->rrStatus = rrStatus;
+		pCur->pDnsMsg = dnsMessage_ref(pDnsMsg);
+	}
+
+	pthread_mutex_unlock(&pShard->lock);
+
+	while(pWaiter)
+	{
+		dnsInflightWaiter_t* pNext = pWaiter->next;
+		dnsInflight_postMailbox(pWaiter);
+		pWaiter = pNext;
+	}
+
+	osfree(pInflight);
+}
+
+
+void dnsInflight_leave(dnsQCacheInfo_t* pQCache)
+{
+	dnsInflightWaiter_t* pWaiter = pQCache->pInflightWaiter;
+	if(!pWaiter)
+	{
+		return;
+	}
+
+	pQCache->pInflightWaiter = NULL;
+
+	dnsInflightShard_t* pShard = dnsInflight_getShard(&pQCache->key);
+
+	pthread_mutex_lock(&pShard->lock);
+
+	bool isRemoved = false;
+	dnsInflight_t* pInflight = dnsCacheTable_lookup(&pShard->table, &pQCache->key);
+	if(pInflight)
+	{
+		for(dnsInflightWaiter_t** ppCur = &pInflight->pWaiter; *ppCur; ppCur = &(*ppCur)->next)
+		{
+			if(*ppCur == pWaiter)
+			{
+				*ppCur = pWaiter->next;
+				isRemoved = true;
+				break;
+			}
+		}
+	}
+
+	//the owner has already passed the waiter to the mailbox, dns_onMailboxEvent() will free it
+	if(!isRemoved)
+	{
+		pWaiter->pQCache = NULL;
+	}
+
+	pthread_mutex_unlock(&pShard->lock);
+
+	if(isRemoved)
+	{
+		osfree(pWaiter);
+		if(--gWaiterNum == 0)
+		{
+			dnsInflight_watchMailbox(false);
+		}
+	}
+}
+
+
+static void dnsInflight_initShared()
+{
+	const dnsConfig_t* pDnsConfig = dns_getConfig();
+
+	//use the same number of shards as the rr cache
+	gInflightShardNum = 1;
+	while(gInflightShardNum < pDnsConfig->rrCacheShardNum && gInflightShardNum < DNS_RR_CACHE_MAX_SHARD_NUM)
+	{
+		gInflightShardNum <<= 1;
+	}
+
+	gInflightShard = oszalloc(sizeof(dnsInflightShard_t) * gInflightShardNum, NULL);
+	if(!gInflightShard)
+	{
+		logError("fails to allocate gInflightShard.");
+		gInflightStatus = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		return;
+	}
+
+	for(int i=0; i<gInflightShardNum; i++)
+	{
+		pthread_mutex_init(&gInflightShard[i].lock, NULL);
+		gInflightStatus = dnsCacheTable_init(&gInflightShard[i].table, pDnsConfig->qHashSize / gInflightShardNum + 1, offsetof(dnsInflight_t, key));
+		if(gInflightStatus != OS_STATUS_OK)
+		{
+			logError("fails to create table for inflight shard %d.", i);
+			return;
+		}
+	}
+}
+
+
+static dnsInflightShard_t* dnsInflight_getShard(const dnsCacheKey_t* pKey)
+{
+	return &gInflightShard[(pKey->hash >> 32) & (gInflightShardNum - 1)];
+}
+
+
+//may be called from any thread.  Only the push that finds the mailbox empty pays for the write(), the waiter thread
+//has not popped the waiters already in the mailbox, and will pop this one with them
+static void dnsInflight_postMailbox(dnsInflightWaiter_t* pWaiter)
+{
+	dnsInflightMailbox_t* pMailbox = pWaiter->pMailbox;
+
+	pWaiter->next = __atomic_load_n(&pMailbox->pHead, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&pMailbox->pHead, &pWaiter->next, pWaiter, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	if(pWaiter->next)
+	{
+		return;
+	}
+
+	uint64_t value = 1;
+	if(write(pMailbox->eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to write the eventfd(%d) of the mailbox, errno=%d.", pMailbox->eventFd, errno);
+	}
+}
+
+
+//the mailbox is only in the epoll set while the thread has waiters, so that the epoll fd is not polled for nothing
+//when the app does not watch it, see dnsEvent.c
+static void dnsInflight_watchMailbox(bool isWatch)
+{
+	if(!isWatch)
+	{
+		dnsEvent_remove(&gMailboxHandler);
+		return;
+	}
+
+	gMailboxHandler.fd = gpMailbox->eventFd;
+	if(dnsEvent_add(&gMailboxHandler, EPOLLIN) != OS_STATUS_OK)
+	{
+		//the waiters give up when their wait timer expires
+		logError("fails to dnsEvent_add for the eventfd of gpMailbox.");
+		gMailboxHandler.fd = -1;
+	}
+}
+
+
+static void dns_onMailboxEvent(int fd, uint32_t events, void* pData)
+{
+	dnsInflightMailbox_t* pMailbox = pData;
+
+	//read before the mailbox is popped, a waiter posted after the pop finds the mailbox empty and writes again
+	uint64_t value;
+	if(read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to read the eventfd(%d) of the mailbox, errno=%d.", fd, errno);
+	}
+
+	dnsInflightWaiter_t* pWaiter = __atomic_exchange_n(&pMailbox->pHead, NULL, __ATOMIC_ACQUIRE);
+
+	//the stack pops the latest first, reverse it so that waiters are notified in the order they were posted
+	dnsInflightWaiter_t* pFifo = NULL;
+	while(pWaiter)
+	{
+		dnsInflightWaiter_t* pNext = pWaiter->next;
+		pWaiter->next = pFifo;
+		pFifo = pWaiter;
+		pWaiter = pNext;
+	}
+
+	while(pFifo)
+	{
+		pWaiter = pFifo;
+		pFifo = pFifo->next;
+
+		//pQCache == NULL when the waiter has given up
+		if(pWaiter->pQCache)
+		{
+			pWaiter->pQCache->pInflightWaiter = NULL;
+			gResultCallback(pWaiter->pQCache, pWaiter->rrStatus, pWaiter->pDnsMsg);
+		}
+
+		dnsMessage_free(pWaiter->pDnsMsg);
+		osfree(pWaiter);
+		--gWaiterNum;
+	}
+
+	if(gWaiterNum == 0)
+	{
+		dnsInflight_watchMailbox(false);
+	}
+}
+
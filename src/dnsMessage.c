@@ -0,0 +1,723 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * the wire format of a dns response, rfc1035 section 4.  A response is parsed into one dnsMessage_t, with its rr
+ * arrays, its rr index and a copy of its wire in one arena.  The header and the question are parsed at once, the rr
+ * are only indexed, and a section is decoded when it is read.  The rdata names and strings are views into the wire.
+ * The parsing only depends on the os library, so it is fuzzed and benchmarked on its own, see test/.
+ */
+
+
+#include <endian.h>
+#include <string.h>
+
+#include "osMemory.h"
+#include "osMBuf.h"
+#include "osList.h"
+#include "osPL.h"
+#include "osDebug.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsCacheTable.h"
+#include "dnsName.h"
+
+
+static __thread dnsParseStats_t gParseStats;
+
+static osStatus_e dnsParseQuestion(osMBuf_t* pBuf, dnsQuestion_t* pQuery);
+static osStatus_e dnsParseRR(osMBuf_t* pBuf, dnsMessage_t* pDnsMsg, dnsRR_t* pRR);
+static osStatus_e dnsIndexRR(osMBuf_t* pBuf, dnsMessage_t* pDnsMsg, bool isAddtl, uint16_t* pRROffNum);
+static inline uint16_t dnsGetU16(osMBuf_t* pBuf);
+static inline uint32_t dnsGetU32(osMBuf_t* pBuf);
+static void* dnsMessage_alloc(dnsMessage_t* pDnsMsg, size_t size);
+static osStatus_e dnsParseName(osMBuf_t* pBuf, uint16_t* pOffset);
+static osPointerLen_t dnsMessage_getString(const dnsMessage_t* pDnsMsg, uint16_t offset);
+static osPointerLen_t dnsMessage_getName(const dnsMessage_t* pDnsMsg, uint16_t offset, char* name);
+
+
+
+/* pExpectKey is the key of the query the response is matched to by its trId, the rr are only indexed when the question matches
+ * it.  It is NULL when the response is not matched to a query, e.g., in the harness under test/.  One pass over the rr validates
+ * their framing and records their offsets, the rr are decoded by dnsMessage_getSection() when a section is read, so the sections
+ * nobody reads, like the auth of a positive response or the glue of an A response, are never decoded
+ */
+dnsMessage_t* dnsMessage_parse(osMBuf_t* pBuf, const dnsCacheKey_t* pExpectKey, dnsRcode_e* replyCode)
+{
+	DEBUG_BEGIN
+	osStatus_e status = OS_STATUS_OK;
+	dnsMessage_t* pDnsMsg = NULL;
+	dnsHdr_t hdr;
+
+	if(pBuf->pos + sizeof(dnsHdr_t) > pBuf->size)
+	{
+		logInfo("the response of %ld bytes is shorter than a dns header.", pBuf->size);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	hdr.trId = dnsGetU16(pBuf);
+	hdr.flags = dnsGetU16(pBuf);
+	*replyCode = hdr.flags & DNS_RCODE_MASK;
+	if(*replyCode == DNS_RCODE_FORMAT_ERROR)
+	{
+		logInfo("dns server returns format error for the query, trId=%d", hdr.trId);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	hdr.qdCount = dnsGetU16(pBuf);
+	if(hdr.qdCount != 1)
+	{
+		logError("only support hdr.qdCount = 1, but the received hdr.qdCount=%d.", hdr.qdCount);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+    hdr.anCount = dnsGetU16(pBuf);
+    hdr.nsCount = dnsGetU16(pBuf);
+    hdr.arCount = dnsGetU16(pBuf);
+
+	//the counts come from the wire, the arena is bound by the rr the datagram can actually hold
+	uint32_t rrNum = hdr.anCount + hdr.nsCount + hdr.arCount;
+	if(rrNum > (pBuf->size - pBuf->pos) / DNS_MIN_RR_SIZE)
+	{
+		logInfo("the response claims %d rr, more than its %ld bytes can hold, trId=%d.", rrNum, pBuf->size, hdr.trId);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	//one allocation for the message, its rr, its rr index and its wire, the arena is not zeroed, a rr is filled when its section is decoded
+	uint32_t arenaSize = rrNum * (sizeof(dnsRR_t) + sizeof(uint16_t)) + pBuf->size;
+	pDnsMsg = osmalloc(sizeof(dnsMessage_t) + arenaSize, NULL);
+	if(!pDnsMsg)
+	{
+		logError("fails to osmalloc for dnsMessage_t, arenaSize=%d.", arenaSize);
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+	gParseStats.allocNum++;
+
+	memset(pDnsMsg, 0, sizeof(dnsMessage_t));
+	pDnsMsg->refNum = 1;
+	pDnsMsg->hdr = hdr;
+	pDnsMsg->arenaSize = arenaSize;
+
+	//the rr arrays are carved first, the wire after them is not aligned
+	pDnsMsg->answer = dnsMessage_alloc(pDnsMsg, hdr.anCount * sizeof(dnsRR_t));
+	pDnsMsg->auth = dnsMessage_alloc(pDnsMsg, hdr.nsCount * sizeof(dnsRR_t));
+	pDnsMsg->addtlAnswer = dnsMessage_alloc(pDnsMsg, hdr.arCount * sizeof(dnsRR_t));
+	pDnsMsg->rrOff = dnsMessage_alloc(pDnsMsg, rrNum * sizeof(uint16_t));
+
+	//pBuf is released or reused once the response is processed, the message keeps the wire its views point into
+	pDnsMsg->wire = dnsMessage_alloc(pDnsMsg, pBuf->size);
+	pDnsMsg->wireLen = pBuf->size;
+	memcpy(pDnsMsg->wire, pBuf->buf, pBuf->size);
+
+	status = dnsParseQuestion(pBuf, &pDnsMsg->query);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsParseQuestion.");
+		goto EXIT;
+	}
+
+	osPointerLen_t qName = {pDnsMsg->query.qName, strlen(pDnsMsg->query.qName)};
+	dnsCacheKey_t qKey;
+	status = dnsCacheKey_build(&qName, pDnsMsg->query.qType, &qKey);
+	if(status != OS_STATUS_OK || (pExpectKey && !dnsCacheKey_isEqual(&qKey, pExpectKey)))
+	{
+		logInfo("the question qName(%r), qType(%d) does not match the pending query, trId=%d.", &qName, pDnsMsg->query.qType, hdr.trId);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	//the rr are indexed in the wire order, the OPT rr is consumed by dnsIndexRR() and not indexed, a response with an OPT rr
+	//outside the additional section, or with more than one, is malformed
+	uint16_t rrOffNum = 0;
+	for(int i=0; i<rrNum; i++)
+	{
+		status = dnsIndexRR(pBuf, pDnsMsg, i >= hdr.anCount + hdr.nsCount, &rrOffNum);
+    	if(status != OS_STATUS_OK)
+    	{
+        	logError("fails to dnsIndexRR for the %d-th rr.", i);
+        	goto EXIT;
+    	}
+
+		if(i+1 == hdr.anCount)
+		{
+			pDnsMsg->answerNum = rrOffNum;
+		}
+		else if(i+1 == hdr.anCount + hdr.nsCount)
+		{
+			pDnsMsg->authNum = rrOffNum - pDnsMsg->answerNum;
+		}
+	}
+	pDnsMsg->addtlAnswerNum = rrOffNum - pDnsMsg->answerNum - pDnsMsg->authNum;
+
+EXIT:
+	if(status != OS_STATUS_OK)
+	{
+		pDnsMsg = dnsMessage_free(pDnsMsg);
+	}
+	else
+	{
+		gParseStats.msgNum++;
+	}
+
+	DEBUG_END
+	return pDnsMsg;
+}
+
+
+/* checks the header and the question of a response without parsing its rr, for a truncated response whose rr are not used.
+ * true if it is a response, and its single question matches pExpectKey
+ */
+bool dnsMessage_isQuestionMatch(const osMBuf_t* pBuf, const dnsCacheKey_t* pExpectKey)
+{
+	osMBuf_t mBuf = *pBuf;
+	if(mBuf.pos + sizeof(dnsHdr_t) > mBuf.size)
+	{
+		return false;
+	}
+
+	mBuf.pos += sizeof(uint16_t);	//trId
+	uint16_t flags = dnsGetU16(&mBuf);
+	uint16_t qdCount = dnsGetU16(&mBuf);
+	if(!(flags & DNS_QR_MASK) || qdCount != 1)
+	{
+		return false;
+	}
+
+	mBuf.pos += 3 * sizeof(uint16_t);	//anCount, nsCount, arCount
+	dnsQuestion_t question;
+	if(dnsParseQuestion(&mBuf, &question) != OS_STATUS_OK)
+	{
+		return false;
+	}
+
+	osPointerLen_t qName = {question.qName, strlen(question.qName)};
+	dnsCacheKey_t qKey;
+	if(dnsCacheKey_build(&qName, question.qType, &qKey) != OS_STATUS_OK)
+	{
+		return false;
+	}
+
+	return dnsCacheKey_isEqual(&qKey, pExpectKey);
+}
+
+
+dnsMessage_t* dnsMessage_ref(dnsMessage_t* pDnsMsg)
+{
+	if(pDnsMsg)
+	{
+		__atomic_add_fetch(&pDnsMsg->refNum, 1, __ATOMIC_RELAXED);
+	}
+
+	return pDnsMsg;
+}
+
+
+//the thread that releases the last reference frees the message, the acquire makes the other threads' reads of it happen before
+dnsMessage_t* dnsMessage_free(dnsMessage_t* pDnsMsg)
+{
+	if(pDnsMsg && __atomic_sub_fetch(&pDnsMsg->refNum, 1, __ATOMIC_ACQ_REL) == 0)
+	{
+		osfree(pDnsMsg);
+	}
+
+	return NULL;
+}
+
+
+void dnsMessage_freeList(osList_t* pList)
+{
+	osListElement_t* pLE = pList->head;
+	while(pLE)
+	{
+		dnsMessage_free(pLE->data);
+		pLE = pLE->next;
+	}
+
+	osList_clear(pList);
+}
+
+
+//bump allocation from the arena following pDnsMsg
+static void* dnsMessage_alloc(dnsMessage_t* pDnsMsg, size_t size)
+{
+	if(pDnsMsg->arenaUsed + size > pDnsMsg->arenaSize)
+	{
+		logError("the message arena is used up, arenaSize=%d, arenaUsed=%d, size=%ld.", pDnsMsg->arenaSize, pDnsMsg->arenaUsed, size);
+		return NULL;
+	}
+
+	void* ptr = (uint8_t*)&pDnsMsg[1] + pDnsMsg->arenaUsed;
+	pDnsMsg->arenaUsed += size;
+
+	return ptr;
+}
+
+
+//validates the name at pBuf->pos and moves past it, *pOffset is where it starts in the wire
+static osStatus_e dnsParseName(osMBuf_t* pBuf, uint16_t* pOffset)
+{
+	*pOffset = pBuf->pos;
+	return dnsName_decode(pBuf->buf, pBuf->size, &pBuf->pos, NULL, NULL);
+}
+
+
+void dnsResolver_getParseStats(dnsParseStats_t* pStats)
+{
+	*pStats = gParseStats;
+}
+
+
+/* validates the framing of the rr at pBuf->pos and moves past it, its offset is appended to pDnsMsg->rrOff.  The rdata is
+ * only checked to be inside the wire, it is decoded by dnsParseRR() when the section of the rr is read.  The OPT rr is
+ * decoded here as it is needed for every response, and is not appended.  isAddtl is true for a rr of the additional section
+ */
+static osStatus_e dnsIndexRR(osMBuf_t* pBuf, dnsMessage_t* pDnsMsg, bool isAddtl, uint16_t* pRROffNum)
+{
+	size_t rrOff = pBuf->pos;
+	osStatus_e status = dnsName_decode(pBuf->buf, pBuf->size, &pBuf->pos, NULL, NULL);
+	if(status != OS_STATUS_OK)
+	{
+		goto EXIT;
+	}
+
+	//type, class, ttl and rdlength
+	if(pBuf->pos + 10 > pBuf->size)
+	{
+		logError("the rr at 0x%lx crosses pBuf->size(%ld).", rrOff, pBuf->size);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	uint16_t type = dnsGetU16(pBuf);
+	uint16_t rrClass = dnsGetU16(pBuf);
+	uint32_t ttl = dnsGetU32(pBuf);
+	uint16_t rDataLen = dnsGetU16(pBuf);
+	if(pBuf->pos + rDataLen > pBuf->size)
+	{
+		logError("the rdata of the rr at 0x%lx crosses pBuf->size(%ld).", rrOff, pBuf->size);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+	pBuf->pos += rDataLen;
+
+	//based on rfc6891 section 6.1.3, the class and ttl are reused, the options are skipped
+	if(type == DNS_QTYPE_OPT)
+	{
+		//rfc6891 section 6.1.1, only one OPT rr in the additional section, otherwise the message is a FORMERR
+		if(!isAddtl || pDnsMsg->isEdns)
+		{
+			logInfo("the OPT rr at 0x%lx is not the only one in the additional section, isAddtl=%d, isEdns=%d.", rrOff, isAddtl, pDnsMsg->isEdns);
+			status = OS_ERROR_INVALID_VALUE;
+			goto EXIT;
+		}
+
+		pDnsMsg->isEdns = true;
+		pDnsMsg->opt.udpPayloadSize = rrClass;
+		pDnsMsg->opt.extRcode = ttl >> 24;
+		pDnsMsg->opt.version = (ttl >> 16) & 0xff;
+		pDnsMsg->opt.flags = ttl & 0xffff;
+		debug("edns udpPayloadSize=%d, extRcode=%d, version=%d.", pDnsMsg->opt.udpPayloadSize, pDnsMsg->opt.extRcode, pDnsMsg->opt.version);
+		goto EXIT;
+	}
+
+	pDnsMsg->rrOff[(*pRROffNum)++] = rrOff;
+
+EXIT:
+	return status;
+}
+
+
+uint16_t dnsMessage_getSection(dnsMessage_t* pDnsMsg, dnsSection_e section, dnsRR_t** ppRR)
+{
+	*ppRR = NULL;
+	if(!pDnsMsg)
+	{
+		logError("null pointer, pDnsMsg.");
+		return 0;
+	}
+
+	dnsRR_t* pRR = NULL;
+	uint16_t rrNum = 0;
+	uint16_t* pRROff = NULL;
+	switch(section)
+	{
+		case DNS_SECTION_ANSWER:
+			pRR = pDnsMsg->answer;
+			rrNum = pDnsMsg->answerNum;
+			pRROff = pDnsMsg->rrOff;
+			break;
+		case DNS_SECTION_AUTH:
+			pRR = pDnsMsg->auth;
+			rrNum = pDnsMsg->authNum;
+			pRROff = &pDnsMsg->rrOff[pDnsMsg->answerNum];
+			break;
+		case DNS_SECTION_ADDTL_ANSWER:
+			pRR = pDnsMsg->addtlAnswer;
+			rrNum = pDnsMsg->addtlAnswerNum;
+			pRROff = &pDnsMsg->rrOff[pDnsMsg->answerNum + pDnsMsg->authNum];
+			break;
+		default:
+			logError("section(%d) is not supported.", section);
+			return 0;
+	}
+
+	if(!rrNum)
+	{
+		return 0;
+	}
+
+	//a message in the rrCache may be read by more than one thread, only one of them decodes a section, the others wait for
+	//it, which takes a few microseconds
+	uint8_t state = DNS_SECTION_STATE_INDEXED;
+	if(__atomic_compare_exchange_n(&pDnsMsg->sectionState[section], &state, DNS_SECTION_STATE_DECODING, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+	{
+		//the rr are decoded from the wire of the message, which has been validated by dnsIndexRR()
+		osMBuf_t buf = {.buf = pDnsMsg->wire, .size = pDnsMsg->wireLen, .end = pDnsMsg->wireLen};
+		state = DNS_SECTION_STATE_DECODED;
+		for(int i=0; i<rrNum; i++)
+		{
+			buf.pos = pRROff[i];
+			if(dnsParseRR(&buf, pDnsMsg, &pRR[i]) != OS_STATUS_OK)
+			{
+				logError("fails to dnsParseRR for the %d-th rr of section(%d).", i, section);
+				state = DNS_SECTION_STATE_FAILED;
+				break;
+			}
+		}
+
+		gParseStats.sectionNum++;
+		__atomic_store_n(&pDnsMsg->sectionState[section], state, __ATOMIC_RELEASE);
+	}
+	else
+	{
+		while(state == DNS_SECTION_STATE_DECODING)
+		{
+			state = __atomic_load_n(&pDnsMsg->sectionState[section], __ATOMIC_ACQUIRE);
+		}
+	}
+
+	if(state != DNS_SECTION_STATE_DECODED)
+	{
+		return 0;
+	}
+
+	*ppRR = pRR;
+	return rrNum;
+}
+
+
+//the names of the rr are views into the wire, only the question name is decoded into pQName->qName, for the pending query match
+static osStatus_e dnsParseQuestion(osMBuf_t* pBuf, dnsQuestion_t* pQName)
+{
+	osStatus_e status = dnsName_decode(pBuf->buf, pBuf->size, &pBuf->pos, pQName->qName, NULL);
+	if(status != OS_STATUS_OK)
+	{
+		goto EXIT;
+	}
+
+	//a response without rr ends right after the question
+	if(pBuf->pos + 4 > pBuf->size)
+	{
+        logError("when parsing QName, pBuf->pos crosses pBuf->size(%ld).", pBuf->size);
+        status = OS_ERROR_INVALID_VALUE;
+        goto EXIT;
+    }
+
+	pQName->qType = dnsGetU16(pBuf);
+	pQName->qClass = dnsGetU16(pBuf);
+
+EXIT:
+	return status;
+}
+
+
+//fills pRR, which is in the arena of pDnsMsg, the variable length fields are kept as their offsets in the wire of pDnsMsg,
+//which is a copy of pBuf->buf.  Every field is checked to be inside the rdata of the rr before it is read
+static osStatus_e dnsParseRR(osMBuf_t* pBuf, dnsMessage_t* pDnsMsg, dnsRR_t* pRR)
+{
+DEBUG_BEGIN
+	size_t rrOff = pBuf->pos;
+	osStatus_e status = dnsParseName(pBuf, &pRR->nameOff);
+    if(status != OS_STATUS_OK)
+    {
+        goto EXIT;
+    }
+
+	if(pBuf->pos + 10 > pBuf->size)
+	{
+		logError("the rr at 0x%lx crosses pBuf->size(%ld).", rrOff, pBuf->size);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	pRR->type = dnsGetU16(pBuf);
+    debug("dns rr type=%d, pos=0x%x", pRR->type, pBuf->pos);
+	pRR->rrClass = dnsGetU16(pBuf);
+	pRR->ttl = dnsGetU32(pBuf);
+	pRR->rDataLen = dnsGetU16(pBuf);
+
+	size_t rDataEnd = pBuf->pos + pRR->rDataLen;
+	if(rDataEnd > pBuf->size)
+	{
+		logError("the rdata of the rr at 0x%lx crosses pBuf->size(%ld).", rrOff, pBuf->size);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	switch(pRR->type)
+	{
+		case DNS_QTYPE_A:
+			if(pRR->rDataLen != 4)
+			{
+				logError("rr class is A, but (pRR->rDataLen=%d.", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+			//no need to do htobe for network address
+			memcpy(&pRR->ipAddr.s_addr, &pBuf->buf[pBuf->pos], 4);
+			pBuf->pos += 4;
+			break;
+		case DNS_QTYPE_SRV:
+			//based on rfc 2782, priority, weight, port, and at least a <Root> target
+			if(pBuf->pos + 7 > rDataEnd)
+			{
+				logError("SRV rdata size(%d) is too small.", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+            pRR->srv.priority = dnsGetU16(pBuf);
+            pRR->srv.weight = dnsGetU16(pBuf);
+            pRR->srv.port = dnsGetU16(pBuf);
+
+            //process target
+		    status = dnsParseName(pBuf, &pRR->srv.targetOff);
+			break;
+		case DNS_QTYPE_NAPTR:
+		{
+			//based on rfc 2915, order, pref, and the flags length octet
+			if(pBuf->pos + 5 > rDataEnd)
+			{
+				logError("NAPTR rdata size(%d) is too small.", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+			pRR->naptr.order = dnsGetU16(pBuf);
+			pRR->naptr.pref = dnsGetU16(pBuf);
+
+			//process flags
+			uint8_t flagsLen = pBuf->buf[pBuf->pos];
+			pRR->naptr.flags = DNS_NAPTR_FLAGS_OTHER;
+			if(!flagsLen)
+			{
+				//empty flags are valid, the rule is not terminal, rfc3403 section 4.1
+				debug("naptr flags is empty.");
+			}
+			else if(flagsLen != 1)
+			{
+				logError("naptr flags size(%d) is not 1, unexpected.", flagsLen);
+			}
+			else if(pBuf->pos + 2 <= rDataEnd)
+			{
+				switch (pBuf->buf[pBuf->pos + 1])
+				{
+					case 's':
+					case 'S':
+						pRR->naptr.flags = DNS_NAPTR_FLAGS_S;
+						break;
+					case 'a':
+					case 'A':
+						pRR->naptr.flags = DNS_NAPTR_FLAGS_A;
+						break;
+					case 'u':
+					case 'U':
+						pRR->naptr.flags = DNS_NAPTR_FLAGS_U;
+						break;
+					case 'p':
+					case 'P':
+						pRR->naptr.flags = DNS_NAPTR_FLAGS_P;
+						break;
+					default:
+						break;
+				}
+			}
+			pBuf->pos += 1 + flagsLen;
+
+			//process service and regexp, character-strings, rfc1035 section 3.3.  each length octet and its string shall be in the rdata
+			if(pBuf->pos >= rDataEnd)
+			{
+				logError("NAPTR rdata crosses its rDataLen(%d).", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+			pRR->naptr.serviceOff = pBuf->pos;
+			pBuf->pos += pBuf->buf[pBuf->pos] + 1;
+
+			if(pBuf->pos >= rDataEnd)
+			{
+				logError("NAPTR rdata crosses its rDataLen(%d).", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+			pRR->naptr.regexpOff = pBuf->pos;
+			pBuf->pos += pBuf->buf[pBuf->pos] + 1;
+
+			if(pBuf->pos >= rDataEnd)
+			{
+				logError("NAPTR rdata crosses its rDataLen(%d).", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+            //process replacement
+		    status = dnsParseName(pBuf, &pRR->naptr.replacementOff);
+			break;
+		}
+		case DNS_QTYPE_SOA:
+			//based on rfc1035 section 3.3.13, mName and rName are skipped
+			status = dnsName_decode(pBuf->buf, rDataEnd, &pBuf->pos, NULL, NULL);
+			if(status != OS_STATUS_OK)
+			{
+				goto EXIT;
+			}
+
+			status = dnsName_decode(pBuf->buf, rDataEnd, &pBuf->pos, NULL, NULL);
+			if(status != OS_STATUS_OK)
+			{
+				goto EXIT;
+			}
+
+			if(pBuf->pos + 20 > rDataEnd)
+			{
+				logError("SOA rdata crosses its rDataLen(%d).", pRR->rDataLen);
+				status = OS_ERROR_INVALID_VALUE;
+				goto EXIT;
+			}
+
+			pRR->soa.serial = dnsGetU32(pBuf);
+			pRR->soa.refresh = dnsGetU32(pBuf);
+			pRR->soa.retry = dnsGetU32(pBuf);
+			pRR->soa.expire = dnsGetU32(pBuf);
+			pRR->soa.minimum = dnsGetU32(pBuf);
+			break;
+		case DNS_QTYPE_OPT:
+			//based on rfc6891 section 6.1.3, the class and ttl are reused, the options are skipped
+			pRR->opt.udpPayloadSize = pRR->rrClass;
+			pRR->opt.extRcode = pRR->ttl >> 24;
+			pRR->opt.version = (pRR->ttl >> 16) & 0xff;
+			pRR->opt.flags = pRR->ttl & 0xffff;
+			pBuf->pos = rDataEnd;
+
+			debug("edns udpPayloadSize=%d, extRcode=%d, version=%d.", pRR->opt.udpPayloadSize, pRR->opt.extRcode, pRR->opt.version);
+			break;
+		default:
+			logInfo("pRR->type=%d is unhandled.", pRR->type);
+			pRR->otherOff = pBuf->pos;
+			pBuf->pos = rDataEnd;
+			break;
+	}
+
+	//a name in the rdata may be compressed, it is decoded against the whole wire, but its in place part shall end in the rdata
+	if(status == OS_STATUS_OK && pBuf->pos > rDataEnd)
+	{
+		logError("the rdata of the rr at 0x%lx crosses its rDataLen(%d).", rrOff, pRR->rDataLen);
+		status = OS_ERROR_INVALID_VALUE;
+	}
+	pBuf->pos = rDataEnd;
+
+EXIT:
+DEBUG_END
+	return status;
+}
+
+
+//the fixed size fields are read after the caller has checked they are inside the wire, which is not aligned
+static inline uint16_t dnsGetU16(osMBuf_t* pBuf)
+{
+	uint16_t value;
+	memcpy(&value, &pBuf->buf[pBuf->pos], sizeof(value));
+	pBuf->pos += sizeof(value);
+	return be16toh(value);
+}
+
+
+static inline uint32_t dnsGetU32(osMBuf_t* pBuf)
+{
+	uint32_t value;
+	memcpy(&value, &pBuf->buf[pBuf->pos], sizeof(value));
+	pBuf->pos += sizeof(value);
+	return be32toh(value);
+}
+
+
+osPointerLen_t dnsRR_getName(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name)
+{
+	return dnsMessage_getName(pDnsMsg, pRR->nameOff, name);
+}
+
+
+osPointerLen_t dnsRR_getSrvTarget(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name)
+{
+	return dnsMessage_getName(pDnsMsg, pRR->srv.targetOff, name);
+}
+
+
+osPointerLen_t dnsRR_getNaptrReplacement(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR, char* name)
+{
+	return dnsMessage_getName(pDnsMsg, pRR->naptr.replacementOff, name);
+}
+
+
+bool dnsMessage_isNameEqual(const dnsMessage_t* pDnsMsg, uint16_t nameOff, const osPointerLen_t* pName)
+{
+	return dnsName_isEqual(pDnsMsg->wire, pDnsMsg->wireLen, nameOff, pName);
+}
+
+
+osPointerLen_t dnsRR_getNaptrService(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR)
+{
+	return dnsMessage_getString(pDnsMsg, pRR->naptr.serviceOff);
+}
+
+
+osPointerLen_t dnsRR_getNaptrRegexp(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR)
+{
+	return dnsMessage_getString(pDnsMsg, pRR->naptr.regexpOff);
+}
+
+
+//the rdata of a rr type that is not parsed
+osPointerLen_t dnsRR_getRData(const dnsMessage_t* pDnsMsg, const dnsRR_t* pRR)
+{
+	osPointerLen_t rData = {(const char*)&pDnsMsg->wire[pRR->otherOff], pRR->rDataLen};
+	return rData;
+}
+
+
+//a character-string in the wire, a length octet followed by the string, rfc1035 section 3.3
+static osPointerLen_t dnsMessage_getString(const dnsMessage_t* pDnsMsg, uint16_t offset)
+{
+	osPointerLen_t str = {(const char*)&pDnsMsg->wire[offset + 1], pDnsMsg->wire[offset]};
+	return str;
+}
+
+
+//the names were validated when the message was parsed, and every valid name fits in DNS_MAX_NAME_SIZE
+static osPointerLen_t dnsMessage_getName(const dnsMessage_t* pDnsMsg, uint16_t offset, char* name)
+{
+	size_t pos = offset;
+	osPointerLen_t pl = {name, 0};
+	if(dnsName_decode(pDnsMsg->wire, pDnsMsg->wireLen, &pos, name, &pl.l) != OS_STATUS_OK)
+	{
+		name[0] = 0;
+		pl.l = 0;
+	}
+
+	return pl;
+}
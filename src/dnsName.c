@@ -0,0 +1,192 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * domain names in the wire format of a dns message, rfc1035 section 3.1 and 4.1.4.  A parsed message keeps its
+ * wire, and its names are decoded from it when they are used.  Every read is checked against the wire length, and
+ * a compression pointer shall point backward, before the label it is in, so a name can not loop.  A name follows at
+ * most DNS_NAME_MAX_HOP pointers.
+ *
+ * names are case insensitive, rfc4343, they are decoded in lowercase, the same as dnsCacheKey_build() folds the qName.
+ * The labels are copied 16 or 32 bytes at a time when the cpu has SSE2 or AVX2, see DNS_AVX2 in the Makefile
+ */
+
+
+#include <string.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "osDebug.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsName.h"
+
+
+static inline void dnsName_copyLabel(char* dst, const uint8_t* src, size_t len);
+
+
+/* the loop is kept small enough to stay in one cache line or two, it only reads the label size, checks the label against the
+ * wire and the name size in one branch, and copies it.  The pointers and every malformed case are off the label path, and
+ * there is one error exit
+ */
+osStatus_e dnsName_decode(const uint8_t* wire, size_t wireLen, size_t* pPos, char* name, size_t* pNameLen)
+{
+	osStatus_e status = OS_ERROR_INVALID_VALUE;
+	size_t pos = *pPos;
+	size_t nextPos = 0;		//the position after the name in place, set when the first pointer is followed
+	size_t nameLen = 0;
+	int hop = 0;
+
+	//"a.b" is 5 octets in the wire, 1 a 1 b 0.  DNS_MAX_NAME_SIZE holds the longest one and its terminating 0
+	size_t maxNameLen = DNS_NAME_MAX_WIRE_LEN - 2;
+
+	while(pos < wireLen)
+	{
+		size_t labelSize = wire[pos];
+		if(labelSize <= DNS_MAX_DOMAIN_NAME_LABEL_SIZE)
+		{
+			if(!labelSize)
+			{
+				pos++;
+				status = OS_STATUS_OK;
+				break;
+			}
+
+			//the dot before the label shall fit too
+			size_t dotLen = nameLen != 0;
+			if(pos + 1 + labelSize > wireLen || nameLen + dotLen + labelSize > maxNameLen)
+			{
+				break;
+			}
+
+			if(name)
+			{
+				//for the first label the dot is overwritten by the label
+				name[nameLen] = '.';
+				dnsName_copyLabel(&name[nameLen + dotLen], &wire[pos+1], labelSize);
+			}
+			nameLen += dotLen + labelSize;
+			pos += 1 + labelSize;
+			continue;
+		}
+
+		//0xc0 = the first 2 bits of a 16 bits field are 1, per rfc1035 section 4.1.4, it indicates the domain name is a pointer.
+		//0x40 and 0x80 are reserved
+		if((labelSize & 0xc0) != 0xc0 || pos + 1 >= wireLen || ++hop > DNS_NAME_MAX_HOP)
+		{
+			break;
+		}
+
+		size_t ptr = ((labelSize & 0x3f) << 8) | wire[pos+1];
+		if(ptr >= pos)
+		{
+			break;
+		}
+
+		if(!nextPos)
+		{
+			nextPos = pos + 2;
+		}
+		pos = ptr;
+	}
+
+	if(status != OS_STATUS_OK)
+	{
+		logInfo("the domain name at pos(0x%lx) is malformed at pos(0x%lx), wireLen=%ld, hop=%d.", *pPos, pos, wireLen, hop);
+		goto EXIT;
+	}
+
+	if(name)
+	{
+		name[nameLen] = 0;
+	}
+
+	if(pNameLen)
+	{
+		*pNameLen = nameLen;
+	}
+
+	*pPos = nextPos ? nextPos : pos;
+
+EXIT:
+	return status;
+}
+
+
+bool dnsName_isEqual(const uint8_t* wire, size_t wireLen, size_t pos, const osPointerLen_t* pName)
+{
+	size_t nameLen = 0;
+	int hop = 0;
+
+	while(pos < wireLen && wire[pos])
+	{
+		if((wire[pos] & 0xc0) == 0xc0)
+		{
+			size_t ptr = pos + 1 < wireLen ? ((wire[pos] & 0x3f) << 8) | wire[pos+1] : pos;
+			if(ptr >= pos || ++hop > DNS_NAME_MAX_HOP)
+			{
+				return false;
+			}
+
+			pos = ptr;
+			continue;
+		}
+
+		uint8_t labelSize = wire[pos];
+		if(nameLen)
+		{
+			if(nameLen >= pName->l || pName->p[nameLen] != '.')
+			{
+				return false;
+			}
+			nameLen++;
+		}
+
+		if(pos + 1 + labelSize > wireLen || nameLen + labelSize > pName->l || strncasecmp((const char*)&wire[pos+1], &pName->p[nameLen], labelSize) != 0)
+		{
+			return false;
+		}
+		nameLen += labelSize;
+		pos += 1 + labelSize;
+	}
+
+	return pos < wireLen && nameLen == pName->l;
+}
+
+
+//copies a label of len bytes in lowercase.  Only whole blocks inside the label are loaded and stored, the rest is copied a
+//byte at a time, so neither the wire nor dst is read or written past the label
+static inline void dnsName_copyLabel(char* dst, const uint8_t* src, size_t len)
+{
+	size_t i = 0;
+
+#if defined(__AVX2__)
+	const __m256i upperA32 = _mm256_set1_epi8('A' - 1);
+	const __m256i upperZ32 = _mm256_set1_epi8('Z' + 1);
+	const __m256i caseBit32 = _mm256_set1_epi8(0x20);
+	for(; i + 32 <= len; i += 32)
+	{
+		__m256i c = _mm256_loadu_si256((const __m256i*)&src[i]);
+		//the bytes >= 0x80 are negative as signed, they are not in ['A', 'Z']
+		__m256i isUpper = _mm256_and_si256(_mm256_cmpgt_epi8(c, upperA32), _mm256_cmpgt_epi8(upperZ32, c));
+		_mm256_storeu_si256((__m256i*)&dst[i], _mm256_or_si256(c, _mm256_and_si256(isUpper, caseBit32)));
+	}
+#endif
+
+#if defined(__SSE2__)
+	const __m128i upperA = _mm_set1_epi8('A' - 1);
+	const __m128i upperZ = _mm_set1_epi8('Z' + 1);
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	for(; i + 16 <= len; i += 16)
+	{
+		__m128i c = _mm_loadu_si128((const __m128i*)&src[i]);
+		__m128i isUpper = _mm_and_si128(_mm_cmpgt_epi8(c, upperA), _mm_cmplt_epi8(c, upperZ));
+		_mm_storeu_si128((__m128i*)&dst[i], _mm_or_si128(c, _mm_and_si128(isUpper, caseBit)));
+	}
+#endif
+
+	for(; i < len; i++)
+	{
+		uint8_t c = src[i];
+		dst[i] = c + ((uint8_t)(c - 'A') <= 'Z' - 'A' ? 'a' - 'A' : 0);
+	}
+}
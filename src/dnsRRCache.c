@@ -0,0 +1,572 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * implement the dns rr cache.  Two modes are supported:
+ * DNS_RR_CACHE_MODE_PER_THREAD: every thread that calls dnsResolver_init() has its own cache, no locking.
+ * DNS_RR_CACHE_MODE_SHARED: one cache for the whole process, split into shards keyed by (qName, qType).
+ * the rr of a shard are indexed by a dnsCacheTable_t, qName and qType must match exactly for a rr to be found.
+ * each shard has its own rwlock, a lookup only takes the read lock of the shard the key belongs to.
+ * A rr keeps its expiry time inline.  A lookup treats an expired rr as a miss, and every thread runs one
+ * sweep timer that removes the expired rr of a shard in bulk under the shard write lock.  In the shared
+ * mode, a shard is swept by whichever thread's timer gets to it first after DNS_RR_CACHE_SWEEP_TIMEOUT.
+ * A dnsMsg returned by a lookup is referred under the shard lock, so a rr removed by another thread stays
+ * valid until the caller frees it.  Many readers refer the same dnsMsg under the read lock at the same time, and
+ * it is released from any thread, so its refNum is atomic, see dnsMessage_ref().
+ * When rrCacheMaxSize is configured, each shard gets an equal part of it.  Before a new rr is added to a
+ * full shard, a CLOCK hand walks the shard's table slots, a rr that has been looked up since the hand
+ * last passed gets a second chance, otherwise it is evicted.
+ * Every lookup is counted in a per shard frequency sketch.  A response is admitted freely while its shard has
+ * room.  When the shard is full, the response is admitted only if its key has been looked up at least
+ * DNS_RR_CACHE_ADMIT_FREQ times recently, and more often than each rr the CLOCK hand would evict for it, so
+ * names that are only queried once do not push the hot rr out.
+ * When DNS_RR_PREFETCH_PERCENT is not 0, the first lookup of a rr in the last DNS_RR_PREFETCH_PERCENT of its
+ * ttl tells the caller to refresh it.  The rr keeps being returned until the refreshed response replaces it.
+ * When DNS_RR_STALE_WINDOW is not 0, an expired rr is kept for DNS_RR_STALE_WINDOW more seconds (rfc8767).  A normal
+ * lookup still treats it as a miss, only dnsRRCache_lookupStale() returns it, when the resolver can not get a
+ * fresh response in time.  The eviction removes an expired rr first, whether it is in the stale window or not.
+ * A NXDOMAIN (rfc2308) is cached without its dnsMsg, only the rcode is kept, it takes a fraction of the size of a
+ * positive rr, and a lookup that hits it does not allocate anything.  A NODATA keeps its dnsMsg, so that a lookup
+ * returns it the same way as a NODATA response from the dns server, with no answer.
+ */
+
+
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "osMemory.h"
+#include "osList.h"
+#include "osPL.h"
+#include "osDebug.h"
+#include "osTimer.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsConfig.h"
+#include "dnsCacheTable.h"
+#include "dnsFreqSketch.h"
+#include "dnsRRCache.h"
+
+
+static dnsRRCache_t gSharedRRCache;
+static pthread_once_t gSharedRRCacheOnce = PTHREAD_ONCE_INIT;
+static osStatus_e gSharedRRCacheStatus;
+static __thread dnsRRCache_t gThreadRRCache;
+static __thread dnsRRCache_t* gpRRCache;		//points to either gSharedRRCache or gThreadRRCache
+static __thread uint64_t gSweepTimerId;
+
+static osStatus_e dnsRRCache_create(dnsRRCache_t* pRRCache, bool isShared, uint32_t shardNum, uint32_t hashSize, uint64_t shardMaxSize);
+static void dnsRRCache_initShared();
+static dnsRRCacheShard_t* dnsRRCache_getShard(const dnsCacheKey_t* pKey);
+static osStatus_e dnsRRCache_insert(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, bool isNegative, dnsRcode_e negRcode, uint32_t ttl);
+static uint32_t dnsRRCache_getMsgSize(dnsMessage_t* pDnsMsg);
+static bool dnsRRCache_evict(dnsRRCacheShard_t* pShard, uint32_t size, uint8_t freq, dnsRRCacheInfo_t* pKeepRRCache, uint64_t now);
+static void dnsRRCache_remove(dnsRRCacheShard_t* pShard, dnsRRCacheInfo_t* pRRCache);
+static void dnsRRCache_sweep(dnsRRCacheShard_t* pShard, uint64_t now);
+static uint64_t dnsRRCache_getTime();
+static void dnsRRCache_rdlock(dnsRRCacheShard_t* pShard);
+static void dnsRRCache_wrlock(dnsRRCacheShard_t* pShard);
+static void dnsRRCache_unlock(dnsRRCacheShard_t* pShard);
+static void dns_onRRCacheSweepTimeout(uint64_t timerId, void* ptr);
+static void dnsRRCacheInfo_cleanup(void* data);
+
+
+
+osStatus_e dnsRRCache_init(const dnsConfig_t* pDnsConfig)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	if(pDnsConfig->rrCacheMode == DNS_RR_CACHE_MODE_SHARED)
+	{
+		pthread_once(&gSharedRRCacheOnce, dnsRRCache_initShared);
+		status = gSharedRRCacheStatus;
+		gpRRCache = &gSharedRRCache;
+	}
+	else
+	{
+		status = dnsRRCache_create(&gThreadRRCache, false, 1, pDnsConfig->rrHashSize, pDnsConfig->rrCacheMaxSize);
+		gpRRCache = &gThreadRRCache;
+	}
+
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to create rr cache, rrCacheMode=%d.", pDnsConfig->rrCacheMode);
+		gpRRCache = NULL;
+		goto EXIT;
+	}
+
+	gSweepTimerId = osStartTimer(DNS_RR_CACHE_SWEEP_TIMEOUT, dns_onRRCacheSweepTimeout, NULL);
+
+EXIT:
+	return status;
+}
+
+
+dnsMessage_t* dnsRRCache_lookup(const dnsCacheKey_t* pKey, bool* pIsPrefetch, bool* pIsNegative, dnsRcode_e* pNegRcode)
+{
+	dnsMessage_t* pDnsMsg = NULL;
+	*pIsPrefetch = false;
+	*pIsNegative = false;
+
+	dnsRRCacheShard_t* pShard = dnsRRCache_getShard(pKey);
+
+	//count both hits and misses, the sketch does not need the lock
+	dnsFreqSketch_increment(&pShard->sketch, pKey->hash);
+
+	dnsRRCache_rdlock(pShard);
+	dnsRRCacheInfo_t* pRRCache = dnsCacheTable_lookup(&pShard->table, pKey);
+	//an expired rr is left for the sweep or the next dnsRRCache_add() of the same key to remove
+	uint64_t now = dnsRRCache_getTime();
+	if(pRRCache && pRRCache->expireTime > now)
+	{
+		if(pRRCache->pDnsMsg)
+		{
+			pDnsMsg = dnsMessage_ref(pRRCache->pDnsMsg);
+		}
+		else
+		{
+			*pIsNegative = true;
+			*pNegRcode = pRRCache->negRcode;
+		}
+
+		//other readers may set it at the same time, the evicting thread holds the write lock
+		__atomic_store_n(&pRRCache->isReferenced, true, __ATOMIC_RELAXED);
+
+		//only one of the threads reading the rr at the same time gets to refresh it
+		if(pRRCache->prefetchTime <= now && !__atomic_exchange_n(&pRRCache->isPrefetching, true, __ATOMIC_RELAXED))
+		{
+			*pIsPrefetch = true;
+		}
+	}
+	dnsRRCache_unlock(pShard);
+
+	return pDnsMsg;
+}
+
+
+dnsMessage_t* dnsRRCache_lookupStale(const dnsCacheKey_t* pKey)
+{
+	dnsMessage_t* pDnsMsg = NULL;
+
+	dnsRRCacheShard_t* pShard = dnsRRCache_getShard(pKey);
+
+	dnsRRCache_rdlock(pShard);
+	dnsRRCacheInfo_t* pRRCache = dnsCacheTable_lookup(&pShard->table, pKey);
+	uint64_t now = dnsRRCache_getTime();
+	if(pRRCache && pRRCache->pDnsMsg && pRRCache->staleTime > now)
+	{
+		pDnsMsg = dnsMessage_ref(pRRCache->pDnsMsg);
+
+		//once expired, the dnsMsg stays stale, it is only set, never cleared, by the readers
+		if(pRRCache->expireTime <= now)
+		{
+			__atomic_store_n(&pDnsMsg->isStale, true, __ATOMIC_RELAXED);
+		}
+	}
+	dnsRRCache_unlock(pShard);
+
+	debug("key(0x%lx), qType(%d), pDnsMsg=%p, isStale=%d.", pKey->hash, pKey->qType, pDnsMsg, pDnsMsg ? pDnsMsg->isStale : false);
+	return pDnsMsg;
+}
+
+
+void dnsRRCache_clearPrefetch(const dnsCacheKey_t* pKey)
+{
+	dnsRRCacheShard_t* pShard = dnsRRCache_getShard(pKey);
+
+	dnsRRCache_rdlock(pShard);
+	dnsRRCacheInfo_t* pRRCache = dnsCacheTable_lookup(&pShard->table, pKey);
+	if(pRRCache)
+	{
+		__atomic_store_n(&pRRCache->isPrefetching, false, __ATOMIC_RELAXED);
+	}
+	dnsRRCache_unlock(pShard);
+}
+
+
+osStatus_e dnsRRCache_add(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, uint32_t ttl)
+{
+	return dnsRRCache_insert(pKey, pDnsMsg, false, DNS_RCODE_NO_ERROR, ttl);
+}
+
+
+osStatus_e dnsRRCache_addNegative(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, dnsRcode_e negRcode, uint32_t ttl)
+{
+	return dnsRRCache_insert(pKey, negRcode == DNS_RCODE_NO_ERROR ? pDnsMsg : NULL, true, negRcode, ttl);
+}
+
+
+bool dnsRRCache_isShared()
+{
+	return gpRRCache && gpRRCache->isShared;
+}
+
+
+void dnsRRCache_getStats(dnsRRCacheStats_t* pStats)
+{
+	memset(pStats, 0, sizeof(dnsRRCacheStats_t));
+	if(!gpRRCache)
+	{
+		return;
+	}
+
+	for(int i=0; i<gpRRCache->shardNum; i++)
+	{
+		dnsRRCacheShard_t* pShard = &gpRRCache->pShard[i];
+
+		dnsRRCache_rdlock(pShard);
+		pStats->size += pShard->size;
+		pStats->rrNum += pShard->table.num;
+		pStats->evictNum += pShard->evictNum;
+		pStats->expireNum += pShard->expireNum;
+		pStats->rejectNum += pShard->rejectNum;
+		dnsRRCache_unlock(pShard);
+	}
+}
+
+
+//pDnsMsg == NULL for a NXDOMAIN response
+static osStatus_e dnsRRCache_insert(const dnsCacheKey_t* pKey, dnsMessage_t* pDnsMsg, bool isNegative, dnsRcode_e negRcode, uint32_t ttl)
+{
+	osStatus_e status = OS_STATUS_OK;
+	dnsRRCacheInfo_t* pRRCache = NULL;
+
+	dnsRRCacheShard_t* pShard = dnsRRCache_getShard(pKey);
+
+	uint32_t size = dnsRRCache_getMsgSize(pDnsMsg);
+	if(gpRRCache->shardMaxSize && size > gpRRCache->shardMaxSize)
+	{
+		debug("rr size(%d) is bigger than the shard size budget(%ld), skip.", size, gpRRCache->shardMaxSize);
+		return OS_STATUS_OK;
+	}
+
+	dnsRRCache_wrlock(pShard);
+
+	//a prefetched response replaces the rr being refreshed.  In the shared mode, another thread may have cached
+	//the same rr in the meantime, keep the one that expires later
+	uint64_t now = dnsRRCache_getTime();
+	uint64_t expireTime = now + (uint64_t)ttl * 1000;
+	dnsRRCacheInfo_t* pOldRRCache = dnsCacheTable_lookup(&pShard->table, pKey);
+	if(pOldRRCache && pOldRRCache->expireTime >= expireTime)
+	{
+		debug("key(0x%lx), qType(%d) is already in the rr cache, skip.", pKey->hash, pKey->qType);
+		goto EXIT;
+	}
+
+	//the old rr stays until the response is admitted, a rejected response does not remove it.  The space it frees counts for the new rr
+	uint32_t oldSize = pOldRRCache ? pOldRRCache->size : 0;
+	if(gpRRCache->shardMaxSize && pShard->size - oldSize + size > gpRRCache->shardMaxSize)
+	{
+		//a rr being replaced before it expires has passed the admission before
+		bool isReplace = pOldRRCache && pOldRRCache->expireTime > now;
+		uint8_t freq = dnsFreqSketch_estimate(&pShard->sketch, pKey->hash);
+		if(!isReplace && freq < DNS_RR_CACHE_ADMIT_FREQ)
+		{
+			debug("key(0x%lx), qType(%d), freq=%d is less than DNS_RR_CACHE_ADMIT_FREQ(%d) and the shard is full, skip.", pKey->hash, pKey->qType, freq, DNS_RR_CACHE_ADMIT_FREQ);
+			pShard->rejectNum++;
+			goto EXIT;
+		}
+
+		if(!dnsRRCache_evict(pShard, size - oldSize, freq, pOldRRCache, now))
+		{
+			debug("key(0x%lx), qType(%d), freq=%d is colder than the rr to be evicted, skip.", pKey->hash, pKey->qType, freq);
+			pShard->rejectNum++;
+			goto EXIT;
+		}
+	}
+
+	pRRCache = oszalloc(sizeof(dnsRRCacheInfo_t), dnsRRCacheInfo_cleanup);
+	if(!pRRCache)
+	{
+		logError("fails to allocate pRRCache.");
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	if(pOldRRCache)
+	{
+		if(pOldRRCache->expireTime <= now)
+		{
+			pShard->expireNum++;
+		}
+		dnsRRCache_remove(pShard, pOldRRCache);
+	}
+
+	//a negative response is neither prefetched nor served stale
+	pRRCache->key = *pKey;
+	pRRCache->isNegative = isNegative;
+	pRRCache->negRcode = negRcode;
+	pRRCache->expireTime = expireTime;
+	pRRCache->prefetchTime = !isNegative && DNS_RR_PREFETCH_PERCENT ? expireTime - (uint64_t)ttl * 10 * DNS_RR_PREFETCH_PERCENT : UINT64_MAX;
+	pRRCache->staleTime = !isNegative ? expireTime + (uint64_t)DNS_RR_STALE_WINDOW * 1000 : expireTime;
+	pRRCache->size = size;
+	status = dnsCacheTable_add(&pShard->table, pRRCache);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsCacheTable_add.");
+		goto EXIT;
+	}
+
+	pShard->size += size;
+	pRRCache->pDnsMsg = dnsMessage_ref(pDnsMsg);
+
+EXIT:
+	dnsRRCache_unlock(pShard);
+
+	if(status != OS_STATUS_OK)
+	{
+		osfree(pRRCache);
+	}
+
+	return status;
+}
+
+
+static void dnsRRCache_initShared()
+{
+	const dnsConfig_t* pDnsConfig = dns_getConfig();
+
+	//round the shard number up to power of 2, so that a shard can be picked by masking the hash key
+	uint32_t shardNum = 1;
+	while(shardNum < pDnsConfig->rrCacheShardNum && shardNum < DNS_RR_CACHE_MAX_SHARD_NUM)
+	{
+		shardNum <<= 1;
+	}
+
+	gSharedRRCacheStatus = dnsRRCache_create(&gSharedRRCache, true, shardNum, pDnsConfig->rrHashSize / shardNum + 1, pDnsConfig->rrCacheMaxSize / shardNum);
+}
+
+
+static osStatus_e dnsRRCache_create(dnsRRCache_t* pRRCache, bool isShared, uint32_t shardNum, uint32_t hashSize, uint64_t shardMaxSize)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	pRRCache->isShared = isShared;
+	pRRCache->shardNum = shardNum;
+	pRRCache->shardMaxSize = shardMaxSize;
+	pRRCache->pShard = oszalloc(sizeof(dnsRRCacheShard_t) * shardNum, NULL);
+	if(!pRRCache->pShard)
+	{
+		logError("fails to allocate pShard, shardNum=%d.", shardNum);
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	for(int i=0; i<shardNum; i++)
+	{
+		if(isShared && pthread_rwlock_init(&pRRCache->pShard[i].lock, NULL) != 0)
+		{
+			logError("fails to pthread_rwlock_init for shard %d.", i);
+			status = OS_ERROR_SYSTEM_FAILURE;
+			goto EXIT;
+		}
+
+		status = dnsCacheTable_init(&pRRCache->pShard[i].table, hashSize, offsetof(dnsRRCacheInfo_t, key));
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to create table for shard %d.", i);
+			goto EXIT;
+		}
+
+		status = dnsFreqSketch_init(&pRRCache->pShard[i].sketch, hashSize);
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to create frequency sketch for shard %d.", i);
+			goto EXIT;
+		}
+	}
+
+	mdebug(LM_DNS, "rr cache is created, isShared=%d, shardNum=%d, hashSize per shard=%d, max size per shard=%ld.", isShared, shardNum, hashSize, shardMaxSize);
+
+EXIT:
+	return status;
+}
+
+
+static dnsRRCacheShard_t* dnsRRCache_getShard(const dnsCacheKey_t* pKey)
+{
+	//the low bits of the hash are used by the table to pick a slot, use the high bits to pick a shard
+	return &gpRRCache->pShard[(pKey->hash >> 32) & (gpRRCache->shardNum - 1)];
+}
+
+
+//the dnsMessage_t and its arena, see dnsMessage_parse().  pDnsMsg == NULL for a NXDOMAIN response
+static uint32_t dnsRRCache_getMsgSize(dnsMessage_t* pDnsMsg)
+{
+	if(!pDnsMsg)
+	{
+		return sizeof(dnsRRCacheInfo_t);
+	}
+
+	return sizeof(dnsRRCacheInfo_t) + sizeof(dnsMessage_t) + pDnsMsg->arenaSize;
+}
+
+
+//shall be called with the shard write lock held.  evicts rr until size more bytes fit in the shard budget.  pKeepRRCache, the rr to be replaced, is never evicted.
+//returns false when the hand reaches a rr looked up at least freq times, the new rr shall not be admitted then
+static bool dnsRRCache_evict(dnsRRCacheShard_t* pShard, uint32_t size, uint8_t freq, dnsRRCacheInfo_t* pKeepRRCache, uint64_t now)
+{
+	dnsCacheTable_t* pTable = &pShard->table;
+
+	//every pass either moves the hand or removes a rr, a referenced rr is evicted the next time the hand comes back
+	while(pShard->size + size > gpRRCache->shardMaxSize && pTable->num > (pKeepRRCache ? 1 : 0))
+	{
+		//the table may have been resized since the last eviction
+		pShard->clockHand &= pTable->mask;
+
+		dnsRRCacheInfo_t* pRRCache = pTable->pSlot[pShard->clockHand].pData;
+		if(!pRRCache || pRRCache == pKeepRRCache)
+		{
+			pShard->clockHand++;
+			continue;
+		}
+
+		//an expired rr that the sweep has not removed yet goes first
+		if(pRRCache->expireTime <= now)
+		{
+			dnsRRCache_remove(pShard, pRRCache);
+			pShard->expireNum++;
+			continue;
+		}
+
+		if(pRRCache->isReferenced)
+		{
+			pRRCache->isReferenced = false;
+			pShard->clockHand++;
+			continue;
+		}
+
+		//keep the victim if it is at least as hot as the new rr, the hand moves on so that the victim is not picked again next time
+		if(dnsFreqSketch_estimate(&pShard->sketch, pRRCache->key.hash) >= freq)
+		{
+			pShard->clockHand++;
+			return false;
+		}
+
+		//the deletion may shift the next rr of the probe chain into this slot, so the hand stays
+		mdebug(LM_DNS, "evict key(0x%lx), qType(%d), size=%d.", pRRCache->key.hash, pRRCache->key.qType, pRRCache->size);
+		dnsRRCache_remove(pShard, pRRCache);
+		pShard->evictNum++;
+	}
+
+	return true;
+}
+
+
+//shall be called with the shard write lock held
+static void dnsRRCache_remove(dnsRRCacheShard_t* pShard, dnsRRCacheInfo_t* pRRCache)
+{
+	dnsCacheTable_delete(&pShard->table, pRRCache);
+	pShard->size -= pRRCache->size;
+
+	osfree(pRRCache);
+}
+
+
+//shall be called with the shard write lock held.  a rr in its stale window is kept
+static void dnsRRCache_sweep(dnsRRCacheShard_t* pShard, uint64_t now)
+{
+	dnsCacheTable_t* pTable = &pShard->table;
+	uint32_t expireNum = 0;
+
+	//the deletion shifts the following rr of the probe chain backward, a slot is checked again after its rr is removed
+	uint32_t i = 0;
+	while(i <= pTable->mask && pTable->num > 0)
+	{
+		dnsRRCacheInfo_t* pRRCache = pTable->pSlot[i].pData;
+		if(pRRCache && pRRCache->staleTime <= now)
+		{
+			dnsRRCache_remove(pShard, pRRCache);
+			expireNum++;
+			continue;
+		}
+
+		i++;
+	}
+
+	pShard->expireNum += expireNum;
+	if(expireNum)
+	{
+		mdebug(LM_DNS, "%d rr expired, %d rr left in the shard.", expireNum, pTable->num);
+	}
+}
+
+
+//monotonic time in msec, a coarse clock is good enough for ttl in seconds
+static uint64_t dnsRRCache_getTime()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &tp);
+
+	return (uint64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
+
+
+static void dnsRRCache_rdlock(dnsRRCacheShard_t* pShard)
+{
+	if(gpRRCache->isShared)
+	{
+		pthread_rwlock_rdlock(&pShard->lock);
+	}
+}
+
+
+static void dnsRRCache_wrlock(dnsRRCacheShard_t* pShard)
+{
+	if(gpRRCache->isShared)
+	{
+		pthread_rwlock_wrlock(&pShard->lock);
+	}
+}
+
+
+static void dnsRRCache_unlock(dnsRRCacheShard_t* pShard)
+{
+	if(gpRRCache->isShared)
+	{
+		pthread_rwlock_unlock(&pShard->lock);
+	}
+}
+
+
+static void dns_onRRCacheSweepTimeout(uint64_t timerId, void* ptr)
+{
+	if(gSweepTimerId != timerId)
+	{
+		logError("gSweepTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", gSweepTimerId, timerId);
+		return;
+	}
+
+	uint64_t now = dnsRRCache_getTime();
+	for(int i=0; i<gpRRCache->shardNum; i++)
+	{
+		dnsRRCacheShard_t* pShard = &gpRRCache->pShard[i];
+
+		//in the shared mode, every thread's timer visits the shard, only the first one after the sweep time sweeps it
+		uint64_t sweepTime = __atomic_load_n(&pShard->nextSweepTime, __ATOMIC_RELAXED);
+		if(sweepTime > now || !__atomic_compare_exchange_n(&pShard->nextSweepTime, &sweepTime, now + DNS_RR_CACHE_SWEEP_TIMEOUT, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		{
+			continue;
+		}
+
+		//remove from the shard before freeing, a thread doing lookup either does not find it, or has referred the dnsMsg
+		dnsRRCache_wrlock(pShard);
+		dnsRRCache_sweep(pShard, now);
+		dnsRRCache_unlock(pShard);
+	}
+
+	gSweepTimerId = osStartTimer(DNS_RR_CACHE_SWEEP_TIMEOUT, dns_onRRCacheSweepTimeout, NULL);
+}
+
+
+static void dnsRRCacheInfo_cleanup(void* data)
+{
+	dnsRRCacheInfo_t* pRRCache = data;
+    if(!pRRCache)
+    {
+        return;
+    }
+
+	//pRRCache has been removed from the shard table before being freed
+	dnsMessage_free(pRRCache->pDnsMsg);
+}
@@ -21,7 +21,7 @@
 
 
 
-static bool isRspHasNextLayerQ(char* qName, dnsQType_e qType, osList_t* pAddtlAnswerList, osList_t* qNameList);
+static bool isRspHasNextLayerQ(const osPointerLen_t* qName, dnsQType_e qType, dnsMessage_t* pDnsRspMsg, osList_t* qNameList);
 
 
 /* this function shall be called after receiving a query response.
@@ -47,15 +47,17 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
         case DNS_QTYPE_SRV:
 		case DNS_QTYPE_NAPTR:
         {
-            osListElement_t* pAnLE = pDnsRspMsg->answerList.head;
-            while(pAnLE)
+			dnsRR_t* pAnswer = NULL;
+			uint16_t answerNum = dnsMessage_getSection(pDnsRspMsg, DNS_SECTION_ANSWER, &pAnswer);
+            for(int anIdx=0; anIdx<answerNum; anIdx++)
             {
-				dnsRR_t* pAnDnsRR = pAnLE->data;
-				char* qName = NULL;
+				dnsRR_t* pAnDnsRR = &pAnswer[anIdx];
+				char qNameBuf[DNS_MAX_NAME_SIZE];
+				osPointerLen_t qName;
 				dnsQType_e qType = DNS_QTYPE_A;
 				if(pDnsRspMsg->query.qType == DNS_QTYPE_SRV)
 				{
-					qName = pAnDnsRR->srv.target;
+					qName = dnsRR_getSrvTarget(pDnsRspMsg, pAnDnsRR, qNameBuf);
 				}
 				else
 				{
@@ -63,38 +65,52 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
 					{
 						case DNS_NAPTR_FLAGS_A:
 							qType = DNS_QTYPE_A;
-							qName = pAnDnsRR->naptr.replacement;
+							qName = dnsRR_getNaptrReplacement(pDnsRspMsg, pAnDnsRR, qNameBuf);
 							break;
 						case DNS_NAPTR_FLAGS_S:
 							qType = DNS_QTYPE_SRV;
-							qName = pAnDnsRR->naptr.replacement;
+							qName = dnsRR_getNaptrReplacement(pDnsRspMsg, pAnDnsRR, qNameBuf);
 							break;
                         case DNS_NAPTR_FLAGS_U:
                         case DNS_NAPTR_FLAGS_P:
                         default:
-                            pAnLE = pAnLE->next;
                             continue;
                             break;
 					}
 				}
 
+				//"." means there is no such service at the domain, rfc2782 and rfc3403, there is nothing to query
+				if(!qName.l)
+				{
+					debug("the next layer qName of answer %d is <Root>, skip.", anIdx);
+					continue;
+				}
+
 				osList_t aQNameList = {};
-				bool isFound = isRspHasNextLayerQ(qName, qType, &pDnsRspMsg->addtlAnswerList, &aQNameList);
+				bool isFound = isRspHasNextLayerQ(&qName, qType, pDnsRspMsg, &aQNameList);
                 if(!isFound)
                 {
                     dnsMessage_t* pDnsMsg = NULL;
+                    dnsRcode_e negRcode = DNS_RCODE_NO_ERROR;
                     dnsQCacheInfo_t* pQCache = NULL;
 					osVPointerLen_t* nextQName = NULL;
 
-					//the next layer qName can be qName, or a element inside aQNameList (when aQNameList is not empty).  The qType
+					//the next layer qName can be qName, or the target of a SRV rr inside aQNameList (when aQNameList is not empty).  The qType
 					//for aQNameList is always DNS_QTYPE_A
 					if(!osList_isEmpty(&aQNameList))
 					{
 						osListElement_t* pLE = aQNameList.head;
 						while(pLE)
 						{
-							osPointerLen_t nextQName = {pLE->data, strlen((char*)pLE->data)};
-                    		qStatus = dnsQueryInternal(&nextQName, DNS_QTYPE_A, true, &pDnsMsg, &pQCache, dnsInternalCallback, pCbData);
+							char nextQNameBuf[DNS_MAX_NAME_SIZE];
+							osPointerLen_t nextQName = dnsRR_getSrvTarget(pDnsRspMsg, pLE->data, nextQNameBuf);
+							if(!nextQName.l)
+							{
+								debug("a SRV target is <Root>, skip.");
+								pLE = pLE->next;
+								continue;
+							}
+                    		qStatus = dnsQueryInternal(&nextQName, DNS_QTYPE_A, true, &pDnsMsg, &negRcode, &pQCache, dnsInternalCallback, pCbData);
 							switch(qStatus)
                     		{
 								case DNS_QUERY_STATUS_FAIL:
@@ -102,8 +118,16 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
 									goto EXIT;
 								case DNS_QUERY_STATUS_DONE:
 								{
+									//a cached NXDOMAIN, the target is skipped, the other targets keep resolving, see dnsInternalCallback()
+									if(!pDnsMsg)
+									{
+										debug("next layer qName(%r) has a cached NXDOMAIN, rcode=%d, skip.", &nextQName, negRcode);
+										break;
+									}
+
 									//this must be rrType == DNS_RR_DATA_TYPE_MSGLIST case, as pDnsRspMsg here is the next layer query response
-									osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pQCache);
+									osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pDnsMsg);
+									pCbData->pQNextInfo->pResResponse->isStale |= pDnsMsg->isStale;
 									//osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pDnsRspMsg);
 									if(pDnsMsg->query.qType == DNS_QTYPE_SRV)
 									{
@@ -125,8 +149,8 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
 					}
 					else
 					{
-						osPointerLen_t nextQName = {qName, strlen(qName)};
-                       	qStatus = dnsQueryInternal(&nextQName, qType, true, &pDnsMsg, &pQCache, dnsInternalCallback, pCbData);
+						osPointerLen_t nextQName = qName;
+                       	qStatus = dnsQueryInternal(&nextQName, qType, true, &pDnsMsg, &negRcode, &pQCache, dnsInternalCallback, pCbData);
 						switch(qStatus)
                         {
                             case DNS_QUERY_STATUS_FAIL:					
@@ -134,8 +158,16 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
 								goto EXIT;
 							case DNS_QUERY_STATUS_DONE:
                             {
+								//a cached NXDOMAIN, the target is skipped, the other targets keep resolving, see dnsInternalCallback()
+								if(!pDnsMsg)
+								{
+									debug("next layer qName(%r) has a cached NXDOMAIN, rcode=%d, skip.", &nextQName, negRcode);
+									break;
+								}
+
 								//this must be rrType == DNS_RR_DATA_TYPE_MSGLIST case, as pDnsRspMsg here is the next layer query response
 								osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pDnsMsg);
+								pCbData->pQNextInfo->pResResponse->isStale |= pDnsMsg->isStale;
                                 //osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pDnsRspMsg);
 
                                 if(pDnsMsg->query.qType == DNS_QTYPE_SRV)
@@ -153,8 +185,6 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
                         }
                 	}
 				}
-
-                pAnLE = pAnLE->next;
             }
             break;
         }
@@ -163,6 +193,12 @@ dnsQueryStatus_e dnsQueryNextLayer(dnsMessage_t* pDnsRspMsg, dnsNextQCallbackDat
     }
 
 EXIT:
+	//a next layer query started earlier in the loop may still be ongoing when the last one is done
+	if(qStatus == DNS_QUERY_STATUS_DONE && !osList_isEmpty(&pCbData->pQNextInfo->qCacheList))
+	{
+		qStatus = DNS_QUERY_STATUS_ONGOING;
+	}
+
 	DEBUG_END
 	return qStatus;
 }
@@ -190,9 +226,21 @@ void dnsInternalCallback(dnsResResponse_t* pRR, void* pData)
 	switch(pRR->rrType)
 	{
 		case DNS_RR_DATA_TYPE_STATUS:
+			//a next layer name that does not exist is skipped, the same as a cached NXDOMAIN in dnsQueryNextLayer().  dnsRspList is only empty for the app's own query
+			if(pRR->status.resStatus == DNS_RES_STATUS_OK && pRR->status.dnsRCode == DNS_RCODE_NAME_ERROR && pCbData->pQNextInfo->pResResponse->rrType != DNS_RR_DATA_TYPE_STATUS && !osList_isEmpty(&pCbData->pQNextInfo->pResResponse->dnsRspList))
+			{
+				debug("next layer qName(%r) does not exist, skip.", pRR->status.pQName);
+				if(osList_isEmpty(&pCbData->pQNextInfo->qCacheList))
+				{
+					pCbData->pQNextInfo->origAppData.rrCallback(pCbData->pQNextInfo->pResResponse, pCbData->pQNextInfo->origAppData.pAppData);
+					osfree(pCbData);
+				}
+				goto EXIT;
+			}
+
 			if(pCbData->pQNextInfo->pResResponse->rrType != DNS_RR_DATA_TYPE_STATUS)
 			{
-				osList_delete(&pCbData->pQNextInfo->pResResponse->dnsRspList);
+				dnsMessage_freeList(&pCbData->pQNextInfo->pResResponse->dnsRspList);
 				pCbData->pQNextInfo->pResResponse->rrType = DNS_RR_DATA_TYPE_STATUS;
 				pCbData->pQNextInfo->pResResponse->status = pRR->status;
 	
@@ -212,12 +260,13 @@ void dnsInternalCallback(dnsResResponse_t* pRR, void* pData)
         		{
             		osfree(pCbData);
         		}
-				osfree(pRR->pDnsRsp);
+				dnsMessage_free(pRR->pDnsRsp);
 				goto EXIT;
 			}
 			else
 			{
 				osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pRR->pDnsRsp);
+				pCbData->pQNextInfo->pResResponse->isStale |= pRR->isStale;
 			}
 			break;
 		case DNS_RR_DATA_TYPE_MSGLIST:
@@ -241,19 +290,18 @@ void dnsInternalCallback(dnsResResponse_t* pRR, void* pData)
     	case DNS_QUERY_STATUS_DONE:
 			if(osList_isEmpty(&pCbData->pQNextInfo->qCacheList))
 			{
-                //refer RR for app.  When app frees pResResponse, RR will be dereferred
-                dnsResResponse_memref(pCbData->pQNextInfo->pResResponse);
+                //every dnsMsg in dnsRspList has already been referred, either by dnsQueryInternal() or when notifying this callback
 				pCbData->pQNextInfo->origAppData.rrCallback(pCbData->pQNextInfo->pResResponse, pCbData->pQNextInfo->origAppData.pAppData);
 
 				osfree(pCbData);
 			}
 			break;
     	case DNS_QUERY_STATUS_FAIL:
-			osList_delete(&pCbData->pQNextInfo->pResResponse->dnsRspList);
+			dnsMessage_freeList(&pCbData->pQNextInfo->pResResponse->dnsRspList);
 
  			pCbData->pQNextInfo->pResResponse->rrType = DNS_RR_DATA_TYPE_STATUS;
 			pCbData->pQNextInfo->pResResponse->status.resStatus = DNS_RES_ERROR_RECURSIVE;	
-			pCbData->pQNextInfo->pResResponse->status.pQName = NULL;
+			pCbData->pQNextInfo->pResResponse->status.pQName = &pCbData->pQNextInfo->qName.pl;
 		
             if(osList_isEmpty(&pCbData->pQNextInfo->qCacheList))
             {
@@ -283,14 +331,14 @@ EXIT:
  * qName: the qName for next layer query.  For example, if a naptr query resonse calls this function, qName will be the replacement
  *        of the naptr query response.  if a SRV query reponse calls this function, qname is the target of the srv query response.
  * qType: the query type for next layer query.  for example, if SRV query calls this function, the query type will be DNS_QTYPE_A.
- * pAddtlAnswerList: the additional answer RR of the query response that calls this function
- * qNameList: list of next next layer query name.  For example, a naptr query calls this function, and passes in a SRV qname.  If
+ * pDnsRspMsg: the query response that calls this function, its additional answer RR are searched
+ * qNameList: list of the SRV rr whose target is a next next layer query name.  For example, a naptr query calls this function, and passes in a SRV qname.  If
  * the attitonl answer does not contain the SRV qname, then the qNameList will be empty, the return value will be FALSE.  But if
  * the additional answer rr has one or more answers for the SRV qname, this function will continue to search the DNS_QTYPE_A  
  * answer for the corresponding SRV targets.  If not found, the unfound target will be put into the qNameList, and the return value
  * will be FALSE, even though SRV answer was found
  */
-static bool isRspHasNextLayerQ(char* qName, dnsQType_e qType, osList_t* pAddtlAnswerList, osList_t* qNameList)
+static bool isRspHasNextLayerQ(const osPointerLen_t* qName, dnsQType_e qType, dnsMessage_t* pDnsRspMsg, osList_t* qNameList)
 {
 DEBUG_BEGIN
     int isFound = false;
@@ -301,17 +349,19 @@ DEBUG_BEGIN
 		goto EXIT;
 	}
 
-	osListElement_t* pArLE = pAddtlAnswerList->head;
-    while(pArLE)
+	//the additional answer is only decoded when a next layer query is looked up in it
+	dnsRR_t* pAddtlAnswer = NULL;
+	uint16_t addtlAnswerNum = dnsMessage_getSection(pDnsRspMsg, DNS_SECTION_ADDTL_ANSWER, &pAddtlAnswer);
+    for(int i=0; i<addtlAnswerNum; i++)
     {
-    	dnsRR_t* pArDnsRR = pArLE->data;
-		debug("qName=%s, pArDnsRR->type=%d, qType=%d", qName, pArDnsRR->type, qType);
+    	dnsRR_t* pArDnsRR = &pAddtlAnswer[i];
+		debug("qName=%r, pArDnsRR->type=%d, qType=%d", qName, pArDnsRR->type, qType);
 
 		//found the match for qName in the additional answer.  be noted for some qType, like SRV, there may have more than one match 
 		//for qName, so need to continue search until the additional answer is completely searched
-        if(pArDnsRR->type == qType && strcasecmp(pArDnsRR->name, qName) == 0)
+        if(pArDnsRR->type == qType && dnsMessage_isNameEqual(pDnsRspMsg, pArDnsRR->nameOff, qName))
         {
-            debug("find a qName match in the addtlAnswer, uri=%s, qType=%d", pArDnsRR->name, qType);
+            debug("find a qName match in the addtlAnswer, uri=%r, qType=%d", qName, qType);
 
 			//for A query, assume only one answer per qName, so as soon as one match is found, return 
 			if(qType == DNS_QTYPE_A)
@@ -323,14 +373,15 @@ DEBUG_BEGIN
 			//for SRV, needs to check next layer, which is A query layer.  note the whole additional answer rr is to be searched until one is found
 			if(qType == DNS_QTYPE_SRV)
 			{
-				isFound = isRspHasNextLayerQ(pArDnsRR->srv.target, DNS_QTYPE_A, pAddtlAnswerList, NULL);
+				char targetBuf[DNS_MAX_NAME_SIZE];
+				osPointerLen_t target = dnsRR_getSrvTarget(pDnsRspMsg, pArDnsRR, targetBuf);
+				isFound = isRspHasNextLayerQ(&target, DNS_QTYPE_A, pDnsRspMsg, NULL);
 				if(!isFound)
 				{
-					osList_append(qNameList, pArDnsRR->srv.target);
+					osList_append(qNameList, pArDnsRR);
 				}
 			}
         }
-        pArLE = pArLE->next;
     }
 
 	//if there are multiple qname entries, some are in the additional answer rr, some are not, mark isFound = false
@@ -368,6 +419,7 @@ void dnsNextQInfo_cleanup(void* pData)
 
 	dnsNextQInfo_t* pNQInfo = pData;
 	osList_clear(&pNQInfo->qCacheList);
+	osVPL_free(&pNQInfo->qName, true);
 	//if app needs pNQInfo->pResResponse, they shall refer the data structure
     osfree(pNQInfo->pResResponse);
 }
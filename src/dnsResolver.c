@@ -8,9 +8,10 @@
 
 #include <endian.h>
 #include <string.h>
+#include <stddef.h>
+#include <time.h>
 
 #include "osSockAddr.h"
-#include "osHash.h"
 #include "osList.h"
 #include "osMemory.h"
 #include "osMBuf.h"
@@ -24,31 +25,54 @@
 #include "dnsResolver.h"
 #include "dnsResolverIntf.h"
 #include "dnsConfig.h"
+#include "dnsCacheTable.h"
+#include "dnsTimerWheel.h"
+#include "dnsRRCache.h"
+#include "dnsInflight.h"
+#include "dnsUdpPool.h"
+#include "dnsTcp.h"
+#include "dnsEvent.h"
+#include "dnsService.h"
 
 
-static __thread osHash_t* gRRCache;	//cached rr records
-static __thread osHash_t* gQCache;	//ongoing queries, each element contains dnsQCacheInfo_t, multiple requests with the same qName and qType are combined into one element with each request's appData is appended in appDataList
-//static __thread osList_t serverFd;	//each element contains dnsUdpActiveFdInfo_t.
+static __thread dnsCacheTable_t gQCache;	//ongoing queries, each element contains dnsQCacheInfo_t, multiple requests with the same qName and qType are combined into one element with each request's appData is appended in appDataList
 static __thread dnsServerSelInfo_t gServerSelInfo;
-static __thread uint16_t gDnsTrId;
-
-static osStatus_e dnsHashLookup(osHash_t* pHash, osPointerLen_t* qName, dnsQType_e qType, void** pHashData);
-static dnsQCacheInfo_t* dnsRRMatchQCacheAndNotifyApp(osPointerLen_t* qName, dnsQType_e qType, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
-static bool dnsIsQueryOngoing(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache);
-static osStatus_e dnsPerformQuery(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache);
+static __thread uint64_t gHedgeSec;		//the second gHedgeNum is counted for
+static __thread uint32_t gHedgeNum;		//the queries hedged in gHedgeSec, capped by DNS_HEDGE_BUDGET
+
+static void dnsQCacheNotifyApp(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
+static void dnsQAppListNotify(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
+static bool dnsIsQueryOngoing(const dnsCacheKey_t* pKey, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache);
+static osStatus_e dnsPerformQuery(osPointerLen_t* qName, const dnsCacheKey_t* pKey, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache);
+static osStatus_e dnsSendQuery(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo);
+static osStatus_e dnsSendQueryTcp(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo);
+static osStatus_e dnsQCacheAddPendingId(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo, int fd);
+static dnsQPendingId_t* dnsQCacheGetPendingId(dnsQCacheInfo_t* pQCache, int fd, uint16_t trId);
+static void dnsQCacheStopWaiting(dnsQPendingId_t* pPendingId);
+static void dnsQCacheAnswered(dnsQPendingId_t* pPendingId);
+static void dnsQCacheStartHedge(dnsQCacheInfo_t* pQCache);
+static osStatus_e dnsQCacheAdd(dnsQCacheInfo_t* pQCache);
+static void dnsCacheNegativeRsp(dnsQCacheInfo_t* pQCache, dnsMessage_t* pDnsMsg, dnsRcode_e replyCode);
+static void dnsPrefetch(osPointerLen_t* qName, const dnsCacheKey_t* pKey);
+static void dnsPrefetchCallback(dnsResResponse_t* pRR, void* pData);
+static void dnsInflightResultCallback(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg);
 static void dnsTpCallback(transportStatus_e tStatus, int fd, osMBuf_t* pBuf);
-static dnsMessage_t* dnsParseMessage(osMBuf_t* pBuf, dnsRcode_e* replyCode);
-static osStatus_e dnsParseDomainName(osMBuf_t* pBuf, char* pUri);
-static osStatus_e dnsParseQuestion(osMBuf_t* pBuf, dnsQuestion_t* pQuery);
-static dnsRR_t* dnsParseRR(osMBuf_t* pBuf);
-static void dns_onQCacheTimeout(uint64_t timerId, void* ptr);
-static void dns_onRRCacheTimeout(uint64_t timerId, void* ptr);
+static void dnsProcessResponse(int fd, osMBuf_t* pBuf);
+static void dns_onQCacheTimeout(void* ptr);
+static void dns_onInflightWaitTimeout(void* ptr);
+static void dns_onClientRspTimeout(void* ptr);
 static void dns_onServerQuarantineTimeout(uint64_t timerId, void* ptr);
-static dnsServerInfo_t* dnsGetServer();
-static uint16_t dnsCreateTrId();
-static void dnsMessage_cleanup(void* data);
+static void dns_onHedgeTimeout(void* ptr);
+static dnsServerInfo_t* dnsGetServer(dnsServerInfo_t* pExcludeServer);
+static void dnsServerRtt_add(dnsServerInfo_t* pServerInfo, uint32_t rtt);
+static uint32_t dnsServerRtt_getHedgeDelay(dnsServerInfo_t* pServerInfo);
+static uint32_t dnsServerRtt_getRto(dnsServerInfo_t* pServerInfo);
+static void dnsServerRtt_backoff(dnsServerInfo_t* pServerInfo);
+static void dnsServer_updateTimeoutRate(dnsServerInfo_t* pServerInfo, bool isTimeout);
+static dnsServerInfo_t* dnsGetServerByLatency(dnsServerInfo_t* pExcludeServer);
+static uint64_t dnsServer_getCost(dnsServerInfo_t* pServerInfo);
+static uint64_t dnsResolver_getTime();
 static void dnsQCacheInfo_cleanup(void* data);
-static void dnsRRCacheInfo_cleanup(void* data);
 
 
 
@@ -58,6 +82,13 @@ osStatus_e dnsResolver_init()
 	osStatus_e status = OS_STATUS_OK;
 	const dnsConfig_t* pDnsConfig = NULL;
 
+	status = dnsEvent_init();
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsEvent_init.");
+		goto EXIT;
+	}
+
 	pDnsConfig = dns_getConfig();
 	if(!pDnsConfig)
     {
@@ -73,22 +104,31 @@ osStatus_e dnsResolver_init()
 		goto EXIT;
 	}
 
-	gRRCache = osHash_create(pDnsConfig->rrHashSize);
-	if(!gRRCache)
+	status = dnsRRCache_init(pDnsConfig);
+	if(status != OS_STATUS_OK)
     {
-        logError("fails to create gRRCache");
-        status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+        logError("fails to create rr cache");
         goto EXIT;
     }
 
-	gQCache = osHash_create(pDnsConfig->qHashSize);
-    if(!gQCache)
+	status = dnsCacheTable_init(&gQCache, pDnsConfig->qHashSize, offsetof(dnsQCacheInfo_t, key));
+    if(status != OS_STATUS_OK)
     {
         logError("fails to create gQCache");
-        status = OS_ERROR_MEMORY_ALLOC_FAILURE;
         goto EXIT;
     }
 
+	//when the rr cache is shared, the same query from different threads are combined too
+	if(dnsRRCache_isShared())
+	{
+		status = dnsInflight_init(dnsInflightResultCallback);
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to dnsInflight_init.");
+			goto EXIT;
+		}
+	}
+
 	//build serverSelInfo.  the serverSelInfo.serverInfo is sorted with least priority first
 	int color[DNS_MAX_SERVER_NUM] = {};
 	for(int i=0; i<pDnsConfig->serverNum; i++)
@@ -124,11 +164,26 @@ osStatus_e dnsResolver_init()
 
 		gServerSelInfo.serverInfo[i].priority = pDnsConfig->dnsServer[curNode].priority;
 		gServerSelInfo.serverInfo[i].quarantineTimerId = 0;
+
+		status = dnsUdpPool_init(&gServerSelInfo.serverInfo[i], dnsProcessResponse);
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to dnsUdpPool_init for ipPortNum=%d", i);
+			goto EXIT;
+		}
+	}
+
+	status = dnsTcp_init(dnsProcessResponse);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsTcp_init.");
+		goto EXIT;
 	}
 
 	gServerSelInfo.serverSelMode = pDnsConfig->serverSelMode;
 	gServerSelInfo.serverNum = pDnsConfig->serverNum;
 	gServerSelInfo.curNodeSelIdx = 0;	
+	gServerSelInfo.randomState = (uint32_t)dnsResolver_getTime() | 1;
 
 	transport_localRegApp(TRANSPORT_APP_TYPE_DNS, dnsTpCallback);
 EXIT:
@@ -136,17 +191,54 @@ EXIT:
 }
 
 
-/* if isCacheRR == true, caller indicates cache the RR if possible, otherwise, the resolver would not cache the rr.  The resolver also uses this flag to check if it needs to check the rrCache first before performing dns query.  It is expected that user may not want to set this flag to true for NSAPR u query (enum query) as each call may require a enum query and the same E164 number may not re-occur for long time, it will be waste of resources to store its rr
+//called instead of dnsResolver_init() in a dedicated resolver thread, see dnsService.c
+osStatus_e dnsResolver_initService()
+{
+	osStatus_e status = dnsResolver_init();
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsResolver_init.");
+		goto EXIT;
+	}
+
+	status = dnsService_init();
+
+EXIT:
+	return status;
+}
+
+
+//called instead of dnsResolver_init() in an app thread whose queries are resolved by the dedicated resolver threads
+osStatus_e dnsResolver_initClient()
+{
+	return dnsService_initClient();
+}
+
+
+int dnsResolver_getEventFd()
+{
+	return dnsEvent_getFd();
+}
+
+
+void dnsResolver_onEvent()
+{
+	dnsEvent_process();
+}
+
+
+/* if isCacheRR == true, caller indicates cache the RR if possible, otherwise, the resolver would not cache the rr.  The resolver also uses this flag to check if it needs to check the rrCache first before performing dns query.  It is expected that user may not want to set this flag to true for NSAPR u query (enum query) as each call may require a enum query and the same E164 number may not re-occur for long time, it will be waste of resources to store its rr.  Even if the flag is set, when the rrCache is full, it only admits a rr whose qName/qType has been queried repeatedly recently, see dnsRRCache_add()
+ * when DNS_QUERY_STATUS_DONE is returned, *qResponse has been referred for the caller, caller shall dnsMessage_free() it when done.  If the rrCache has a negative response (NXDOMAIN or NODATA) for the qName/qType, DNS_QUERY_STATUS_DONE is returned with *qResponse = NULL, and *pNegRcode tells which one
 */
-dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsMessage_t** qResponse, dnsQCacheInfo_t** ppQCache, dnsResolver_callback_h rrCallback, void* pData)
+dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsMessage_t** qResponse, dnsRcode_e* pNegRcode, dnsQCacheInfo_t** ppQCache, dnsResolver_callback_h rrCallback, void* pData)
 {
 	DEBUG_BEGIN
 	dnsQueryStatus_e qStatus = DNS_QUERY_STATUS_ONGOING;
 	osStatus_e status = OS_STATUS_OK;
 
-	if(!qName || !qResponse || !rrCallback || !ppQCache)
+	if(!qName || !qResponse || !pNegRcode || !rrCallback || !ppQCache)
 	{
-		logError("null pointer, qName=%p, qResponse=%p, rrCallback=%p, ppQCache=%p.", qName, qResponse, rrCallback, ppQCache);
+		logError("null pointer, qName=%p, qResponse=%p, pNegRcode=%p, rrCallback=%p, ppQCache=%p.", qName, qResponse, pNegRcode, rrCallback, ppQCache);
 		status = OS_ERROR_NULL_POINTER;
 		goto EXIT;
 	}
@@ -161,42 +253,62 @@ dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool
 	*qResponse = NULL;
 	*ppQCache = NULL;
 
+	//the key used by all caches, qName is normalized to the lower case wire format
+	dnsCacheKey_t qKey;
+	status = dnsCacheKey_build(qName, qType, &qKey);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsCacheKey_build for qName(%r).", qName);
+		goto EXIT;
+	}
+
 	debug("qName=%r, qType=%d, isCacheRR=%d", qName, qType, isCacheRR);
 	if(isCacheRR)
 	{
 		//check if there is cached response
-		dnsRRCacheInfo_t* pRRCache = NULL;
-		status = dnsHashLookup(gRRCache, qName, qType, (void**)&pRRCache);
-		if(status != OS_STATUS_OK)
+		bool isPrefetch = false;
+		bool isNegative = false;
+		*qResponse = dnsRRCache_lookup(&qKey, &isPrefetch, &isNegative, pNegRcode);
+		if(isNegative)
 		{
-			logError("fails to dnsHashLookup for qName(%r), qType(%d).", qName, qType);
+			logInfo("find a cached NXDOMAIN for qName(%r), qType(%d), rcode=%d.", qName, qType, *pNegRcode);
+			qStatus = DNS_QUERY_STATUS_DONE;
 			goto EXIT;
 		}
 
-		if(pRRCache)
+		if(*qResponse)
 		{
-			*qResponse = pRRCache->pDnsMsg;
-			if(!*qResponse)
+			logInfo("find a cached DNS query response for qName(%r), qType(%d).", qName, qType);
+			if(isPrefetch)
 			{
-				logError("a dnsMsg is cached in gRRCache, but is empty.");
-				status = OS_ERROR_INVALID_VALUE;
-				goto EXIT;
+				dnsPrefetch(qName, &qKey);
 			}
-			logInfo("find a cached DNS query response for qName(%r), qType(%d).", qName, qType);
+
 			qStatus = DNS_QUERY_STATUS_DONE;
 			goto EXIT;
 		}
 	}
  	
 	//check if a query is ongoing for the same qName
-	if(dnsIsQueryOngoing(qName, qType, isCacheRR, rrCallback, pData, ppQCache))
+	if(dnsIsQueryOngoing(&qKey, isCacheRR, rrCallback, pData, ppQCache))
 	{
 		logInfo("there is a query ongoing for qName(%r), qType(%d).", qName, qType);
 		goto EXIT;
 	}
 
 	//do not find a cached query response, neither there is a ongoing query, perform a brand new query		
-	status = dnsPerformQuery(qName, qType, isCacheRR, rrCallback, pData, ppQCache);
+	status = dnsPerformQuery(qName, &qKey, isCacheRR, rrCallback, pData, ppQCache);
+	if(status != OS_STATUS_OK && isCacheRR && DNS_RR_STALE_WINDOW)
+	{
+		//no server is available to query, serve the expired rr if it is still in the stale window
+		*qResponse = dnsRRCache_lookupStale(&qKey);
+		if(*qResponse)
+		{
+			logInfo("fails to perform query, serve the stale rr for qName(%r), qType(%d).", qName, qType);
+			status = OS_STATUS_OK;
+			qStatus = DNS_QUERY_STATUS_DONE;
+		}
+	}
 
 EXIT:
 	if(status != OS_STATUS_OK)
@@ -208,118 +320,78 @@ EXIT:
 }	
 
 
-
-static osStatus_e dnsHashLookup(osHash_t* pHash, osPointerLen_t* qName, dnsQType_e qType, void** pHashData)
+static void dnsQCacheNotifyApp(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg)
 {
-	osStatus_e status = OS_STATUS_OK;
-	*pHashData = NULL;
+    //remove from hash.  Intentionally put before the notifying of pDnsMsg to app to allow app to add the same entry (may not be necessary though)
+	if(pQCache->isInQCache)
+	{
+    	dnsCacheTable_delete(&gQCache, pQCache);
+		pQCache->isInQCache = false;
+	}
 
-	uint32_t hashKeyInt = osHash_getKeyPL_extraKey(qName, false, qType);
+	dnsTimerWheel_stop(&pQCache->clientRspTimer);
 
-	osListElement_t* pHashElement = osHash_lookupByKey(pHash, &hashKeyInt, OSHASHKEY_INT);
-	if(pHashElement)
+	//the query fails, serve the expired rr if it is still in the stale window, see rfc8767
+	dnsMessage_t* pStaleMsg = NULL;
+	if(pQCache->isCacheRR && DNS_RR_STALE_WINDOW && (rrStatus != DNS_RES_STATUS_OK || (pDnsMsg && (pDnsMsg->hdr.flags & DNS_RCODE_MASK) == DNS_RCODE_SERVER_FAILURE)))
 	{
-		osHashData_t* pHashNode = pHashElement->data;
-		if(!pHashNode)
+		pStaleMsg = dnsRRCache_lookupStale(&pQCache->key);
+		if(pStaleMsg)
 		{
-			logError("pHashData is NULL for qName(%r), qType(%d).", qName, qType);
-			status = OS_ERROR_INVALID_VALUE;
-		}
-		else
-		{
-			*pHashData = pHashNode->pData;
+			logInfo("query fails, rrStatus=%d, serve the stale rr for qName(%r), qType(%d).", rrStatus, &pQCache->qName.pl, pQCache->qType);
+			rrStatus = DNS_RES_STATUS_OK;
+			pDnsMsg = pStaleMsg;
 		}
 	}
 
-	return status;
-}
-	
+	//if other threads are waiting for this query, pass the result to them
+	dnsInflight_complete(pQCache, rrStatus, pDnsMsg);
 
-static dnsQCacheInfo_t* dnsRRMatchQCacheAndNotifyApp(osPointerLen_t* qName, dnsQType_e qType, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg)
-{
-	osStatus_e status = OS_STATUS_OK;
-    dnsQCacheInfo_t* pQCache = NULL;
- 
-    /* find the request owners and forward the result. */
-    if(dnsHashLookup(gQCache, qName, qType, (void**)&pQCache) != OS_STATUS_OK)
-    {
-        logError("fails to dnsHashLookup in gQCache for qName(%r), qType(%d).", qName, qType);
-        status = OS_ERROR_INVALID_VALUE;
-        goto EXIT;
-    }
+	dnsQAppListNotify(pQCache, rrStatus, pDnsMsg);
 
-    if(!pQCache)
-    {
-        logInfo("find an entry in gQCache hash for qName(%r), qType(%d), but pQCache is NULL.", qName, qType);
-        status = OS_ERROR_INVALID_VALUE;
-        goto EXIT;
-    }
+	dnsMessage_free(pStaleMsg);
+}
 
-    //remove from hash.  Intentionally put before the notifying of pDnsMsg to app to allow app to add the same entry (may not be necessary though)
-    osHash_deleteNode(pQCache->pHashElement, OS_HASH_DEL_NODE_TYPE_KEEP_USER_DATA);
 
-    //notify the request owners one after another
+//notify the request owners one after another
+static void dnsQAppListNotify(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg)
+{
     osListElement_t* pLE = pQCache->appDataList.head;
     while(pLE)
     {
-		dnsRcode_e replyCode = pDnsMsg->hdr.flags & DNS_RCODE_MASK;
+		dnsRcode_e replyCode = pDnsMsg ? pDnsMsg->hdr.flags & DNS_RCODE_MASK : DNS_RCODE_NO_ERROR;
 		dnsResResponse_t* pRR = osmalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
 	    //in this function, rrType can only take either DNS_RR_DATA_TYPE_MSG or DNS_RR_DATA_TYPE_STATUS		
     	if(rrStatus == DNS_RES_STATUS_OK && replyCode == DNS_RCODE_NO_ERROR)
     	{
         	pRR->rrType = DNS_RR_DATA_TYPE_MSG;
 	        //refer pDnsRsp for app.  When app frees pResResponse, RR will be dereferred
-        	pRR->pDnsRsp = osmemref(pDnsMsg);
+        	pRR->pDnsRsp = dnsMessage_ref(pDnsMsg);
+			pRR->isStale = pDnsMsg->isStale;
     	}
     	else
     	{
         	pRR->rrType = DNS_RR_DATA_TYPE_STATUS;
-			pRR->status.pQName = qName;
+			pRR->status.pQName = &pQCache->qName.pl;
         	pRR->status.resStatus = rrStatus;
 			pRR->status.dnsRCode = replyCode;
+			pRR->isStale = false;
     	}
 
         dnsQAppInfo_t* pApp = pLE->data;
         pApp->rrCallback(pRR, pApp->pAppData);
         pLE = pLE->next;
     }
-
-EXIT:
-	if(status != OS_STATUS_OK)
-	{
-		pQCache = NULL;
-	}
-
-	return pQCache;
 }
 
 
-static bool dnsIsQueryOngoing(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache)
+static bool dnsIsQueryOngoing(const dnsCacheKey_t* pKey, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache)
 {
-	osStatus_e status = OS_STATUS_OK;
 	bool isQOngoing = false;
-	dnsQCacheInfo_t* pQuery = NULL;
-
-	uint32_t hashKeyInt = osHash_getKeyPL_extraKey(qName, false, qType);
-	osListElement_t* pHashElement = osHash_lookupByKey(gQCache, &hashKeyInt, OSHASHKEY_INT);
-	if(!pHashElement)
-	{
-		goto EXIT;
-	}
 
-	osHashData_t* pHashData = pHashElement->data;
-    if(!pHashData)
-    {
-        logError("pHashData is NULL for qName(%r), qType(%d), unexpected.", qName, qType);
-		status = OS_ERROR_INVALID_VALUE;
-		goto EXIT;
-    }
-			
-	pQuery = pHashData->pData;
+	dnsQCacheInfo_t* pQuery = dnsCacheTable_lookup(&gQCache, pKey);
 	if(!pQuery)
 	{
-		logError("qName(%r), qType(%d) has an entry in gQCache hash, but pQueryInfo is NULL, unexpected.", qName, qType);
-		status = OS_ERROR_INVALID_VALUE;
 		goto EXIT;
 	}
 
@@ -333,7 +405,6 @@ static bool dnsIsQueryOngoing(osPointerLen_t* qName, dnsQType_e qType, bool isCa
 	if(!pQAppInfo)
 	{
 		logError("fails to osmalloc for pQAppInfo.");
-		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
 		goto EXIT;
 	}
 
@@ -348,8 +419,9 @@ EXIT:
 }
 
 
-static osStatus_e dnsPerformQuery(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache)
+static osStatus_e dnsPerformQuery(osPointerLen_t* qName, const dnsCacheKey_t* pKey, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData, dnsQCacheInfo_t** ppQCache)
 {
+	dnsQType_e qType = pKey->qType;
 	osStatus_e status = OS_STATUS_OK;
 
 	osMBuf_t* pBuf = NULL;
@@ -384,18 +456,28 @@ static osStatus_e dnsPerformQuery(osPointerLen_t* qName, dnsQType_e qType, bool
     }
 
 	osVPL_copyPL(&pQCache->qName, qName);
+	pQCache->key = *pKey;
 	pQCache->qType = qType;
 	pQCache->isCacheRR = isCacheRR;
 	pQAppInfo->rrCallback = rrCallback;
 	pQAppInfo->pAppData = pData;
 	osList_append(&pQCache->appDataList, pQAppInfo);
 
+	//when the rr cache is shared, another thread may be performing the same query, wait for its result instead of sending a new one
+	if(dnsRRCache_isShared() && dnsInflight_join(pQCache) == DNS_INFLIGHT_ROLE_WAITER)
+	{
+		//the owner thread may try all allowed servers before giving up
+		dnsTimerWheel_start(&pQCache->waitForRespTimer, DNS_WAIT_RESPONSE_TIMEOUT * DNS_MAX_ALLOWED_SERVER_NUM_PER_QUERY, dns_onInflightWaitTimeout, pQCache);
+		status = dnsQCacheAdd(pQCache);
+		goto EXIT;
+	}
+
 	//fill the query header
-	osMBuf_writeU16(pBuf, dnsCreateTrId(), true);			//transaction ID
+	osMBuf_writeU16(pBuf, 0, true);							//transaction ID, filled per send by dnsSendQuery()
 	osMBuf_writeU16(pBuf, htobe16(1<<DNS_RD_POS), true);	//flags
 	osMBuf_writeU16(pBuf, htobe16(1), true);				//qustions
 	osMBuf_writeU32(pBuf, 0, true);					//answer, authority RRs
-	osMBuf_writeU16(pBuf, 0, true);					//additional RRs
+	osMBuf_writeU16(pBuf, htobe16(DNS_EDNS_PAYLOAD_SIZE ? 1 : 0), true);	//additional RRs, the OPT rr
 
 	//fill uri
 	size_t labelPos = pBuf->pos++;
@@ -420,512 +502,492 @@ static osStatus_e dnsPerformQuery(osPointerLen_t* qName, dnsQType_e qType, bool
 	osMBuf_writeU16(pBuf, htobe16(qType), true);
 	osMBuf_writeU16(pBuf, htobe16(DNS_CLASS_IN), true);
 
-	//send message to tp to be transmitted.  support UDP only.  true is for persistent
-	transportInfo_t tpInfo;
-	tpInfo.isCom = false;
-	tpInfo.tpType = TRANSPORT_TYPE_UDP;
-    dnsServerInfo_t* pServerInfo = dnsGetServer();
+	//advertise the udp payload size the response can use, so that the server does not have to trim the additional rr, rfc6891
+	if(DNS_EDNS_PAYLOAD_SIZE)
+	{
+		osMBuf_writeU8(pBuf, 0, true);								//name, <Root>
+		osMBuf_writeU16(pBuf, htobe16(DNS_QTYPE_OPT), true);
+		osMBuf_writeU16(pBuf, htobe16(DNS_EDNS_PAYLOAD_SIZE), true);	//class, the udp payload size
+		osMBuf_writeU32(pBuf, 0, true);								//ttl, extended rcode, version 0 and flags
+		osMBuf_writeU16(pBuf, 0, true);								//rdata length, no option
+	}
+
+    dnsServerInfo_t* pServerInfo = dnsGetServer(NULL);
 	if(!pServerInfo)
 	{
         logError("no dns server available.");
 		status = OS_ERROR_NETWORK_FAILURE;
 		goto EXIT;
 	}
-	pQCache->pServerInfo = pServerInfo;
 
-	tpInfo.local = dnsConfig_getLocalSockAddr();
-    tpInfo.peer = pServerInfo->socketAddr;
-	tpInfo.udpInfo.isUdpWaitResponse = true;
-	tpInfo.udpInfo.isEphemeralPort = true;
-	tpInfo.udpInfo.fd = -1;
-	tpInfo.protocolUpdatePos = 0;
-	transportStatus_e tStatus = transport_localSend(TRANSPORT_APP_TYPE_DNS, &tpInfo, pBuf, NULL); 
-	if(tStatus != TRANSPORT_STATUS_UDP)
+	status = dnsSendQuery(pQCache, pServerInfo);
+	if(status != OS_STATUS_OK)
 	{
-		logError("fails to transport_localSend.");
-		status = OS_ERROR_NETWORK_FAILURE;
 		goto EXIT;
 	}
 
-	//start wait for response timer
-	pQCache->waitForRespTimerId = osStartTimer(DNS_WAIT_RESPONSE_TIMEOUT, dns_onQCacheTimeout, pQCache); 
+	//start wait for response timer, from the rtt of the server
+	dnsTimerWheel_start(&pQCache->waitForRespTimer, dnsServerRtt_getRto(pServerInfo), dns_onQCacheTimeout, pQCache);
+	dnsQCacheStartHedge(pQCache);
 
-	osHashData_t* pHashData = oszalloc(sizeof(osHashData_t), NULL);
-    if(!pHashData)
-    {
-        logError("fails to allocate pHashData.");
-
-		//keep fd.  the rr response will be dropped eventually since pQCache will be removed 
-        status = OS_ERROR_MEMORY_ALLOC_FAILURE;
-        goto EXIT;
-    }
-
-    pHashData->hashKeyType = OSHASHKEY_INT;
-	pHashData->hashKeyInt = osHash_getKeyPL_extraKey(qName, false, qType);
-	pHashData->pData = pQCache;
-	pQCache->pHashElement = osHash_add(gQCache, pHashData);
+	//keep fd if fails.  the rr response will be dropped eventually since pQCache will be removed 
+	status = dnsQCacheAdd(pQCache);
 
 EXIT:
 	if(status != OS_STATUS_OK)
 	{
 		pQCache = osfree(pQCache);
 	}
+	else if(isCacheRR && DNS_RR_STALE_WINDOW)
+	{
+		//if the query takes too long, the apps get the stale rr, if there is one, while the query continues to refresh the rr cache
+		dnsTimerWheel_start(&pQCache->clientRspTimer, DNS_CLIENT_RSP_TIMEOUT, dns_onClientRspTimeout, pQCache);
+	}
 
 	*ppQCache = pQCache;
 	return status;
 }
 
 
-static void dnsTpCallback(transportStatus_e tStatus, int fd, osMBuf_t* pBuf)
+//refresh a cached rr that is about to expire, the response replaces the rr in dnsProcessResponse()
+static void dnsPrefetch(osPointerLen_t* qName, const dnsCacheKey_t* pKey)
 {
-	DEBUG_BEGIN
-
-	osStatus_e status = OS_STATUS_OK;
-	dnsRcode_e replyCode = 0;
-	dnsMessage_t* pDnsMsg = NULL;
-    dnsQCacheInfo_t* pQCache = NULL;
-	dnsRRCacheInfo_t* pRRCache = NULL;
-
-	//some thing is wrong with a udp fd.  For query waiting on the fd, the timeout will take care of it
-	if(tStatus != TRANSPORT_STATUS_UDP)
+	//a query for the same qName/qType is ongoing, its response refreshes the rr too.  It is not a prefetch, if it fails, a
+	//later lookup shall be able to refresh the rr
+	if(dnsCacheTable_lookup(&gQCache, pKey))
 	{
-		//to-do, need to check replycode, try to match qcache and notify app
-		logInfo("tStatus(%d) != TRANSPORT_STATUS_UDP, ignore.");
-		goto EXIT;
+		dnsRRCache_clearPrefetch(pKey);
+		return;
 	}
 
-	pDnsMsg = dnsParseMessage(pBuf, &replyCode);
-	if(!pDnsMsg)
+	//the callback clears the prefetch of the rr of the key
+	dnsCacheKey_t* pPrefetchKey = osmalloc(sizeof(dnsCacheKey_t), NULL);
+	if(!pPrefetchKey)
 	{
-		logError("fails to dnsParseMessage.");
-		status = OS_ERROR_INVALID_VALUE;
-		goto EXIT;
+		logError("fails to osmalloc for pPrefetchKey.");
+		dnsRRCache_clearPrefetch(pKey);
+		return;
 	}
+	*pPrefetchKey = *pKey;
 
-	if(!(pDnsMsg->hdr.flags & DNS_QR_MASK))
+	dnsQCacheInfo_t* pQCache = NULL;
+	if(dnsPerformQuery(qName, pKey, true, dnsPrefetchCallback, pPrefetchKey, &pQCache) != OS_STATUS_OK)
 	{
-		logError("received a DNS request, drop.");
-        status = OS_ERROR_INVALID_VALUE;
-		goto EXIT;
+		logInfo("fails to prefetch qName(%r), qType(%d).", qName, pKey->qType);
+		dnsRRCache_clearPrefetch(pKey);
+		osfree(pPrefetchKey);
+		return;
 	}
 
-	osPointerLen_t qName = {pDnsMsg->query.qName, strlen(pDnsMsg->query.qName)};
-    debug("query response, qName=%r, qType=%d, replyCode=%d", &qName, pDnsMsg->query.qType, replyCode);
-	pQCache = dnsRRMatchQCacheAndNotifyApp(&qName, pDnsMsg->query.qType, DNS_RES_STATUS_OK, pDnsMsg);
+	debug("prefetch qName(%r), qType(%d).", qName, pKey->qType);
+}
 
-	if(!pQCache)
+
+/* nobody waits for a prefetch.  The callback is called before the response is cached, the rr being refreshed is still in the
+ * rr cache.  Its prefetch is cleared either way, a response replaces the rr right after this, and when the prefetch fails,
+ * e.g., it times out or gets SERVFAIL, a later lookup gets to refresh the rr again
+ */
+static void dnsPrefetchCallback(dnsResResponse_t* pRR, void* pData)
+{
+	dnsCacheKey_t* pKey = pData;
+	if(pKey)
 	{
-		logError("dnsRRMatchQCacheAndNotifyApp returns null pQCache, unexpected.");
-		goto EXIT;
+		dnsRRCache_clearPrefetch(pKey);
+		osfree(pKey);
 	}
 
-	pQCache->pServerInfo->noRspCount = 0;
+	osfree(pRR);
+}
 
-	//app does not want this RR to cache, or error query response
-	if(!pQCache->isCacheRR || replyCode != DNS_RCODE_NO_ERROR )
+
+//send pQCache->pBuf over one of the pooled udp sockets of the server, with a new random trId
+static osStatus_e dnsSendQuery(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	pQCache->pServerInfo = pServerInfo;
+	pQCache->isTcp = false;
+
+	dnsUdpActiveFdInfo_t* pFdInfo = dnsUdpPool_getFd(pServerInfo);
+	if(!pFdInfo)
 	{
-		logInfo("do not cache rr for qName(%r), qType=%d", &qName, pDnsMsg->query.qType);
+		logError("no udp socket to server(%A).", &pServerInfo->socketAddr);
+		status = OS_ERROR_NETWORK_FAILURE;
 		goto EXIT;
 	}
 
-	//use the first answer if there is more than one answer
-	uint32_t ttl = ((dnsRR_t*)pDnsMsg->answerList.head->data)->ttl;
-	if(!ttl)
+	int fd = pFdInfo->fd;
+	status = dnsQCacheAddPendingId(pQCache, pServerInfo, fd);
+	if(status != OS_STATUS_OK)
 	{
-		debug("ttl=0, do not cache");
 		goto EXIT;
 	}
 
-	debug("qName=%r, ttl=%d(sec)", &qName, ttl);
-	//cache the response in the rrCache, create a rrCache data structure
-	pRRCache = oszalloc(sizeof(dnsRRCacheInfo_t), dnsRRCacheInfo_cleanup);
-//	pRRCache->pDnsMsg = osmemref(pDnsMsg);
-	pRRCache->pDnsMsg = pDnsMsg;
-    osHashData_t* pHashData = oszalloc(sizeof(osHashData_t), NULL);
-    if(!pHashData)
-    {
-        logError("fails to allocate pHashData.");
-        status = OS_ERROR_MEMORY_ALLOC_FAILURE;
-        goto EXIT;
-    }
-
-    pHashData->hashKeyType = OSHASHKEY_INT;
-    pHashData->hashKeyInt = osHash_getKeyPL_extraKey(&qName, false, pQCache->qType);
-    pHashData->pData = pRRCache;
-    pRRCache->pHashElement = osHash_add(gRRCache, pHashData);
-
-    //start the ttl timer
-    pRRCache->ttlTimerId = osStartTimer(ttl*1000, dns_onRRCacheTimeout, pRRCache);
-
-EXIT:
-	osfree(pQCache);
-	osMBuf_dealloc(pBuf);
+	//the pending entry is kept if the send fails, the query times out and is retried.  The server is not charged for it
+	status = dnsUdpPool_send(pServerInfo, pFdInfo, pQCache->pBuf);
 	if(status != OS_STATUS_OK)
 	{
-		osfree(pRRCache);
+		logError("fails to dnsUdpPool_send, fd=%d.", fd);
+		dnsQCacheStopWaiting(&pQCache->pendingId[pQCache->pendingNum-1]);
+		goto EXIT;
 	}
 
-	DEBUG_END
-	return;
+EXIT:
+	return status;
 }
 
 
-
-static dnsMessage_t* dnsParseMessage(osMBuf_t* pBuf, dnsRcode_e* replyCode)
+//resend the query over the persistent tcp connection to the server that sent a truncated udp response, rfc7766 section 5
+static osStatus_e dnsSendQueryTcp(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo)
 {
-	DEBUG_BEGIN
 	osStatus_e status = OS_STATUS_OK;
-	dnsMessage_t* pDnsMsg = NULL;
 
-	uint16_t trId = htobe16(*(uint16_t*)pBuf->buf);
-	pBuf->pos += 2;
-	uint16_t flags = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-	pBuf->pos += 2;
-	*replyCode = flags & DNS_RCODE_MASK;
-	if(*replyCode == DNS_RCODE_FORMAT_ERROR)
+	pQCache->pServerInfo = pServerInfo;
+
+	dnsTcpConn_t* pConn = dnsTcp_getConn(pServerInfo);
+	if(!pConn)
 	{
-		logInfo("dns server returns format error for the query, trId=%d", trId);
-		status = OS_ERROR_INVALID_VALUE;
+		logError("no tcp connection to server(%A).", &pServerInfo->socketAddr);
+		status = OS_ERROR_NETWORK_FAILURE;
 		goto EXIT;
 	}
 
-	pDnsMsg = oszalloc(sizeof(dnsMessage_t), dnsMessage_cleanup);
-	if(!pDnsMsg)
+	status = dnsQCacheAddPendingId(pQCache, pServerInfo, pConn->fd);
+	if(status != OS_STATUS_OK)
 	{
-		logError("fails to osmalloc for dnsMessage_t.");
-		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
 		goto EXIT;
 	}
 
-	pDnsMsg->hdr.flags = flags;
-	pDnsMsg->hdr.qdCount = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-	pBuf->pos += 2;
-	if(pDnsMsg->hdr.qdCount != 1)
+	//the rtt over tcp may include the connection setup, it is not sampled
+	pQCache->pendingId[pQCache->pendingNum-1].sendTime = 0;
+
+	status = dnsTcp_send(pConn, pQCache->pBuf);
+	if(status != OS_STATUS_OK)
 	{
-		logError("only support pDnsMsg->hdr.qdCount = 1, but the received pDnsMsg->hdr.qdCount=%d.", pDnsMsg->hdr.qdCount);
-		status = OS_ERROR_INVALID_VALUE;
+		logError("fails to dnsTcp_send, fd=%d.", pConn->fd);
+		dnsQCacheStopWaiting(&pQCache->pendingId[pQCache->pendingNum-1]);
 		goto EXIT;
 	}
 
-	//only parse the maximum DNS_MAX_RR_NUM records.
-    pDnsMsg->hdr.anCount = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
+	pQCache->pendingId[pQCache->pendingNum-1].tcpConnId = pConn->connId;
+	pQCache->isTcp = true;
 
-    pDnsMsg->hdr.nsCount = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
+EXIT:
+	return status;
+}
 
-    pDnsMsg->hdr.arCount = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
 
-	status = dnsParseQuestion(pBuf, &pDnsMsg->query);
+//records a new random trId of the query for fd, and writes it into pQCache->pBuf
+static osStatus_e dnsQCacheAddPendingId(dnsQCacheInfo_t* pQCache, dnsServerInfo_t* pServerInfo, int fd)
+{
+	uint16_t trId = 0;
+	osStatus_e status = dnsUdpPool_addPending(fd, pQCache, &trId);
 	if(status != OS_STATUS_OK)
 	{
-		logError("fails to dnsParseQuestion.");
+		logError("fails to dnsUdpPool_addPending, fd=%d.", fd);
 		goto EXIT;
 	}
 
-	dnsRR_t* pRR = NULL;
-	for(int i=0; i<pDnsMsg->hdr.anCount; i++)
+	//only keep the latest DNS_MAX_SERVER_NUM sends, a response to an older one is dropped
+	if(pQCache->pendingNum == DNS_MAX_SERVER_NUM)
 	{
-		pRR = dnsParseRR(pBuf);
-    	if(!pRR)
-    	{
-        	logError("fails to dnsParseRR for pDnsMsg->answer[%d].", i);
-        	goto EXIT;
-    	}
-
-		osList_append(&pDnsMsg->answerList, pRR);
+		dnsUdpPool_deletePending(pQCache->pendingId[0].fd, pQCache->pendingId[0].trId, pQCache);
+		dnsQCacheStopWaiting(&pQCache->pendingId[0]);
+		memmove(&pQCache->pendingId[0], &pQCache->pendingId[1], sizeof(dnsQPendingId_t) * --pQCache->pendingNum);
 	}
+	dnsQPendingId_t* pPendingId = &pQCache->pendingId[pQCache->pendingNum++];
+	pPendingId->fd = fd;
+	pPendingId->trId = trId;
+	pPendingId->pServerInfo = pServerInfo;
+	pPendingId->sendTime = dnsResolver_getTime();
+	pPendingId->isWaiting = true;
+	pPendingId->tcpConnId = 0;
+	pServerInfo->inflightNum++;
+	pQCache->qTrId = trId;
+
+	//trId is random, no need to convert the byte order
+	memcpy(pQCache->pBuf->buf, &trId, sizeof(trId));
 
-    for(int i=0; i<pDnsMsg->hdr.nsCount; i++)
-    {
-        pRR = dnsParseRR(pBuf);
-        if(!pRR)
-        {
-            logError("fails to dnsParseRR for pDnsMsg->auth[%d].", i);
-            goto EXIT;
-        }
-
-		osList_append(&pDnsMsg->authList, pRR);
-    }
-
-    for(int i=0; i<pDnsMsg->hdr.arCount; i++)
-    {
-        pRR = dnsParseRR(pBuf);
-        if(!pRR)
-        {
-            logError("fails to dnsParseRR for pDnsMsg->addtlAnswer[%d].", i);
-            goto EXIT;
-        }
+EXIT:
+	return status;
+}
 
-		osList_append(&pDnsMsg->addtlAnswerList, pRR);
-    }
 
-EXIT:
-	if(status != OS_STATUS_OK)
+static dnsQPendingId_t* dnsQCacheGetPendingId(dnsQCacheInfo_t* pQCache, int fd, uint16_t trId)
+{
+	for(int i=0; i<pQCache->pendingNum; i++)
 	{
-		pDnsMsg = osfree(pDnsMsg);
+		if(pQCache->pendingId[i].fd == fd && pQCache->pendingId[i].trId == trId)
+		{
+			return &pQCache->pendingId[i];
+		}
 	}
 
-	DEBUG_END
-	return pDnsMsg;
+	return NULL;
 }
 
 
-/* handle three scenarios: the domainName is
-	1. a sequence of labels ending in a zero octet
-	2. a pointer
-	3. a sequence of labels ending with a pointer
-*/
-static osStatus_e dnsParseDomainName(osMBuf_t* pBuf, char* pUri)
+//the send is answered, timed out, or abandoned, it stops counting in the inflightNum of its server and in the outstandingNum of its tcp connection
+static void dnsQCacheStopWaiting(dnsQPendingId_t* pPendingId)
 {
-    DEBUG_BEGIN
-	osStatus_e status = OS_STATUS_OK;
+	if(!pPendingId->isWaiting)
+	{
+		return;
+	}
 
-    //it is possible labelSize=0, indicating the domain name is <Root>
-	if(pBuf->buf[pBuf->pos] == 0)
+	pPendingId->isWaiting = false;
+	pPendingId->pServerInfo->inflightNum--;
+	if(pPendingId->tcpConnId)
 	{
-        pUri[0] = 0;
-		pBuf->pos++;
-        goto EXIT;
-    }
+		dnsTcp_complete(pPendingId->pServerInfo, pPendingId->tcpConnId);
+		pPendingId->tcpConnId = 0;
+	}
+}
 
-	//starts from the first char after the first label
-	uint8_t labelSize;
-	size_t origPos = pBuf->pos;	//points to the first label of the domain name
-	while(pBuf->buf[pBuf->pos] != 0 && pBuf->pos < pBuf->size)
+
+//a validated response to the send, the rtt is sampled and its server is credited, only then the send stops waiting
+static void dnsQCacheAnswered(dnsQPendingId_t* pPendingId)
+{
+	dnsServerInfo_t* pServerInfo = pPendingId->pServerInfo;
+	if(pPendingId->sendTime)
 	{
-		labelSize = pBuf->buf[pBuf->pos];
-		//add +1 because the last char of the domain name must end with 0x00, which is extra of what is pointed by the labelSize
-		if(pBuf->pos + labelSize + 1 >= pBuf->size)
-		{
-			logError("domain name pBuf->pos(%ld) + labelSize(%d) exceed the pBuf->size(%ld).", pBuf->pos, labelSize, pBuf->size);
-			status = OS_ERROR_INVALID_VALUE;
-			goto EXIT;
-		}
+		dnsServerRtt_add(pServerInfo, dnsResolver_getTime() - pPendingId->sendTime);
+	}
+	dnsServer_updateTimeoutRate(pServerInfo, false);
+	pServerInfo->noRspCount = 0;
 
-		 //0xc0 = the first 2 bits of a 16 bits field are 1, per rfc1035 section 4.1.4, it indicates the domain name is a pointer
-		if(labelSize >= 0xc0)
-	    {
-        	uint16_t origUriPos = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]) & 0x3fff;
-			//copy the uri before this label, note the label has been replace with '.' in earlier iteration
-			if(pBuf->pos > origPos+1)
-			{
-                //the char in origPos shall be a label, the uri starts right after the first label
-				memcpy(pUri, &pBuf->buf[origPos+1], pBuf->pos-origPos-1);
-                strcpy(&pUri[pBuf->pos-origPos-1], &pBuf->buf[origUriPos]);
-			}
-            else
-            {
-                //the new URI completely points to a subset of a previous URI, remove the pointed top label in the previous URI 
-                strcpy(pUri, &pBuf->buf[++origUriPos]);
-            }
-			//copy the remaining uri since the offset label is used, per rfc1035, this must be the last label.  note the earlier occurance of the domain name's label must have been replaced by '.' too
-			pBuf->pos += 2;
+	dnsQCacheStopWaiting(pPendingId);
+}
 
-            debug("domain name=%s, using pointer", pUri);
-        	goto EXIT;
-    	}
 
-		if(labelSize > DNS_MAX_DOMAIN_NAME_LABEL_SIZE)
-		{
-			logError("a domain name label size(0x%x) in pos(0x%lx) is bigger than maximum allowed(%d).", labelSize, pBuf->pos, DNS_MAX_DOMAIN_NAME_LABEL_SIZE);
-			pBuf->pos = origPos;
-			status = OS_ERROR_INVALID_VALUE;
-			goto EXIT;
-		}
-		pBuf->buf[pBuf->pos] = '.';
-		pBuf->pos += labelSize + 1;
+//if the server does not respond within its p95 rtt, the query is also sent to another server, the first response wins
+static void dnsQCacheStartHedge(dnsQCacheInfo_t* pQCache)
+{
+	if(!DNS_HEDGE_BUDGET || pQCache->serverQueried + 1 >= DNS_MAX_ALLOWED_SERVER_NUM_PER_QUERY)
+	{
+		return;
 	}
 
-	//combined with the previous while() check, the following check also implicitly verified the pBuf->buf[pBuf->pos] == 0
-	if(pBuf->pos >= pBuf->size)
+	uint32_t delay = dnsServerRtt_getHedgeDelay(pQCache->pServerInfo);
+	if(!delay || delay >= dnsServerRtt_getRto(pQCache->pServerInfo))
 	{
-        logError("the parsing of domain name crosses pBuf->size(%ld).", pBuf->size);
-		pBuf->pos = origPos;
-        status = OS_ERROR_INVALID_VALUE;
-        goto EXIT;
-    }
+		return;
+	}
+
+	dnsTimerWheel_start(&pQCache->hedgeTimer, delay, dns_onHedgeTimeout, pQCache);
+}
 
-	if(pBuf->pos - origPos > DNS_MAX_NAME_SIZE)
+
+static osStatus_e dnsQCacheAdd(dnsQCacheInfo_t* pQCache)
+{
+	osStatus_e status = dnsCacheTable_add(&gQCache, pQCache);
+	if(status != OS_STATUS_OK)
 	{
-		logError("domain name size(%ld) is larger than DNS_MAX_NAME_SIZE(%d).", pBuf->pos - origPos, DNS_MAX_NAME_SIZE);
-		pBuf->pos = origPos;
-		status = OS_ERROR_INVALID_VALUE;
+		logError("fails to add pQCache into gQCache.");
 		goto EXIT;
 	}
 
-	//the URI in mBuf starts 1 char after origPos (the 1st har is a label), and ends with 0, i.e., pBuf->buf[pBuf->pos] = 0
-	strcpy(pUri, &pBuf->buf[origPos+1]);
-
-	//point the pos to the first char after the uri, including the terminating 00
-	pBuf->pos++;
-
-	debug("domain name=%s", pUri);
+	pQCache->isInQCache = true;
 
 EXIT:
-    DEBUG_END
 	return status;
-}	
-	
+}
+
 
-static osStatus_e dnsParseQuestion(osMBuf_t* pBuf, dnsQuestion_t* pQName)
+static void dnsTpCallback(transportStatus_e tStatus, int fd, osMBuf_t* pBuf)
 {
-	osStatus_e status = dnsParseDomainName(pBuf, pQName->qName);
-	if(status != OS_STATUS_OK)
+	DEBUG_BEGIN
+
+	//some thing is wrong with a udp fd.  For query waiting on the fd, the timeout will take care of it
+	if(tStatus != TRANSPORT_STATUS_UDP)
 	{
+		//to-do, need to check replycode, try to match qcache and notify app
+		logInfo("tStatus(%d) != TRANSPORT_STATUS_UDP, ignore.");
+		osMBuf_dealloc(pBuf);
 		goto EXIT;
 	}
 
-	pQName->qType = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-	pBuf->pos += 2;
-	pQName->qClass = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
+	dnsProcessResponse(fd, pBuf);
+	osMBuf_dealloc(pBuf);
 
-	if(pBuf->pos >= pBuf->size)
-	{
-        logError("when parsing QName, pBuf->pos crosses pBuf->size(%ld).", pBuf->size);
-        status = OS_ERROR_INVALID_VALUE;
-        goto EXIT;
-    }
+	//read the rest of the responses queued on the fd in batch, if DNS_UDP_BATCH_IO is set
+	dnsUdpPool_drain(fd, dnsProcessResponse);
 
 EXIT:
-	return status;
+	DEBUG_END
+	return;
 }
 
 
-static dnsRR_t* dnsParseRR(osMBuf_t* pBuf)
+//pBuf is owned by the caller, it may be a buffer of the batch receive ring that is reused after the function returns
+static void dnsProcessResponse(int fd, osMBuf_t* pBuf)
 {
-DEBUG_BEGIN
 	osStatus_e status = OS_STATUS_OK;
-	dnsRR_t* pRR = osmalloc(sizeof(dnsRR_t), NULL);
-	if(!pRR)
+	dnsRcode_e replyCode = 0;
+	dnsMessage_t* pDnsMsg = NULL;
+    dnsQCacheInfo_t* pQCache = NULL;
+
+	if(pBuf->size < sizeof(dnsHdr_t))
 	{
-		logError("fails to osmalloc pRR.");
-		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		logInfo("received a message of %ld bytes on fd(%d), shorter than a dns header, drop.", pBuf->size, fd);
 		goto EXIT;
 	}
 
-	status = dnsParseDomainName(pBuf, pRR->name);
-    if(status != OS_STATUS_OK)
-    {
-        goto EXIT;
-    }
+	//match the pending query from the fd and the trId before parsing anything else.  Nothing of the query or its server is
+	//changed until the response is validated, a stray or spoofed datagram with a matching trId is dropped without a trace
+	uint16_t trId;
+	memcpy(&trId, pBuf->buf, sizeof(trId));
+	dnsQCacheInfo_t* pPendingQCache = dnsUdpPool_lookupPending(fd, trId);
+	dnsQPendingId_t* pPendingId = pPendingQCache ? dnsQCacheGetPendingId(pPendingQCache, fd, trId) : NULL;
+	if(!pPendingId)
+	{
+		logInfo("no query is pending for fd(%d), trId(0x%x), drop.", fd, trId);
+		goto EXIT;
+	}
+
+	uint16_t flags;
+	memcpy(&flags, &pBuf->buf[2], sizeof(flags));
+	flags = be16toh(flags);
+	if(!(flags & DNS_QR_MASK))
+	{
+		logError("received a DNS request on fd(%d), trId(0x%x), drop.", fd, trId);
+		goto EXIT;
+	}
 
-	pRR->type = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    debug("domain name=%s, dns rr type=%d, pos=0x%x", pRR->name, pRR->type, pBuf->pos);
-    pBuf->pos += 2;
-	pRR->rrClass = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
-	pRR->ttl = htobe32(*(uint32_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 4;
-	pRR->rDataLen = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-    pBuf->pos += 2;
+	//the server that responds, with hedging it may not be the one of the latest send
+	dnsServerInfo_t* pRspServer = pPendingId->pServerInfo;
 
-	switch(pRR->type)
+	//the rr of a truncated response are not used, the query is retried over tcp, rfc7766 section 5
+	if(flags & DNS_TC_MASK && !pPendingQCache->isTcp)
 	{
-		case DNS_QTYPE_A:
-			if(pRR->rDataLen != 4)
-			{
-				logError("rr class is A, but (pRR->rDataLen=%d.", pRR->rDataLen);
-				status = OS_ERROR_INVALID_VALUE;
-				goto EXIT;
-			}
+		if(!dnsMessage_isQuestionMatch(pBuf, &pPendingQCache->key))
+		{
+			logInfo("the question of the truncated response does not match the query, fd(%d), trId(0x%x), drop.", fd, trId);
+			goto EXIT;
+		}
 
-			//no need to do htobe for network address
-			pRR->ipAddr.s_addr = *(uint32_t*)&pBuf->buf[pBuf->pos];	
-			pBuf->pos += 4;
-			break;
-		case DNS_QTYPE_SRV:
-			//based on rfc 2782
-            pRR->srv.priority = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-            pBuf->pos += 2;
-            pRR->srv.weight = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-            pBuf->pos += 2;
-            pRR->srv.port = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-            pBuf->pos += 2;
-
-            //process target
-		    status = dnsParseDomainName(pBuf, pRR->srv.target);
-			break;
-		case DNS_QTYPE_NAPTR:
-			//based on rfc 2915
-			pRR->naptr.order = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-		    pBuf->pos += 2;
-			pRR->naptr.pref = htobe16(*(uint16_t*)&pBuf->buf[pBuf->pos]);
-            pBuf->pos += 2;
-
-			//process flags
-			if(pBuf->buf[pBuf->pos] != 1)
-			{
-				logError("naptr flags size(%d) is not 1, unexpected.", pBuf->buf[pBuf->pos]);
-				pRR->naptr.flags = DNS_NAPTR_FLAGS_OTHER;
-			}
-			else
-			{
-				switch (pBuf->buf[++pBuf->pos])
-				{
-					case 's':
-					case 'S':
-						pRR->naptr.flags = DNS_NAPTR_FLAGS_S;
-						break;
-					case 'a':
-					case 'A':
-						pRR->naptr.flags = DNS_NAPTR_FLAGS_A;
-						break;
-					case 'u':
-					case 'U':
-						pRR->naptr.flags = DNS_NAPTR_FLAGS_U;
-						break;
-					case 'p':
-					case 'P':
-						pRR->naptr.flags = DNS_NAPTR_FLAGS_P;
-						break;
-					default:
-						pRR->naptr.flags = DNS_NAPTR_FLAGS_OTHER;
-						break;
-				}
-			}
-			++pBuf->pos;
-
-			//process service
-			pRR->naptr.service.l = pBuf->buf[pBuf->pos++];
-			pRR->naptr.service.p = &pBuf->buf[pBuf->pos];
-			pBuf->pos += pRR->naptr.service.l;
-
-            //process regexp
-            pRR->naptr.regexp.l = pBuf->buf[pBuf->pos++];
-            pRR->naptr.regexp.p = &pBuf->buf[pBuf->pos];
-            pBuf->pos += pRR->naptr.regexp.l;
-
-            //process replacement
-		    status = dnsParseDomainName(pBuf, pRR->naptr.replacement);
-    		if(status != OS_STATUS_OK)
-    		{
-        		goto EXIT;
-    		}
-			break;
-		default:
-			logInfo("pRR->type=%d is unhandled.", pRR->type);
-			pRR->other.l = pRR->rDataLen;
-			pRR->other.p = &pBuf->buf[pBuf->pos];
-			pBuf->pos += pRR->other.l;
-			break;
+		dnsQCacheAnswered(pPendingId);
+
+		debug("the response for fd(%d), trId(0x%x) is truncated, retry over tcp.", fd, trId);
+		if(dnsSendQueryTcp(pPendingQCache, pRspServer) != OS_STATUS_OK)
+		{
+			logError("fails to dnsSendQueryTcp, the query will time out and be retried.");
+			goto EXIT;
+		}
+
+		//the udp rto is too short for the tcp setup and a large response, and the query is not hedged over udp any more
+		dnsTimerWheel_stop(&pPendingQCache->hedgeTimer);
+		dnsTimerWheel_start(&pPendingQCache->waitForRespTimer, DNS_WAIT_RESPONSE_TIMEOUT, dns_onQCacheTimeout, pPendingQCache);
+		goto EXIT;
 	}
 
-EXIT:
+	pDnsMsg = dnsMessage_parse(pBuf, &pPendingQCache->key, &replyCode);
+	if(!pDnsMsg)
+	{
+		logInfo("fails to dnsMessage_parse, or the question does not match the query, fd(%d), trId(0x%x).", fd, trId);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	dnsQCacheAnswered(pPendingId);
+
+	//the other sends of a hedged or retried query are abandoned, their servers are no longer loaded by this query
+	for(int i=0; i<pPendingQCache->pendingNum; i++)
+	{
+		dnsQCacheStopWaiting(&pPendingQCache->pendingId[i]);
+	}
+
+	osPointerLen_t qName = {pDnsMsg->query.qName, strlen(pDnsMsg->query.qName)};
+    debug("query response, qName=%r, qType=%d, replyCode=%d", &qName, pDnsMsg->query.qType, replyCode);
+
+	//the pending query is held by gQCache, it is released at EXIT after the apps are notified
+	pQCache = pPendingQCache;
+	dnsQCacheNotifyApp(pQCache, DNS_RES_STATUS_OK, pDnsMsg);
+
+	//app does not want this RR to cache, or error query response
+	if(!pQCache->isCacheRR || (replyCode != DNS_RCODE_NO_ERROR && replyCode != DNS_RCODE_NAME_ERROR))
+	{
+		logInfo("do not cache rr for qName(%r), qType=%d", &qName, pDnsMsg->query.qType);
+		goto EXIT;
+	}
+
+	//NXDOMAIN, or NODATA that has no answer, rfc2308
+	if(replyCode == DNS_RCODE_NAME_ERROR || !pDnsMsg->answerNum)
+	{
+		dnsCacheNegativeRsp(pQCache, pDnsMsg, replyCode);
+		goto EXIT;
+	}
+
+	dnsRR_t* pAnswer = NULL;
+	if(!dnsMessage_getSection(pDnsMsg, DNS_SECTION_ANSWER, &pAnswer))
+	{
+		logInfo("fails to decode the answer of qName(%r), qType=%d, do not cache.", &qName, pDnsMsg->query.qType);
+		goto EXIT;
+	}
+
+	//use the first answer if there is more than one answer
+	uint32_t ttl = pAnswer[0].ttl;
+	if(!ttl)
+	{
+		debug("ttl=0, do not cache");
+		goto EXIT;
+	}
+
+	debug("qName=%r, ttl=%d(sec)", &qName, ttl);
+	//cache the response in the rrCache, the rrCache refers pDnsMsg
+	status = dnsRRCache_add(&pQCache->key, pDnsMsg, ttl);
 	if(status != OS_STATUS_OK)
 	{
-		pRR = osfree(pRR);
+		logError("fails to dnsRRCache_add for qName(%r), qType=%d.", &qName, pQCache->qType);
 	}
 
-DEBUG_END
-	return pRR;
+EXIT:
+	osfree(pQCache);
+	//every app and the rrCache have referred pDnsMsg as needed, release the parsing reference
+	dnsMessage_free(pDnsMsg);
+
+	return;
 }
 
 
 
-static void dns_onQCacheTimeout(uint64_t timerId, void* ptr)
+//the negative ttl is the smaller of the SOA ttl and the SOA MINIMUM, per rfc2308 section 5.  without a SOA, the response is not cached
+static void dnsCacheNegativeRsp(dnsQCacheInfo_t* pQCache, dnsMessage_t* pDnsMsg, dnsRcode_e replyCode)
+{
+	dnsRR_t* pSoaRR = NULL;
+	dnsRR_t* pAuth = NULL;
+	uint16_t authNum = dnsMessage_getSection(pDnsMsg, DNS_SECTION_AUTH, &pAuth);
+	for(int i=0; i<authNum; i++)
+	{
+		if(pAuth[i].type == DNS_QTYPE_SOA)
+		{
+			pSoaRR = &pAuth[i];
+			break;
+		}
+	}
+
+	if(!pSoaRR)
+	{
+		debug("no SOA in the negative response for qName(%r), qType=%d, do not cache.", &pQCache->qName.pl, pQCache->qType);
+		return;
+	}
+
+	uint32_t ttl = pSoaRR->ttl < pSoaRR->soa.minimum ? pSoaRR->ttl : pSoaRR->soa.minimum;
+	if(!ttl)
+	{
+		debug("negative ttl=0, do not cache");
+		return;
+	}
+
+	debug("qName=%r, replyCode=%d, negative ttl=%d(sec)", &pQCache->qName.pl, replyCode, ttl);
+	if(dnsRRCache_addNegative(&pQCache->key, pDnsMsg, replyCode, ttl) != OS_STATUS_OK)
+	{
+		logError("fails to dnsRRCache_addNegative for qName(%r), qType=%d.", &pQCache->qName.pl, pQCache->qType);
+	}
+}
+
+
+static void dns_onQCacheTimeout(void* ptr)
 {
     if(!ptr)
     {
@@ -934,59 +996,71 @@ static void dns_onQCacheTimeout(uint64_t timerId, void* ptr)
     }
 
     dnsQCacheInfo_t* pQCache = ptr;
-    if(pQCache->waitForRespTimerId != timerId)
-    {
-        logError("pQCache->waitForRespTimerId(%d) does not match with timerId(%d), unexpected.", pQCache->waitForRespTimerId, timerId);
-        return;
-    }
 
-	pQCache->waitForRespTimerId = 0;
-	if(++pQCache->pServerInfo->noRspCount > DNS_MAX_SERVER_QUARANTINE_NO_RESPONSE_NUM)
+	/* every server the query is waiting for is charged, with hedging it is not only the server of the latest send.  A send
+	 * is only charged once, a late response to it is still accepted, and the tcp connections do not wait for it
+	 */
+	for(int i=0; i<pQCache->pendingNum; i++)
 	{
-		pQCache->pServerInfo->quarantineTimerId = osStartTimer(DNS_QUARANTINE_TIMEOUT, dns_onServerQuarantineTimeout, pQCache->pServerInfo);
+		dnsQPendingId_t* pPendingId = &pQCache->pendingId[i];
+		if(!pPendingId->isWaiting)
+		{
+			continue;
+		}
+		dnsQCacheStopWaiting(pPendingId);
+
+		dnsServerInfo_t* pServerInfo = pPendingId->pServerInfo;
+		dnsServerRtt_backoff(pServerInfo);
+		dnsServer_updateTimeoutRate(pServerInfo, true);
+		if(++pServerInfo->noRspCount > DNS_MAX_SERVER_QUARANTINE_NO_RESPONSE_NUM && !pServerInfo->quarantineTimerId)
+		{
+			pServerInfo->quarantineTimerId = osStartTimer(DNS_QUARANTINE_TIMEOUT, dns_onServerQuarantineTimeout, pServerInfo);
+		}
 	}
 
 	//if there is multiple servers, and the query is allowed to try other servers
 	if(++pQCache->serverQueried < DNS_MAX_ALLOWED_SERVER_NUM_PER_QUERY)
 	{
-	    //send message to tp to be transmitted.  support UDP only.  true is for persistent
-    	transportInfo_t tpInfo;
-    	tpInfo.isCom = false;
-    	tpInfo.tpType = TRANSPORT_TYPE_UDP;
-    	dnsServerInfo_t* pServerInfo = dnsGetServer();
+    	dnsServerInfo_t* pServerInfo = dnsGetServer(NULL);
 		if(!pServerInfo)
 		{
 			logError("no dns server available.");
 			goto EXIT;
 		}
 
-    	tpInfo.local.sin_addr.s_addr = 0;   //use the default ip in the tp layer
-    	tpInfo.peer = pServerInfo->socketAddr;
-    	tpInfo.udpInfo.isUdpWaitResponse = true;
-    	tpInfo.udpInfo.isEphemeralPort = true;
-    	tpInfo.udpInfo.fd = -1;
-    	tpInfo.protocolUpdatePos = 0;
-    	transportStatus_e tStatus = transport_localSend(TRANSPORT_APP_TYPE_DNS, &tpInfo, pQCache->pBuf, NULL);
-    	if(tStatus != TRANSPORT_STATUS_UDP)
-    	{
-        	logError("fails to transport_localSend.");
-        	goto EXIT;
-    	}
+		//a query whose udp response was truncated is retried over tcp directly
+		if(pQCache->isTcp)
+		{
+			if(dnsSendQueryTcp(pQCache, pServerInfo) != OS_STATUS_OK)
+			{
+				goto EXIT;
+			}
+
+			dnsTimerWheel_start(&pQCache->waitForRespTimer, DNS_WAIT_RESPONSE_TIMEOUT, dns_onQCacheTimeout, pQCache);
+			return;
+		}
+
+		if(dnsSendQuery(pQCache, pServerInfo) != OS_STATUS_OK)
+		{
+			goto EXIT;
+		}
 
     	//start wait for response timer
-    	pQCache->waitForRespTimerId = osStartTimer(DNS_WAIT_RESPONSE_TIMEOUT, dns_onQCacheTimeout, pQCache);
+    	dnsTimerWheel_start(&pQCache->waitForRespTimer, dnsServerRtt_getRto(pServerInfo), dns_onQCacheTimeout, pQCache);
+		dnsQCacheStartHedge(pQCache);
 		return;
 	}
 
 EXIT:
 	//notify all Query listeners
-	dnsRRMatchQCacheAndNotifyApp(&pQCache->qName.pl, pQCache->qType, DNS_RES_ERROR_NO_RESPONSE, NULL);
+	dnsQCacheNotifyApp(pQCache, DNS_RES_ERROR_NO_RESPONSE, NULL);
 
     osfree(pQCache);
 }
 
 
-static void dns_onServerQuarantineTimeout(uint64_t timerId, void* ptr)
+//the server of the latest send has not responded within its p95 rtt, send the query to another server too.  The query still times out at the original waitForRespTimer
+static void dns_onHedgeTimeout(void* ptr)
 {
     if(!ptr)
     {
@@ -994,37 +1068,115 @@ static void dns_onServerQuarantineTimeout(uint64_t timerId, void* ptr)
         return;
     }
 
-	dnsServerInfo_t* pServerInfo = ptr;
-	if(pServerInfo->quarantineTimerId != timerId)
+    dnsQCacheInfo_t* pQCache = ptr;
+
+	//the budget caps the extra load on the servers when all of them slow down
+	uint64_t curSec = dnsResolver_getTime() / 1000000;
+	if(curSec != gHedgeSec)
+	{
+		gHedgeSec = curSec;
+		gHedgeNum = 0;
+	}
+
+	if(gHedgeNum >= DNS_HEDGE_BUDGET)
+	{
+		debug("hedge budget(%d) is used up, qName(%r) is not hedged.", DNS_HEDGE_BUDGET, &pQCache->qName.pl);
+		return;
+	}
+
+	dnsServerInfo_t* pServerInfo = dnsGetServer(pQCache->pServerInfo);
+	if(!pServerInfo)
+	{
+		debug("no other dns server available, qName(%r) is not hedged.", &pQCache->qName.pl);
+		return;
+	}
+
+	//the response to either send is accepted, the other one is dropped when pQCache is freed
+	if(dnsSendQuery(pQCache, pServerInfo) != OS_STATUS_OK)
+	{
+		logError("fails to hedge qName(%r) to server(%A).", &pQCache->qName.pl, &pServerInfo->socketAddr);
+		return;
+	}
+
+	++pQCache->serverQueried;
+	++gHedgeNum;
+	debug("qName(%r) is hedged to server(%A).", &pQCache->qName.pl, &pServerInfo->socketAddr);
+}
+
+
+//the owner thread of a shared query did not pass back the result in time
+static void dns_onInflightWaitTimeout(void* ptr)
+{
+    if(!ptr)
     {
-        logError("pServerInfo->quarantineTimerId(%d) does not match with timerId(%d), unexpected.", pServerInfo->quarantineTimerId, timerId);
+        logError("null pointer, ptr.");
         return;
     }
-	pServerInfo->quarantineTimerId = 0;
+
+    dnsQCacheInfo_t* pQCache = ptr;
+	dnsInflight_leave(pQCache);
+
+	dnsQCacheNotifyApp(pQCache, DNS_RES_ERROR_NO_RESPONSE, NULL);
+
+    osfree(pQCache);
 }
 
 
-static void dns_onRRCacheTimeout(uint64_t timerId, void* ptr)
+//the query has not got a response in DNS_CLIENT_RSP_TIMEOUT, the apps waiting for it get the stale rr if there is one
+static void dns_onClientRspTimeout(void* ptr)
 {
-	if(!ptr)
-	{
-		logError("null pointer, ptr.");
-		return;
-	}
+    if(!ptr)
+    {
+        logError("null pointer, ptr.");
+        return;
+    }
 
-	dnsRRCacheInfo_t* pRRCache = ptr;
-	if(pRRCache->ttlTimerId != timerId)
+    dnsQCacheInfo_t* pQCache = ptr;
+	dnsMessage_t* pStaleMsg = dnsRRCache_lookupStale(&pQCache->key);
+	if(!pStaleMsg)
 	{
-		logError("pRRCache->ttlTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", pRRCache->ttlTimerId, timerId);
+		debug("no stale rr for qName(%r), qType(%d), keep waiting for the query response.", &pQCache->qName.pl, pQCache->qType);
 		return;
 	}
-	pRRCache->ttlTimerId = 0;
 
-	osfree(pRRCache);
-}	
-		
+	//the apps that have been notified are removed, the query stays in gQCache, its response refreshes the rr cache
+	logInfo("query for qName(%r), qType(%d) is slow, serve the stale rr.", &pQCache->qName.pl, pQCache->qType);
+	dnsQAppListNotify(pQCache, DNS_RES_STATUS_OK, pStaleMsg);
+	osList_delete(&pQCache->appDataList);
+
+	dnsMessage_free(pStaleMsg);
+}
+
+
+//the owner thread of a shared query passed back the result.  pDnsMsg is released by the caller after this function returns
+static void dnsInflightResultCallback(dnsQCacheInfo_t* pQCache, dnsResStatus_e rrStatus, dnsMessage_t* pDnsMsg)
+{
+	dnsQCacheNotifyApp(pQCache, rrStatus, pDnsMsg);
+
+	osfree(pQCache);
+}
+
+
+static void dns_onServerQuarantineTimeout(uint64_t timerId, void* ptr)
+{
+    if(!ptr)
+    {
+        logError("null pointer, ptr.");
+        return;
+    }
+
+	dnsServerInfo_t* pServerInfo = ptr;
+	if(pServerInfo->quarantineTimerId != timerId)
+    {
+        logError("pServerInfo->quarantineTimerId(%d) does not match with timerId(%d), unexpected.", pServerInfo->quarantineTimerId, timerId);
+        return;
+    }
+	pServerInfo->quarantineTimerId = 0;
+}
 
-static dnsServerInfo_t* dnsGetServer()
+
+//pExcludeServer is not selected, NULL if any server can be selected
+static dnsServerInfo_t* dnsGetServer(dnsServerInfo_t* pExcludeServer)
 {
 	dnsServerInfo_t* pServer = NULL;
 
@@ -1034,11 +1186,15 @@ static dnsServerInfo_t* dnsGetServer()
 		goto EXIT;
 	}
 	
-	if(gServerSelInfo.serverSelMode == OS_NODE_SELECT_MODE_PRIORITY)
+	if(gServerSelInfo.serverSelMode == DNS_SERVER_SELECT_MODE_LATENCY)
+	{
+		pServer = dnsGetServerByLatency(pExcludeServer);
+	}
+	else if(gServerSelInfo.serverSelMode == OS_NODE_SELECT_MODE_PRIORITY)
 	{
 		for(int i=0; i<gServerSelInfo.serverNum; i++)
 		{
-			if(gServerSelInfo.serverInfo[i].quarantineTimerId)
+			if(gServerSelInfo.serverInfo[i].quarantineTimerId || &gServerSelInfo.serverInfo[i] == pExcludeServer)
 			{
 				continue;
 			}
@@ -1052,7 +1208,7 @@ static dnsServerInfo_t* dnsGetServer()
 		int nodeIdx = gServerSelInfo.curNodeSelIdx++ % gServerSelInfo.serverNum;
 		for(int i=nodeIdx; i < gServerSelInfo.serverNum; i++)
 		{
-            if(gServerSelInfo.serverInfo[i].quarantineTimerId)
+            if(gServerSelInfo.serverInfo[i].quarantineTimerId || &gServerSelInfo.serverInfo[i] == pExcludeServer)
             {
                 continue;
             }
@@ -1065,7 +1221,7 @@ static dnsServerInfo_t* dnsGetServer()
 		{
 			for(int i=0; i<nodeIdx; i++)
 			{
-	            if(gServerSelInfo.serverInfo[i].quarantineTimerId)
+	            if(gServerSelInfo.serverInfo[i].quarantineTimerId || &gServerSelInfo.serverInfo[i] == pExcludeServer)
     	        {
         	        continue;
             	}
@@ -1081,61 +1237,194 @@ EXIT:
 }
 
 
-static uint16_t dnsCreateTrId()
+//power of two choices among the available servers of the best priority.  The configured priority is a strict tier, within the tier
+//the load moves away from a server gradually as its rtt, timeout rate or queries in flight grow, well before it is quarantined
+static dnsServerInfo_t* dnsGetServerByLatency(dnsServerInfo_t* pExcludeServer)
+{
+	dnsServerInfo_t* pCandidate[DNS_MAX_SERVER_NUM];
+	int candidateNum = 0;
+
+	//gServerSelInfo.serverInfo is sorted with the best priority first
+	for(int i=0; i<gServerSelInfo.serverNum; i++)
+	{
+		dnsServerInfo_t* pServer = &gServerSelInfo.serverInfo[i];
+		if(pServer->quarantineTimerId || pServer == pExcludeServer)
+		{
+			continue;
+		}
+
+		if(candidateNum && pServer->priority != pCandidate[0]->priority)
+		{
+			break;
+		}
+
+		pCandidate[candidateNum++] = pServer;
+	}
+
+	if(candidateNum <= 1)
+	{
+		return candidateNum ? pCandidate[0] : NULL;
+	}
+
+	//xorshift32, the choice does not need a strong random
+	uint32_t x = gServerSelInfo.randomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	gServerSelInfo.randomState = x;
+
+	int first = x % candidateNum;
+	int second = (first + 1 + (x >> 16) % (candidateNum - 1)) % candidateNum;
+
+	return dnsServer_getCost(pCandidate[second]) < dnsServer_getCost(pCandidate[first]) ? pCandidate[second] : pCandidate[first];
+}
+
+
+//the expected wait for a query sent to the server, srtt scaled by the queries ahead of it and by the timeout rate
+static uint64_t dnsServer_getCost(dnsServerInfo_t* pServerInfo)
+{
+	//a server without rtt sample is preferred, so that it gets one
+	uint64_t cost = pServerInfo->rtt.sampleNum ? pServerInfo->rtt.srtt + 1 : 1;
+
+	cost *= pServerInfo->inflightNum + 1;
+
+	//a server that times out every query costs 17 times its rtt
+	return cost * (DNS_TIMEOUT_RATE_ONE + 16 * (uint64_t)pServerInfo->timeoutRate) / DNS_TIMEOUT_RATE_ONE;
+}
+
+
+static void dnsServer_updateTimeoutRate(dnsServerInfo_t* pServerInfo, bool isTimeout)
 {
-	return gDnsTrId++;
+	pServerInfo->timeoutRate -= pServerInfo->timeoutRate >> DNS_TIMEOUT_RATE_SHIFT;
+	if(isTimeout)
+	{
+		pServerInfo->timeoutRate += DNS_TIMEOUT_RATE_ONE >> DNS_TIMEOUT_RATE_SHIFT;
+	}
 }
 
 
-static void dnsMessage_cleanup(void* data)
+//rtt in usec
+static void dnsServerRtt_add(dnsServerInfo_t* pServerInfo, uint32_t rtt)
 {
-	dnsMessage_t* pMsg = data;
-	if(!pMsg)
+	dnsServerRtt_t* pRtt = &pServerInfo->rtt;
+
+	//rfc6298 section 2, with alpha=1/8, beta=1/4, K=4
+	if(!pRtt->sampleNum)
+	{
+		pRtt->srtt = rtt;
+		pRtt->rttvar = rtt / 2;
+	}
+	else
+	{
+		uint32_t delta = pRtt->srtt > rtt ? pRtt->srtt - rtt : rtt - pRtt->srtt;
+		pRtt->rttvar = pRtt->rttvar - pRtt->rttvar / 4 + delta / 4;
+		pRtt->srtt = pRtt->srtt - pRtt->srtt / 8 + rtt / 8;
+	}
+	pRtt->rto = (pRtt->srtt + 4 * pRtt->rttvar + 999) / 1000;
+
+	pRtt->sample[pRtt->sampleNum++ % DNS_RTT_SAMPLE_NUM] = rtt;
+	if(pRtt->sampleNum % DNS_RTT_P95_INTERVAL)
 	{
 		return;
 	}
 
-	osList_delete(&pMsg->answerList);
-	osList_delete(&pMsg->authList);
-	osList_delete(&pMsg->addtlAnswerList);
+	//insertion sort a copy of the ring, it is small and only sorted every DNS_RTT_P95_INTERVAL samples
+	uint32_t sorted[DNS_RTT_SAMPLE_NUM];
+	int num = pRtt->sampleNum < DNS_RTT_SAMPLE_NUM ? pRtt->sampleNum : DNS_RTT_SAMPLE_NUM;
+	for(int i=0; i<num; i++)
+	{
+		uint32_t value = pRtt->sample[i];
+		int j = i;
+		for(; j>0 && sorted[j-1] > value; j--)
+		{
+			sorted[j] = sorted[j-1];
+		}
+		sorted[j] = value;
+	}
+
+	pRtt->p95 = sorted[(num * 95 + 99) / 100 - 1];
 }
 
 
-static void dnsQCacheInfo_cleanup(void* data)
+//msec, 0 if the server does not have enough rtt samples for a p95
+static uint32_t dnsServerRtt_getHedgeDelay(dnsServerInfo_t* pServerInfo)
 {
-	dnsQCacheInfo_t* pQCache = data;
-	if(!pQCache)
+	if(pServerInfo->rtt.sampleNum < DNS_HEDGE_MIN_SAMPLE_NUM)
 	{
-		return;
+		return 0;
 	}
 
-	osVPL_free(&pQCache->qName, true);
-	osMBuf_dealloc(pQCache->pBuf);
-	//keep the user data, as the user data is actually pQCache.
-    osHash_deleteNode(pQCache->pHashElement, OS_HASH_DEL_NODE_TYPE_KEEP_USER_DATA);
-	osList_delete(&pQCache->appDataList);
-	if(pQCache->waitForRespTimerId)
+	return (pServerInfo->rtt.p95 + 999) / 1000;
+}
+
+
+//msec, the wait response timeout of a query sent to the server
+static uint32_t dnsServerRtt_getRto(dnsServerInfo_t* pServerInfo)
+{
+	uint32_t rto = pServerInfo->rtt.rto;
+	if(!DNS_MAX_RTO || !rto)
+	{
+		return DNS_WAIT_RESPONSE_TIMEOUT;
+	}
+
+	if(rto < DNS_MIN_RTO)
 	{
-		pQCache->waitForRespTimerId = osStopTimer(pQCache->waitForRespTimerId);
+		return DNS_MIN_RTO;
 	}
+
+	return rto > DNS_MAX_RTO ? DNS_MAX_RTO : rto;
 }
 
 
-static void dnsRRCacheInfo_cleanup(void* data)
+//a query to the server timed out, rfc6298 section 5.5.  The next rtt sample resets the rto
+static void dnsServerRtt_backoff(dnsServerInfo_t* pServerInfo)
 {
-	dnsRRCacheInfo_t* pRRCache = data;
-    if(!pRRCache)
-    {
-        return;
-    }
+	uint32_t rto = dnsServerRtt_getRto(pServerInfo);
+	if(pServerInfo->rtt.rto)
+	{
+		pServerInfo->rtt.rto = rto * 2 > DNS_MAX_RTO ? DNS_MAX_RTO : rto * 2;
+	}
+}
+
+
+//monotonic time in usec, the rtt of a local server may be well below a msec
+static uint64_t dnsResolver_getTime()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return (uint64_t)tp.tv_sec * 1000000 + tp.tv_nsec / 1000;
+}
 
-	osfree(pRRCache->pDnsMsg);
-	//keep the user data, as the user data is actually pQCache.
-    osHash_deleteNode(pRRCache->pHashElement, OS_HASH_DEL_NODE_TYPE_KEEP_USER_DATA);
-	if(pRRCache->ttlTimerId)
+
+static void dnsQCacheInfo_cleanup(void* data)
+{
+	dnsQCacheInfo_t* pQCache = data;
+	if(!pQCache)
 	{
-		pRRCache->ttlTimerId = osStopTimer(pRRCache->ttlTimerId);
+		return;
 	}
+
+	//a query shared with other threads is freed without result, release the waiters
+	dnsInflight_complete(pQCache, DNS_RES_ERROR_OTHER, NULL);
+	dnsInflight_leave(pQCache);
+
+	for(int i=0; i<pQCache->pendingNum; i++)
+	{
+		dnsUdpPool_deletePending(pQCache->pendingId[i].fd, pQCache->pendingId[i].trId, pQCache);
+		dnsQCacheStopWaiting(&pQCache->pendingId[i]);
+	}
+
+	osVPL_free(&pQCache->qName, true);
+	osMBuf_dealloc(pQCache->pBuf);
+	if(pQCache->isInQCache)
+	{
+    	dnsCacheTable_delete(&gQCache, pQCache);
+	}
+	osList_delete(&pQCache->appDataList);
+	dnsTimerWheel_stop(&pQCache->waitForRespTimer);
+	dnsTimerWheel_stop(&pQCache->clientRspTimer);
+	dnsTimerWheel_stop(&pQCache->hedgeTimer);
 }
 
 
@@ -1149,14 +1438,14 @@ void dnsResResponse_memref(dnsResResponse_t* pDnsRsp)
     switch(pDnsRsp->rrType)
     {
         case DNS_RR_DATA_TYPE_MSG:
-            osmemref(pDnsRsp->pDnsRsp);
+            dnsMessage_ref(pDnsRsp->pDnsRsp);
             break;
         case DNS_RR_DATA_TYPE_MSGLIST:
         {
             osListElement_t* pLE = pDnsRsp->dnsRspList.head;
             while(pLE)
             {
-                osmemref(pLE->data);
+                dnsMessage_ref(pLE->data);
                 pLE = pLE->next;
             }
 
@@ -1184,10 +1473,10 @@ void dnsResResponse_cleanup(void* pData)
     switch(pRR->rrType)
     {
         case DNS_RR_DATA_TYPE_MSGLIST:
-            osList_delete(&pRR->dnsRspList);
+            dnsMessage_freeList(&pRR->dnsRspList);
             break;
         case DNS_RR_DATA_TYPE_MSG:
-            osfree(pRR->pDnsRsp);
+            dnsMessage_free(pRR->pDnsRsp);
             break;
         case DNS_RR_DATA_TYPE_STATUS:
         default:
@@ -10,6 +10,8 @@
 #include "dnsResolverIntf.h"
 #include "dnsResolver.h"
 #include "dnsRecurQuery.h"
+#include "dnsService.h"
+
 
 
 
@@ -18,6 +20,7 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
 {
 	dnsQueryStatus_e qStatus = DNS_QUERY_STATUS_DONE;
 	dnsMessage_t* pDnsRspMsg = NULL;
+	dnsRcode_e negRcode = DNS_RCODE_NO_ERROR;
 
 	if(!qName || !ppResResponse)
 	{
@@ -34,17 +37,25 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
     }
 
 	*ppResResponse = NULL;
+
+	//the query is resolved by a dedicated resolver thread
+	if(dnsService_isClient())
+	{
+		qStatus = dnsService_query(qName, qType, isResolveAll, isCacheRR, rrCallback, pData);
+		goto EXIT;
+	}
+
 	dnsQCacheInfo_t* pQCache = NULL;
 	dnsNextQCallbackData_t* pCbData = NULL;
 	if(qType == DNS_QTYPE_A || !isResolveAll)
 	{
-		qStatus = dnsQueryInternal(qName, qType, isCacheRR, &pDnsRspMsg, &pQCache, rrCallback, pData);
+		qStatus = dnsQueryInternal(qName, qType, isCacheRR, &pDnsRspMsg, &negRcode, &pQCache, rrCallback, pData);
 	}
 	else
 	{
 		pCbData = oszalloc(sizeof(dnsNextQCallbackData_t), dnsNextQCallbackData_cleanup);
 	
-		qStatus = dnsQueryInternal(qName, qType, isCacheRR, &pDnsRspMsg, &pQCache, dnsInternalCallback, pCbData);
+		qStatus = dnsQueryInternal(qName, qType, isCacheRR, &pDnsRspMsg, &negRcode, &pQCache, dnsInternalCallback, pCbData);
 	}
 
 	switch(qStatus)
@@ -55,6 +66,7 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
         		pCbData->pQNextInfo = oszalloc(sizeof(dnsNextQInfo_t), dnsNextQInfo_cleanup);
         		pCbData->pQNextInfo->pResResponse = oszalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
         		pCbData->pQNextInfo->pResResponse->rrType = DNS_RR_DATA_TYPE_MSGLIST;
+				osVPL_copyPL(&pCbData->pQNextInfo->qName, qName);
 
 				pCbData->pQNextInfo->origAppData.rrCallback = rrCallback;
 				pCbData->pQNextInfo->origAppData.pAppData = pData;
@@ -64,11 +76,26 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
 			}
 			break;
 		case DNS_QUERY_STATUS_DONE:
-			if(pDnsRspMsg->query.qType == DNS_QTYPE_A || !isResolveAll)
+			if(!pDnsRspMsg)
+			{
+				//a cached NXDOMAIN, reported the same way as a NXDOMAIN from the dns server, see dnsQAppListNotify().  A cached
+				//NODATA comes back as its dnsMsg with no answer, the same as a NODATA from the dns server
+				*ppResResponse = oszalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
+				(*ppResResponse)->rrType = DNS_RR_DATA_TYPE_STATUS;
+				(*ppResResponse)->status.pQName = qName;
+				(*ppResResponse)->status.resStatus = DNS_RES_STATUS_OK;
+				(*ppResResponse)->status.dnsRCode = negRcode;
+				if(isResolveAll)
+				{
+					osfree(pCbData);
+				}
+			}
+			else if(pDnsRspMsg->query.qType == DNS_QTYPE_A || !isResolveAll)
 			{
 		        *ppResResponse = oszalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
         		(*ppResResponse)->rrType = DNS_RR_DATA_TYPE_MSG;
 				(*ppResResponse)->pDnsRsp = pDnsRspMsg;
+				(*ppResResponse)->isStale = pDnsRspMsg->isStale;
     		}
 			else
 			{
@@ -76,6 +103,8 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
     	        pCbData->pQNextInfo->pResResponse = oszalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
      	        pCbData->pQNextInfo->pResResponse->rrType = DNS_RR_DATA_TYPE_MSGLIST;
                 osList_append(&pCbData->pQNextInfo->pResResponse->dnsRspList, pDnsRspMsg);
+				pCbData->pQNextInfo->pResResponse->isStale = pDnsRspMsg->isStale;
+				osVPL_copyPL(&pCbData->pQNextInfo->qName, qName);
 
           	    pCbData->pQNextInfo->origAppData.rrCallback = rrCallback;
                	pCbData->pQNextInfo->origAppData.pAppData = pData;
@@ -86,10 +115,10 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
             		case DNS_QUERY_STATUS_ONGOING:
                 		break;
             		case DNS_QUERY_STATUS_FAIL:
-                		osList_delete(&pCbData->pQNextInfo->pResResponse->dnsRspList);
+                		dnsMessage_freeList(&pCbData->pQNextInfo->pResResponse->dnsRspList);
                 		pCbData->pQNextInfo->pResResponse->rrType = DNS_RR_DATA_TYPE_STATUS;
                 		pCbData->pQNextInfo->pResResponse->status.resStatus = DNS_RES_ERROR_RECURSIVE;
-						pCbData->pQNextInfo->pResResponse->status.pQName = NULL;
+						pCbData->pQNextInfo->pResResponse->status.pQName = qName;
                 		*ppResResponse = pCbData->pQNextInfo->pResResponse;
 						pCbData->pQNextInfo->pResResponse = NULL;
 
@@ -121,11 +150,7 @@ dnsQueryStatus_e dnsQuery(osPointerLen_t* qName, dnsQType_e qType, bool isResolv
 	}	
 
 EXIT:
-	if(qStatus == DNS_QUERY_STATUS_DONE)
-	{
-		dnsResResponse_memref(*ppResResponse);
-	}
-	
+	//no need to refer *ppResResponse for app, every dnsMsg returned by dnsQueryInternal() has been referred
 	return qStatus;
 }
 
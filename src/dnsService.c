@@ -0,0 +1,495 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * an alternative deployment where the queries are resolved by one or a few dedicated resolver threads.  A resolver
+ * thread calls dnsResolver_initService(), it owns the sockets, caches and timers, and drains its MPSC request ring
+ * when the eventfd of the ring is readable.  The eventfd is in the epoll set of the resolver thread, see
+ * dnsResolver_getEventFd(), and is only written by the app thread whose request finds the ring idle.  An app thread calls dnsResolver_initClient() instead of dnsResolver_init(),
+ * dnsQuery() then passes the query to the resolver thread chosen by the hash of qName, so that the same qName is
+ * always resolved by the same thread, and its per thread rr cache is used.  The result comes back on the app
+ * thread's SPSC completion ring of the resolver thread, which the app thread drains in its own event loop when the
+ * eventfd of the ring is readable, and rrCallback is called there.  The eventfd is in the epoll set of the app thread
+ * while it has queries outstanding on the ring, and is written the same way as the one of the request ring.  Both
+ * rings are lock free.
+ */
+
+
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "osMemory.h"
+#include "osPL.h"
+#include "osDebug.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsEvent.h"
+#include "dnsService.h"
+
+
+static dnsServiceRequestRing_t* gpServiceRing[DNS_SERVICE_MAX_THREAD_NUM];
+static int gServiceNum;
+static pthread_mutex_t gServiceLock = PTHREAD_MUTEX_INITIALIZER;
+
+//resolver thread
+static __thread dnsServiceRequestRing_t* gpRequestRing;
+static __thread dnsEventHandler_t gRequestHandler;
+
+//app thread
+static __thread bool gIsClient;
+static __thread int gClientServiceNum;
+static __thread dnsServiceCompletionRing_t* gpCompletion[DNS_SERVICE_MAX_THREAD_NUM];
+static __thread uint32_t gOutstandingNum[DNS_SERVICE_MAX_THREAD_NUM];
+static __thread dnsEventHandler_t gCompletionHandler[DNS_SERVICE_MAX_THREAD_NUM];
+
+static bool dnsService_enqueue(dnsServiceRequestRing_t* pRing, dnsServiceRequest_t* pReq);
+static dnsServiceRequest_t* dnsService_dequeue(dnsServiceRequestRing_t* pRing);
+static bool dnsService_isEmpty(dnsServiceRequestRing_t* pRing);
+static void dnsService_kick(dnsServiceRequestRing_t* pRing);
+static void dnsService_kickCompletion(dnsServiceCompletionRing_t* pCompletion);
+static void dnsService_watchCompletion(int serviceIdx, bool isWatch);
+static void dnsService_process(dnsServiceRequest_t* pReq);
+static void dnsService_complete(dnsServiceRequest_t* pReq, dnsResResponse_t* pResResponse);
+static void dnsService_onResult(dnsResResponse_t* pRR, void* pData);
+static uint32_t dnsService_hash(osPointerLen_t* qName);
+static void dns_onRequestEvent(int fd, uint32_t events, void* pData);
+static void dns_onCompletionEvent(int fd, uint32_t events, void* pData);
+
+
+
+osStatus_e dnsService_init()
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	//the ring is accessed by the app threads, it is never freed
+	gpRequestRing = oszalloc(sizeof(dnsServiceRequestRing_t), NULL);
+	if(!gpRequestRing)
+	{
+		logError("fails to allocate gpRequestRing.");
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	for(uint32_t i=0; i<DNS_SERVICE_RING_SIZE; i++)
+	{
+		gpRequestRing->slot[i].seq = i;
+	}
+
+	//the ring starts empty, the first request kicks the resolver thread
+	gpRequestRing->isIdle = 1;
+	gpRequestRing->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(gpRequestRing->eventFd < 0)
+	{
+		logError("fails to create the eventfd of gpRequestRing, errno=%d.", errno);
+		gpRequestRing = osfree(gpRequestRing);
+		status = OS_ERROR_SYSTEM_FAILURE;
+		goto EXIT;
+	}
+
+	gRequestHandler.fd = gpRequestRing->eventFd;
+	gRequestHandler.callback = dns_onRequestEvent;
+	gRequestHandler.pData = gpRequestRing;
+	status = dnsEvent_add(&gRequestHandler, EPOLLIN);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsEvent_add for the eventfd of gpRequestRing.");
+		close(gpRequestRing->eventFd);
+		gpRequestRing = osfree(gpRequestRing);
+		goto EXIT;
+	}
+
+	pthread_mutex_lock(&gServiceLock);
+	if(gServiceNum == DNS_SERVICE_MAX_THREAD_NUM)
+	{
+		pthread_mutex_unlock(&gServiceLock);
+		logError("the number of resolver threads exceeds DNS_SERVICE_MAX_THREAD_NUM(%d).", DNS_SERVICE_MAX_THREAD_NUM);
+		dnsEvent_remove(&gRequestHandler);
+		close(gpRequestRing->eventFd);
+		gpRequestRing = osfree(gpRequestRing);
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+	gpServiceRing[gServiceNum++] = gpRequestRing;
+	pthread_mutex_unlock(&gServiceLock);
+
+EXIT:
+	return status;
+}
+
+
+osStatus_e dnsService_initClient()
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	pthread_mutex_lock(&gServiceLock);
+	gClientServiceNum = gServiceNum;
+	pthread_mutex_unlock(&gServiceLock);
+
+	if(!gClientServiceNum)
+	{
+		logError("no resolver thread has called dnsResolver_initService().");
+		status = OS_ERROR_INVALID_VALUE;
+		goto EXIT;
+	}
+
+	status = dnsEvent_init();
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsEvent_init.");
+		goto EXIT;
+	}
+
+	//the rings are accessed by the resolver threads, they are never freed
+	for(int i=0; i<gClientServiceNum; i++)
+	{
+		gpCompletion[i] = oszalloc(sizeof(dnsServiceCompletionRing_t), NULL);
+		if(!gpCompletion[i])
+		{
+			logError("fails to allocate gpCompletion[%d].", i);
+			status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+			goto EXIT;
+		}
+
+		//the ring starts empty, the first completion kicks the app thread
+		gpCompletion[i]->isIdle = 1;
+		gpCompletion[i]->eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(gpCompletion[i]->eventFd < 0)
+		{
+			logError("fails to create the eventfd of gpCompletion[%d], errno=%d.", i, errno);
+			gpCompletion[i] = osfree(gpCompletion[i]);
+			status = OS_ERROR_SYSTEM_FAILURE;
+			goto EXIT;
+		}
+
+		//only in the epoll set while the ring has requests outstanding, see dnsService_watchCompletion()
+		gCompletionHandler[i].fd = -1;
+		gCompletionHandler[i].callback = dns_onCompletionEvent;
+		gCompletionHandler[i].pData = (void*)(intptr_t)i;
+	}
+
+	gIsClient = true;
+
+EXIT:
+	return status;
+}
+
+
+bool dnsService_isClient()
+{
+	return gIsClient;
+}
+
+
+dnsQueryStatus_e dnsService_query(osPointerLen_t* qName, dnsQType_e qType, bool isResolveAll, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData)
+{
+	dnsQueryStatus_e qStatus = DNS_QUERY_STATUS_ONGOING;
+
+	if(qName->l >= DNS_MAX_NAME_SIZE)
+	{
+		logError("qName(%r) is longer than DNS_MAX_NAME_SIZE(%d).", qName, DNS_MAX_NAME_SIZE);
+		qStatus = DNS_QUERY_STATUS_FAIL;
+		goto EXIT;
+	}
+
+	int serviceIdx = dnsService_hash(qName) % gClientServiceNum;
+
+	//the completion ring can hold every outstanding request, so that the resolver thread never finds it full
+	if(gOutstandingNum[serviceIdx] == DNS_SERVICE_RING_SIZE)
+	{
+		logError("%d requests are outstanding on resolver thread %d, reject qName(%r).", DNS_SERVICE_RING_SIZE, serviceIdx, qName);
+		qStatus = DNS_QUERY_STATUS_FAIL;
+		goto EXIT;
+	}
+
+	dnsServiceRequest_t* pReq = osmalloc(sizeof(dnsServiceRequest_t), NULL);
+	if(!pReq)
+	{
+		logError("fails to allocate pReq.");
+		qStatus = DNS_QUERY_STATUS_FAIL;
+		goto EXIT;
+	}
+
+	//the app's qName may not live until the resolver thread picks up the request
+	memcpy(pReq->qNameBuf, qName->p, qName->l);
+	pReq->qNameBuf[qName->l] = 0;
+	pReq->qName.p = pReq->qNameBuf;
+	pReq->qName.l = qName->l;
+	pReq->qType = qType;
+	pReq->isResolveAll = isResolveAll;
+	pReq->isCacheRR = isCacheRR;
+	pReq->rrCallback = rrCallback;
+	pReq->pData = pData;
+	pReq->pResResponse = NULL;
+	pReq->pCompletion = gpCompletion[serviceIdx];
+
+	if(!dnsService_enqueue(gpServiceRing[serviceIdx], pReq))
+	{
+		logError("the request ring of resolver thread %d is full, reject qName(%r).", serviceIdx, qName);
+		osfree(pReq);
+		qStatus = DNS_QUERY_STATUS_FAIL;
+		goto EXIT;
+	}
+	dnsService_kick(gpServiceRing[serviceIdx]);
+
+	//start watching the completion ring when the first request on it is outstanding
+	if(gOutstandingNum[serviceIdx]++ == 0)
+	{
+		dnsService_watchCompletion(serviceIdx, true);
+	}
+
+EXIT:
+	return qStatus;
+}
+
+
+//Vyukov's bounded queue, each slot's seq tells whether it is free or filled for a given position
+static bool dnsService_enqueue(dnsServiceRequestRing_t* pRing, dnsServiceRequest_t* pReq)
+{
+	uint32_t pos = __atomic_load_n(&pRing->enqueuePos, __ATOMIC_RELAXED);
+	while(true)
+	{
+		dnsServiceSlot_t* pSlot = &pRing->slot[pos & (DNS_SERVICE_RING_SIZE - 1)];
+		int32_t diff = (int32_t)(__atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE) - pos);
+		if(diff == 0)
+		{
+			if(__atomic_compare_exchange_n(&pRing->enqueuePos, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				pSlot->pReq = pReq;
+				__atomic_store_n(&pSlot->seq, pos + 1, __ATOMIC_RELEASE);
+				return true;
+			}
+		}
+		else if(diff < 0)
+		{
+			//the consumer has not freed the slot yet, the ring is full
+			return false;
+		}
+		else
+		{
+			pos = __atomic_load_n(&pRing->enqueuePos, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+
+//only called by the resolver thread that owns the ring
+static dnsServiceRequest_t* dnsService_dequeue(dnsServiceRequestRing_t* pRing)
+{
+	dnsServiceSlot_t* pSlot = &pRing->slot[pRing->dequeuePos & (DNS_SERVICE_RING_SIZE - 1)];
+	if(__atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE) != pRing->dequeuePos + 1)
+	{
+		return NULL;
+	}
+
+	dnsServiceRequest_t* pReq = pSlot->pReq;
+	__atomic_store_n(&pSlot->seq, pRing->dequeuePos + DNS_SERVICE_RING_SIZE, __ATOMIC_RELEASE);
+	pRing->dequeuePos++;
+
+	return pReq;
+}
+
+
+static bool dnsService_isEmpty(dnsServiceRequestRing_t* pRing)
+{
+	dnsServiceSlot_t* pSlot = &pRing->slot[pRing->dequeuePos & (DNS_SERVICE_RING_SIZE - 1)];
+	return __atomic_load_n(&pSlot->seq, __ATOMIC_ACQUIRE) != pRing->dequeuePos + 1;
+}
+
+
+//called by an app thread after it enqueues, only the one that finds the resolver thread idle pays for the write()
+static void dnsService_kick(dnsServiceRequestRing_t* pRing)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(!__atomic_exchange_n(&pRing->isIdle, 0, __ATOMIC_SEQ_CST))
+	{
+		return;
+	}
+
+	uint64_t value = 1;
+	if(write(pRing->eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to write the eventfd(%d) of the request ring, errno=%d.", pRing->eventFd, errno);
+	}
+}
+
+
+//called by the resolver thread after it completes a request, only when the app thread has found the ring empty
+static void dnsService_kickCompletion(dnsServiceCompletionRing_t* pCompletion)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(!__atomic_exchange_n(&pCompletion->isIdle, 0, __ATOMIC_SEQ_CST))
+	{
+		return;
+	}
+
+	uint64_t value = 1;
+	if(write(pCompletion->eventFd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to write the eventfd(%d) of the completion ring, errno=%d.", pCompletion->eventFd, errno);
+	}
+}
+
+
+//the completion ring is only in the epoll set while it has requests outstanding, so that the epoll fd is not polled
+//for nothing when the app does not watch it, see dnsEvent.c
+static void dnsService_watchCompletion(int serviceIdx, bool isWatch)
+{
+	if(!isWatch)
+	{
+		dnsEvent_remove(&gCompletionHandler[serviceIdx]);
+		return;
+	}
+
+	gCompletionHandler[serviceIdx].fd = gpCompletion[serviceIdx]->eventFd;
+	if(dnsEvent_add(&gCompletionHandler[serviceIdx], EPOLLIN) != OS_STATUS_OK)
+	{
+		logError("fails to dnsEvent_add for the eventfd of gpCompletion[%d].", serviceIdx);
+		gCompletionHandler[serviceIdx].fd = -1;
+	}
+}
+
+
+//called in the resolver thread, passes the request back to the app thread
+static void dnsService_complete(dnsServiceRequest_t* pReq, dnsResResponse_t* pResResponse)
+{
+	//the qName the resolver thread points to may be gone by the time rrCallback is called, pReq lives until then
+	if(pResResponse && pResResponse->rrType == DNS_RR_DATA_TYPE_STATUS)
+	{
+		pResResponse->status.pQName = &pReq->qName;
+	}
+	pReq->pResResponse = pResResponse;
+
+	dnsServiceCompletionRing_t* pCompletion = pReq->pCompletion;
+	uint32_t tail = pCompletion->tail;
+	pCompletion->pReq[tail & (DNS_SERVICE_RING_SIZE - 1)] = pReq;
+	__atomic_store_n(&pCompletion->tail, tail + 1, __ATOMIC_RELEASE);
+
+	dnsService_kickCompletion(pCompletion);
+}
+
+
+//rrCallback of the queries performed in the resolver thread on behalf of the app threads
+static void dnsService_onResult(dnsResResponse_t* pRR, void* pData)
+{
+	dnsService_complete(pData, pRR);
+}
+
+
+//FNV-1a of the lower case qName, the same qName always goes to the same resolver thread
+static uint32_t dnsService_hash(osPointerLen_t* qName)
+{
+	uint32_t hash = 2166136261u;
+	for(size_t i=0; i<qName->l; i++)
+	{
+		hash = (hash ^ (uint8_t)tolower(qName->p[i])) * 16777619u;
+	}
+
+	return hash;
+}
+
+
+//called in the resolver thread for each request dequeued
+static void dnsService_process(dnsServiceRequest_t* pReq)
+{
+	dnsResResponse_t* pResResponse = NULL;
+	dnsQueryStatus_e qStatus = dnsQuery(&pReq->qName, pReq->qType, pReq->isResolveAll, pReq->isCacheRR, &pResResponse, dnsService_onResult, pReq);
+	switch(qStatus)
+	{
+		case DNS_QUERY_STATUS_ONGOING:
+			//dnsService_onResult() will pass it back
+			break;
+		case DNS_QUERY_STATUS_DONE:
+			dnsService_complete(pReq, pResResponse);
+			break;
+		case DNS_QUERY_STATUS_FAIL:
+		default:
+			pResResponse = oszalloc(sizeof(dnsResResponse_t), dnsResResponse_cleanup);
+			if(pResResponse)
+			{
+				pResResponse->rrType = DNS_RR_DATA_TYPE_STATUS;
+				pResResponse->status.pQName = &pReq->qName;
+				pResResponse->status.resStatus = DNS_RES_ERROR_OTHER;
+			}
+			dnsService_complete(pReq, pResResponse);
+			break;
+	}
+}
+
+
+static void dns_onRequestEvent(int fd, uint32_t events, void* pData)
+{
+	dnsServiceRequestRing_t* pRing = pData;
+
+	uint64_t value;
+	if(read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to read the eventfd(%d) of the request ring, errno=%d.", fd, errno);
+	}
+
+	while(true)
+	{
+		dnsServiceRequest_t* pReq;
+		while((pReq = dnsService_dequeue(pRing)))
+		{
+			dnsService_process(pReq);
+		}
+
+		//a request enqueued before isIdle is set does not write eventFd, check the ring once more
+		__atomic_store_n(&pRing->isIdle, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(dnsService_isEmpty(pRing))
+		{
+			break;
+		}
+
+		__atomic_store_n(&pRing->isIdle, 0, __ATOMIC_SEQ_CST);
+	}
+}
+
+
+//called in the app thread, pData is the index of the resolver thread
+static void dns_onCompletionEvent(int fd, uint32_t events, void* pData)
+{
+	int serviceIdx = (intptr_t)pData;
+	dnsServiceCompletionRing_t* pCompletion = gpCompletion[serviceIdx];
+
+	uint64_t value;
+	if(read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to read the eventfd(%d) of the completion ring, errno=%d.", fd, errno);
+	}
+
+	while(true)
+	{
+		uint32_t tail = __atomic_load_n(&pCompletion->tail, __ATOMIC_ACQUIRE);
+		while(pCompletion->head != tail)
+		{
+			dnsServiceRequest_t* pReq = pCompletion->pReq[pCompletion->head & (DNS_SERVICE_RING_SIZE - 1)];
+			__atomic_store_n(&pCompletion->head, pCompletion->head + 1, __ATOMIC_RELEASE);
+
+			//before rrCallback, which may send a new request on the same ring
+			if(--gOutstandingNum[serviceIdx] == 0)
+			{
+				dnsService_watchCompletion(serviceIdx, false);
+			}
+
+			//the app owns pResResponse from now on
+			pReq->rrCallback(pReq->pResResponse, pReq->pData);
+			osfree(pReq);
+		}
+
+		//a request completed before isIdle is set does not write eventFd, check the ring once more
+		__atomic_store_n(&pCompletion->isIdle, 1, __ATOMIC_SEQ_CST);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&pCompletion->tail, __ATOMIC_ACQUIRE) == pCompletion->head)
+		{
+			break;
+		}
+
+		__atomic_store_n(&pCompletion->isIdle, 0, __ATOMIC_SEQ_CST);
+	}
+}
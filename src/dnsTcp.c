@@ -0,0 +1,399 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * tcp transport for the queries whose udp response is truncated, rfc7766.  Each thread keeps one persistent
+ * connection per dns server, opened when it is first needed.  The queries are pipelined on it with the length
+ * prefix of rfc1035 section 4.2.2, and the responses, which may come out of order, are matched by (fd, trId) in
+ * the pending query table of dnsUdpPool.c, the same way as the udp responses.
+ * The fds are owned by the resolver and not registered with the tp, they are in the per thread epoll set of
+ * dnsEvent.c, with EPOLLOUT only while a connection is being established or has queries to write.  A connection is
+ * closed after it has been idle for DNS_TCP_IDLE_TIMEOUT, or as soon as it has no query outstanding if
+ * DNS_TCP_IDLE_TIMEOUT is 0.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "osMemory.h"
+#include "osMBuf.h"
+#include "osDebug.h"
+
+#include "dnsResolver.h"
+#include "dnsConfig.h"
+#include "dnsTimerWheel.h"
+#include "dnsEvent.h"
+#include "dnsTcp.h"
+
+
+static __thread dnsTcpConn_t* gpTcpConn[DNS_MAX_SERVER_NUM];
+static __thread int gTcpConnNum;
+static __thread uint32_t gTcpConnId;
+static __thread dnsUdpPool_recvCallback_h gRecvCallback;
+
+static osStatus_e dnsTcp_connect(dnsTcpConn_t* pConn);
+static void dnsTcp_close(dnsTcpConn_t* pConn);
+static void dnsTcp_write(dnsTcpConn_t* pConn);
+static void dnsTcp_read(dnsTcpConn_t* pConn);
+static void dnsTcp_touch(dnsTcpConn_t* pConn);
+static void dnsTcp_updateEvents(dnsTcpConn_t* pConn);
+static void dns_onTcpEvent(int fd, uint32_t events, void* pData);
+static void dns_onTcpIdleTimeout(void* ptr);
+
+
+
+osStatus_e dnsTcp_init(dnsUdpPool_recvCallback_h recvCallback)
+{
+	gRecvCallback = recvCallback;
+	return OS_STATUS_OK;
+}
+
+
+dnsTcpConn_t* dnsTcp_getConn(dnsServerInfo_t* pServerInfo)
+{
+	dnsTcpConn_t* pConn = pServerInfo->pTcpConn;
+	if(!pConn)
+	{
+		if(gTcpConnNum == DNS_MAX_SERVER_NUM)
+		{
+			logError("gTcpConnNum reaches DNS_MAX_SERVER_NUM(%d).", DNS_MAX_SERVER_NUM);
+			goto EXIT;
+		}
+
+		//the connection and its buffers are kept for the life of the thread, only the fd is opened and closed
+		pConn = oszalloc(sizeof(dnsTcpConn_t), NULL);
+		if(!pConn)
+		{
+			logError("fails to allocate pConn.");
+			goto EXIT;
+		}
+
+		pConn->sendBuf = osmalloc(DNS_TCP_SEND_BUF_SIZE, NULL);
+		pConn->recvBuf = osmalloc(2 + DNS_TCP_MAX_MSG_SIZE, NULL);
+		if(!pConn->sendBuf || !pConn->recvBuf)
+		{
+			logError("fails to allocate the buffers of pConn.");
+			osfree(pConn->sendBuf);
+			osfree(pConn->recvBuf);
+			pConn = osfree(pConn);
+			goto EXIT;
+		}
+
+		pConn->fd = -1;
+		pConn->state = DNS_TCP_CONN_STATE_CLOSED;
+		pConn->pServerInfo = pServerInfo;
+		pConn->eventHandler.fd = -1;
+		pConn->eventHandler.callback = dns_onTcpEvent;
+		pConn->eventHandler.pData = pConn;
+		pServerInfo->pTcpConn = pConn;
+		gpTcpConn[gTcpConnNum++] = pConn;
+	}
+
+	if(pConn->state == DNS_TCP_CONN_STATE_CLOSED && dnsTcp_connect(pConn) != OS_STATUS_OK)
+	{
+		pConn = NULL;
+		goto EXIT;
+	}
+
+EXIT:
+	return pConn;
+}
+
+
+osStatus_e dnsTcp_send(dnsTcpConn_t* pConn, osMBuf_t* pBuf)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	if(pConn->sendLen + 2 + pBuf->pos > DNS_TCP_SEND_BUF_SIZE)
+	{
+		//move the unwritten queries to the beginning of the buffer
+		memmove(pConn->sendBuf, &pConn->sendBuf[pConn->sendPos], pConn->sendLen - pConn->sendPos);
+		pConn->sendLen -= pConn->sendPos;
+		pConn->sendPos = 0;
+
+		if(pConn->sendLen + 2 + pBuf->pos > DNS_TCP_SEND_BUF_SIZE)
+		{
+			logError("the send buffer of fd(%d) is full, drop the query.", pConn->fd);
+			status = OS_ERROR_NETWORK_FAILURE;
+			goto EXIT;
+		}
+	}
+
+	uint16_t msgLen = htobe16(pBuf->pos);
+	memcpy(&pConn->sendBuf[pConn->sendLen], &msgLen, sizeof(msgLen));
+	memcpy(&pConn->sendBuf[pConn->sendLen + 2], pBuf->buf, pBuf->pos);
+	pConn->sendLen += 2 + pBuf->pos;
+	pConn->outstandingNum++;
+
+	if(pConn->state == DNS_TCP_CONN_STATE_CONNECTED)
+	{
+		dnsTcp_write(pConn);
+	}
+
+	dnsTcp_touch(pConn);
+
+EXIT:
+	return status;
+}
+
+
+void dnsTcp_complete(dnsServerInfo_t* pServerInfo, uint32_t connId)
+{
+	dnsTcpConn_t* pConn = pServerInfo->pTcpConn;
+	if(!pConn || pConn->state == DNS_TCP_CONN_STATE_CLOSED || pConn->connId != connId)
+	{
+		return;
+	}
+
+	if(pConn->outstandingNum)
+	{
+		pConn->outstandingNum--;
+	}
+
+	if(!DNS_TCP_IDLE_TIMEOUT && !pConn->outstandingNum && !pConn->sendLen)
+	{
+		dnsTcp_close(pConn);
+	}
+}
+
+
+static osStatus_e dnsTcp_connect(dnsTcpConn_t* pConn)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	pConn->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(pConn->fd < 0)
+	{
+		logError("fails to create tcp socket, errno=%d.", errno);
+		status = OS_ERROR_NETWORK_FAILURE;
+		goto EXIT;
+	}
+
+	struct sockaddr_in localAddr = dnsConfig_getLocalSockAddr();
+	localAddr.sin_family = AF_INET;
+	localAddr.sin_port = 0;
+	if(bind(pConn->fd, (struct sockaddr*)&localAddr, sizeof(localAddr)) != 0)
+	{
+		logError("fails to bind tcp socket, errno=%d.", errno);
+		status = OS_ERROR_NETWORK_FAILURE;
+		goto EXIT;
+	}
+
+	//the queries are queued until the connection is established, see dns_onTcpEvent()
+	if(connect(pConn->fd, (struct sockaddr*)&pConn->pServerInfo->socketAddr, sizeof(pConn->pServerInfo->socketAddr)) != 0 && errno != EINPROGRESS)
+	{
+		logError("fails to connect tcp socket to server(%A), errno=%d.", &pConn->pServerInfo->socketAddr, errno);
+		status = OS_ERROR_NETWORK_FAILURE;
+		goto EXIT;
+	}
+
+	pConn->eventHandler.fd = pConn->fd;
+	pConn->events = EPOLLIN | EPOLLOUT;
+	status = dnsEvent_add(&pConn->eventHandler, pConn->events);
+	if(status != OS_STATUS_OK)
+	{
+		logError("fails to dnsEvent_add for tcp fd(%d).", pConn->fd);
+		pConn->eventHandler.fd = -1;
+		goto EXIT;
+	}
+
+	//0 is never used, it is the connId of a udp send
+	if(!++gTcpConnId)
+	{
+		++gTcpConnId;
+	}
+	pConn->connId = gTcpConnId;
+	pConn->state = DNS_TCP_CONN_STATE_CONNECTING;
+	pConn->sendPos = pConn->sendLen = 0;
+	pConn->recvLen = 0;
+	pConn->outstandingNum = 0;
+
+	debug("fd(%d) is connecting to server(%A).", pConn->fd, &pConn->pServerInfo->socketAddr);
+
+EXIT:
+	if(status != OS_STATUS_OK && pConn->fd >= 0)
+	{
+		close(pConn->fd);
+		pConn->fd = -1;
+	}
+
+	return status;
+}
+
+
+//the queries outstanding on the connection time out and are retried
+static void dnsTcp_close(dnsTcpConn_t* pConn)
+{
+	debug("close tcp fd(%d), outstandingNum=%d.", pConn->fd, pConn->outstandingNum);
+
+	dnsTimerWheel_stop(&pConn->idleTimer);
+	dnsEvent_remove(&pConn->eventHandler);
+	//the fd number may be reused by a udp socket, whose responses shall not match the queries sent on this connection
+	dnsUdpPool_purgePending(pConn->fd);
+	close(pConn->fd);
+	pConn->fd = -1;
+	pConn->state = DNS_TCP_CONN_STATE_CLOSED;
+	pConn->sendPos = pConn->sendLen = 0;
+	pConn->recvLen = 0;
+	pConn->outstandingNum = 0;
+}
+
+
+static void dnsTcp_write(dnsTcpConn_t* pConn)
+{
+	while(pConn->sendPos < pConn->sendLen)
+	{
+		ssize_t len = send(pConn->fd, &pConn->sendBuf[pConn->sendPos], pConn->sendLen - pConn->sendPos, MSG_NOSIGNAL);
+		if(len < 0)
+		{
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				logError("fails to send on tcp fd(%d), errno=%d.", pConn->fd, errno);
+				dnsTcp_close(pConn);
+				return;
+			}
+
+			//the rest is written when the fd is writable
+			dnsTcp_updateEvents(pConn);
+			return;
+		}
+
+		pConn->sendPos += len;
+	}
+
+	pConn->sendPos = pConn->sendLen = 0;
+	dnsTcp_updateEvents(pConn);
+}
+
+
+static void dnsTcp_read(dnsTcpConn_t* pConn)
+{
+	while(true)
+	{
+		ssize_t len = recv(pConn->fd, &pConn->recvBuf[pConn->recvLen], 2 + DNS_TCP_MAX_MSG_SIZE - pConn->recvLen, 0);
+		if(len <= 0)
+		{
+			if(len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				//the server may close an idle connection any time, rfc7766 section 6.2.3
+				debug("tcp fd(%d) is closed by the server or fails, len=%ld, errno=%d.", pConn->fd, len, errno);
+				dnsTcp_close(pConn);
+			}
+			return;
+		}
+		pConn->recvLen += len;
+
+		//pass each complete response
+		size_t pos = 0;
+		while(pConn->recvLen - pos >= 2)
+		{
+			uint16_t msgLen;
+			memcpy(&msgLen, &pConn->recvBuf[pos], sizeof(msgLen));
+			msgLen = be16toh(msgLen);
+			if(pConn->recvLen - pos - 2 < msgLen)
+			{
+				break;
+			}
+
+			//outstandingNum is decreased by the callback if the response matches a query, see dnsTcp_complete()
+			osMBuf_t mBuf = {.buf = &pConn->recvBuf[pos + 2], .size = msgLen, .end = msgLen, .pos = 0};
+			uint32_t connId = pConn->connId;
+			gRecvCallback(pConn->fd, &mBuf);
+
+			//the connection may have been closed, and even reopened by a query sent from the callback
+			if(pConn->state == DNS_TCP_CONN_STATE_CLOSED || pConn->connId != connId)
+			{
+				return;
+			}
+
+			pos += 2 + msgLen;
+		}
+
+		memmove(pConn->recvBuf, &pConn->recvBuf[pos], pConn->recvLen - pos);
+		pConn->recvLen -= pos;
+
+		dnsTcp_touch(pConn);
+	}
+}
+
+
+//restarts the idle timer
+static void dnsTcp_touch(dnsTcpConn_t* pConn)
+{
+	if(pConn->state == DNS_TCP_CONN_STATE_CLOSED)
+	{
+		return;
+	}
+
+	//without reuse, the connection still closes if the outstanding queries never get response
+	dnsTimerWheel_start(&pConn->idleTimer, DNS_TCP_IDLE_TIMEOUT ? DNS_TCP_IDLE_TIMEOUT : DNS_WAIT_RESPONSE_TIMEOUT, dns_onTcpIdleTimeout, pConn);
+}
+
+
+//EPOLLOUT is only asked while it is needed, the epoll set is level triggered
+static void dnsTcp_updateEvents(dnsTcpConn_t* pConn)
+{
+	if(pConn->state == DNS_TCP_CONN_STATE_CLOSED)
+	{
+		return;
+	}
+
+	uint32_t events = EPOLLIN;
+	if(pConn->state == DNS_TCP_CONN_STATE_CONNECTING || pConn->sendLen)
+	{
+		events |= EPOLLOUT;
+	}
+
+	if(events != pConn->events && dnsEvent_modify(&pConn->eventHandler, events) == OS_STATUS_OK)
+	{
+		pConn->events = events;
+	}
+}
+
+
+static void dns_onTcpEvent(int fd, uint32_t events, void* pData)
+{
+	dnsTcpConn_t* pConn = pData;
+	if(pConn->state == DNS_TCP_CONN_STATE_CONNECTING)
+	{
+		int error = 0;
+		socklen_t errorLen = sizeof(error);
+		if(getsockopt(pConn->fd, SOL_SOCKET, SO_ERROR, &error, &errorLen) != 0 || error)
+		{
+			logError("fails to connect tcp fd(%d) to server(%A), error=%d.", pConn->fd, &pConn->pServerInfo->socketAddr, error);
+			dnsTcp_close(pConn);
+			return;
+		}
+
+		debug("tcp fd(%d) is connected.", pConn->fd);
+		pConn->state = DNS_TCP_CONN_STATE_CONNECTED;
+		dnsTcp_write(pConn);
+	}
+	else if(events & EPOLLOUT)
+	{
+		dnsTcp_write(pConn);
+	}
+
+	if(pConn->state == DNS_TCP_CONN_STATE_CONNECTED && events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+	{
+		dnsTcp_read(pConn);
+	}
+}
+
+
+static void dns_onTcpIdleTimeout(void* ptr)
+{
+	if(!ptr)
+	{
+		logError("null pointer, ptr.");
+		return;
+	}
+
+	dnsTcpConn_t* pConn = ptr;
+	debug("tcp fd(%d) has been idle, close it.", pConn->fd);
+	dnsTcp_close(pConn);
+}
@@ -0,0 +1,190 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * implement a per thread single level hashed timer wheel for the resolver's query timers.  A timer is
+ * put into the slot of its expiry tick, the slots are double linked lists, so that a start or a stop is
+ * O(1).  A timer that expires more than one round later stays in its slot until the round comes.  The
+ * wheel uses one os timer, it is only running when the wheel has timers, and it advances the wheel
+ * based on the monotonic clock, so a late os timer does not delay the following ticks.
+ */
+
+
+#include <time.h>
+
+#include "osTimer.h"
+#include "osDebug.h"
+
+#include "dnsTimerWheel.h"
+
+
+static __thread dnsTimerNode_t gSlot[DNS_TIMER_WHEEL_SLOT_NUM];	//the list head of each slot
+static __thread bool gIsWheelInit;
+static __thread uint64_t gCurTick;			//the last tick that has been processed
+static __thread uint32_t gNodeNum;			//running timers
+static __thread uint64_t gWheelTimerId;
+
+static void dnsTimerWheel_init();
+static void dnsTimerWheel_processSlot(dnsTimerNode_t* pHead, uint64_t nowTick);
+static inline void dnsTimerWheel_append(dnsTimerNode_t* pHead, dnsTimerNode_t* pNode);
+static inline void dnsTimerWheel_unlink(dnsTimerNode_t* pNode);
+static uint64_t dnsTimerWheel_getTime();
+static void dns_onTimerWheelTimeout(uint64_t timerId, void* ptr);
+
+
+
+void dnsTimerWheel_start(dnsTimerNode_t* pNode, uint32_t msec, dnsTimerWheel_callback_h callback, void* pData)
+{
+	if(!gIsWheelInit)
+	{
+		dnsTimerWheel_init();
+	}
+
+	dnsTimerWheel_stop(pNode);
+
+	uint64_t now = dnsTimerWheel_getTime();
+	//no timer is running, nothing to be processed for the ticks that have passed
+	if(!gNodeNum && !gWheelTimerId)
+	{
+		gCurTick = now / DNS_TIMER_WHEEL_TICK;
+	}
+
+	//round up, a timer never fires earlier than msec
+	pNode->expireTick = (now + msec + DNS_TIMER_WHEEL_TICK - 1) / DNS_TIMER_WHEEL_TICK;
+	if(pNode->expireTick <= gCurTick)
+	{
+		pNode->expireTick = gCurTick + 1;
+	}
+	pNode->callback = callback;
+	pNode->pData = pData;
+
+	dnsTimerWheel_append(&gSlot[pNode->expireTick & (DNS_TIMER_WHEEL_SLOT_NUM - 1)], pNode);
+
+	if(gNodeNum++ == 0 && !gWheelTimerId)
+	{
+		gWheelTimerId = osStartTimer(DNS_TIMER_WHEEL_TICK, dns_onTimerWheelTimeout, NULL);
+	}
+}
+
+
+void dnsTimerWheel_stop(dnsTimerNode_t* pNode)
+{
+	if(!pNode->prev)
+	{
+		return;
+	}
+
+	//the os timer is left running, it stops by itself at the next tick if the wheel is empty
+	dnsTimerWheel_unlink(pNode);
+	--gNodeNum;
+}
+
+
+bool dnsTimerWheel_isRunning(dnsTimerNode_t* pNode)
+{
+	return pNode->prev != NULL;
+}
+
+
+static void dnsTimerWheel_init()
+{
+	for(int i=0; i<DNS_TIMER_WHEEL_SLOT_NUM; i++)
+	{
+		gSlot[i].prev = &gSlot[i];
+		gSlot[i].next = &gSlot[i];
+	}
+
+	gCurTick = dnsTimerWheel_getTime() / DNS_TIMER_WHEEL_TICK;
+	gIsWheelInit = true;
+}
+
+
+static void dns_onTimerWheelTimeout(uint64_t timerId, void* ptr)
+{
+	if(gWheelTimerId != timerId)
+	{
+		logError("gWheelTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", gWheelTimerId, timerId);
+		return;
+	}
+	gWheelTimerId = 0;
+
+	uint64_t nowTick = dnsTimerWheel_getTime() / DNS_TIMER_WHEEL_TICK;
+	uint64_t tick = gCurTick + 1;
+	//when the os timer is late for more than a round, each slot only needs to be visited once
+	if(nowTick - gCurTick > DNS_TIMER_WHEEL_SLOT_NUM)
+	{
+		tick = nowTick - DNS_TIMER_WHEEL_SLOT_NUM + 1;
+	}
+
+	//a timer started by a callback expires after nowTick, it is not fired in this round
+	gCurTick = nowTick;
+	for(; tick <= nowTick; tick++)
+	{
+		dnsTimerWheel_processSlot(&gSlot[tick & (DNS_TIMER_WHEEL_SLOT_NUM - 1)], nowTick);
+	}
+
+	if(gNodeNum > 0 && !gWheelTimerId)
+	{
+		gWheelTimerId = osStartTimer(DNS_TIMER_WHEEL_TICK, dns_onTimerWheelTimeout, NULL);
+	}
+}
+
+
+static void dnsTimerWheel_processSlot(dnsTimerNode_t* pHead, uint64_t nowTick)
+{
+	if(pHead->next == pHead)
+	{
+		return;
+	}
+
+	//move the slot to a local list, a callback may start or stop any timer, including the ones in this list
+	dnsTimerNode_t list;
+	list.next = pHead->next;
+	list.prev = pHead->prev;
+	list.next->prev = &list;
+	list.prev->next = &list;
+	pHead->next = pHead;
+	pHead->prev = pHead;
+
+	while(list.next != &list)
+	{
+		dnsTimerNode_t* pNode = list.next;
+		dnsTimerWheel_unlink(pNode);
+
+		//expires in a later round
+		if(pNode->expireTick > nowTick)
+		{
+			dnsTimerWheel_append(pHead, pNode);
+			continue;
+		}
+
+		--gNodeNum;
+		pNode->callback(pNode->pData);
+	}
+}
+
+
+static inline void dnsTimerWheel_append(dnsTimerNode_t* pHead, dnsTimerNode_t* pNode)
+{
+	pNode->prev = pHead->prev;
+	pNode->next = pHead;
+	pHead->prev->next = pNode;
+	pHead->prev = pNode;
+}
+
+
+static inline void dnsTimerWheel_unlink(dnsTimerNode_t* pNode)
+{
+	pNode->prev->next = pNode->next;
+	pNode->next->prev = pNode->prev;
+	pNode->prev = NULL;
+	pNode->next = NULL;
+}
+
+
+//monotonic time in msec
+static uint64_t dnsTimerWheel_getTime()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+
+	return (uint64_t)tp.tv_sec * 1000 + tp.tv_nsec / 1000000;
+}
@@ -0,0 +1,617 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * a per thread pool of long lived udp sockets, DNS_UDP_SOCKET_NUM per dns server.  Each socket is connected to
+ * its server, so that the kernel only delivers datagrams from the server to it, and no socket is created or
+ * closed per query.  A query picks one of the sockets at random.  Every socket is bound to a kernel chosen
+ * ephemeral port, and is replaced by a socket with a new port after DNS_UDP_SOCKET_MAX_QUERY queries, so that
+ * the source port of the queries keeps changing.  A replaced socket is closed after DNS_WAIT_RESPONSE_TIMEOUT,
+ * when no response on it is waited for any more.  Before it is closed, it is deregistered from the tp, and its
+ * entries are purged from the pending table, so that a new socket that gets the same fd number does not match them.
+ * Every query sent is recorded in a per thread table indexed by (fd, trId).  The trId is drawn at random from
+ * the IDs not pending on the socket, a response is matched by the fd it arrives on and its first 2 bytes.
+ * When DNS_UDP_BATCH_IO is set, the queries sent in one event loop iteration are copied into a per thread send
+ * ring, and flushed by a 0 msec timer with one sendmmsg() per socket.  When the tp passes a response, the rest of
+ * the responses queued on the socket are read with recvmmsg() into a pre-allocated ring of buffers.  The first
+ * query on a socket always goes through the tp, so that the tp starts to receive on the socket.
+ * When the library is built with DNS_IO_URING and the kernel supports it, the sockets are sent and received
+ * through the io_uring engine instead, see dnsUring.c.
+ */
+
+
+//for sendmmsg() and recvmmsg()
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "osMemory.h"
+#include "osMBuf.h"
+#include "osDebug.h"
+#include "osTimer.h"
+
+#include "transportIntf.h"
+
+#include "dnsResolver.h"
+#include "dnsConfig.h"
+#include "dnsTimerWheel.h"
+#include "dnsUdpPool.h"
+#include "dnsUring.h"
+
+
+static __thread dnsUdpPendingSlot_t* gpPendingSlot;
+static __thread uint32_t gPendingMask;		//number of slots - 1
+static __thread uint32_t gPendingNum;
+static __thread uint8_t gRandomBuf[256];
+static __thread uint32_t gRandomPos = sizeof(gRandomBuf);
+static __thread dnsUdpSendSlot_t* gpSendSlot;		//DNS_UDP_BATCH_SIZE slots
+static __thread uint32_t gSendNum;
+static __thread uint64_t gFlushTimerId;
+static __thread uint8_t* gpRecvBuf;		//DNS_UDP_BATCH_SIZE buffers of DNS_UDP_RECV_BUF_SIZE
+static __thread dnsUdpIoStats_t gIoStats;
+static __thread dnsUdpPool_recvCallback_h gRecvCallback;
+
+static int dnsUdpPool_openFd(dnsServerInfo_t* pServerInfo);
+static void dnsUdpPool_retireFd(int fd, bool isUringArmed, bool isTpRegistered);
+static void dnsUdpPool_closeFd(int fd, bool isUringArmed, bool isTpRegistered);
+static void dnsUdpPool_onUringRecv(int fd, osMBuf_t* pBuf);
+static void dnsUdpPool_flush();
+static osStatus_e dnsUdpPool_resizePending(uint32_t slotNum);
+static uint32_t dnsUdpPool_findPending(uint32_t key);
+static inline uint32_t dnsUdpPool_hashPending(uint32_t key);
+static uint16_t dnsUdpPool_random();
+static void dns_onUdpFdCloseTimeout(void* ptr);
+static void dns_onUdpFlushTimeout(uint64_t timerId, void* ptr);
+
+
+
+osStatus_e dnsUdpPool_init(dnsServerInfo_t* pServerInfo, dnsUdpPool_recvCallback_h recvCallback)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	//the pending table and the io_uring engine are shared by all servers of the thread
+	if(!gpPendingSlot)
+	{
+		status = dnsUdpPool_resizePending(DNS_UDP_PENDING_MIN_SIZE);
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to create the pending query table.");
+			goto EXIT;
+		}
+
+		gRecvCallback = recvCallback;
+		if(dnsUring_init(dnsUdpPool_onUringRecv))
+		{
+			logInfo("the udp queries are sent and received through io_uring.");
+		}
+	}
+
+	if(DNS_UDP_BATCH_IO && !gpSendSlot)
+	{
+		gpSendSlot = osmalloc(sizeof(dnsUdpSendSlot_t) * DNS_UDP_BATCH_SIZE, NULL);
+		gpRecvBuf = osmalloc(DNS_UDP_RECV_BUF_SIZE * DNS_UDP_BATCH_SIZE, NULL);
+		if(!gpSendSlot || !gpRecvBuf)
+		{
+			logError("fails to allocate the batch io rings.");
+			status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+			goto EXIT;
+		}
+	}
+
+	pServerInfo->udpFdNum = DNS_UDP_SOCKET_NUM;
+	pServerInfo->pUdpFd = osmalloc(sizeof(dnsUdpActiveFdInfo_t) * pServerInfo->udpFdNum, NULL);
+	if(!pServerInfo->pUdpFd)
+	{
+		logError("fails to allocate pUdpFd, udpFdNum=%d.", pServerInfo->udpFdNum);
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	//the sockets are opened when they are first used
+	for(int i=0; i<pServerInfo->udpFdNum; i++)
+	{
+		pServerInfo->pUdpFd[i].fd = -1;
+		pServerInfo->pUdpFd[i].queryNum = 0;
+		pServerInfo->pUdpFd[i].isTpRegistered = false;
+		pServerInfo->pUdpFd[i].isUringArmed = false;
+	}
+
+EXIT:
+	return status;
+}
+
+
+dnsUdpActiveFdInfo_t* dnsUdpPool_getFd(dnsServerInfo_t* pServerInfo)
+{
+	dnsUdpActiveFdInfo_t* pFdInfo = &pServerInfo->pUdpFd[dnsUdpPool_random() % pServerInfo->udpFdNum];
+
+	if(pFdInfo->fd >= 0 && DNS_UDP_SOCKET_MAX_QUERY && pFdInfo->queryNum >= DNS_UDP_SOCKET_MAX_QUERY)
+	{
+		debug("fd(%d) has been used for %d queries, replace it.", pFdInfo->fd, pFdInfo->queryNum);
+		dnsUdpPool_retireFd(pFdInfo->fd, pFdInfo->isUringArmed, pFdInfo->isTpRegistered);
+		pFdInfo->fd = -1;
+	}
+
+	if(pFdInfo->fd < 0)
+	{
+		pFdInfo->fd = dnsUdpPool_openFd(pServerInfo);
+		pFdInfo->queryNum = 0;
+		pFdInfo->isTpRegistered = false;
+		if(pFdInfo->fd < 0)
+		{
+			pFdInfo = NULL;
+			goto EXIT;
+		}
+
+		//if the receive can not be armed, the socket goes through the tp
+		pFdInfo->isUringArmed = dnsUring_isActive() && dnsUring_addFd(pFdInfo->fd) == OS_STATUS_OK;
+	}
+
+	pFdInfo->queryNum++;
+
+EXIT:
+	return pFdInfo;
+}
+
+
+osStatus_e dnsUdpPool_send(dnsServerInfo_t* pServerInfo, dnsUdpActiveFdInfo_t* pFdInfo, osMBuf_t* pBuf)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	//the engine may become inactive after the socket is armed, see dnsUring_onRecv()
+	if(pFdInfo->isUringArmed && dnsUring_isActive())
+	{
+		status = dnsUring_send(pFdInfo->fd, pBuf);
+		if(status == OS_STATUS_OK)
+		{
+			gIoStats.sentNum++;
+		}
+		goto EXIT;
+	}
+
+	if(DNS_UDP_BATCH_IO && pFdInfo->isTpRegistered)
+	{
+		dnsUdpSendSlot_t* pSlot = &gpSendSlot[gSendNum++];
+		pSlot->fd = pFdInfo->fd;
+		pSlot->len = pBuf->pos;
+		memcpy(pSlot->buf, pBuf->buf, pBuf->pos);
+
+		if(gSendNum == DNS_UDP_BATCH_SIZE)
+		{
+			dnsUdpPool_flush();
+		}
+		else if(!gFlushTimerId)
+		{
+			//fires in the next event loop iteration, after all queries of this iteration have been queued
+			gFlushTimerId = osStartTimer(0, dns_onUdpFlushTimeout, NULL);
+		}
+
+		gIoStats.sentNum++;
+		goto EXIT;
+	}
+
+	//the tp only sends and receives on the fd, the fd is owned by the resolver
+	transportInfo_t tpInfo;
+	tpInfo.isCom = false;
+	tpInfo.tpType = TRANSPORT_TYPE_UDP;
+	tpInfo.local = dnsConfig_getLocalSockAddr();
+	tpInfo.peer = pServerInfo->socketAddr;
+	tpInfo.udpInfo.isUdpWaitResponse = true;
+	tpInfo.udpInfo.isEphemeralPort = false;
+	tpInfo.udpInfo.fd = pFdInfo->fd;
+	tpInfo.protocolUpdatePos = 0;
+	transportStatus_e tStatus = transport_localSend(TRANSPORT_APP_TYPE_DNS, &tpInfo, pBuf, NULL);
+	gIoStats.sendCallNum++;
+	if(tStatus != TRANSPORT_STATUS_UDP)
+	{
+		logError("fails to transport_localSend, fd=%d.", pFdInfo->fd);
+		status = OS_ERROR_NETWORK_FAILURE;
+		goto EXIT;
+	}
+
+	pFdInfo->isTpRegistered = true;
+	gIoStats.sentNum++;
+
+EXIT:
+	return status;
+}
+
+
+void dnsUdpPool_drain(int fd, dnsUdpPool_recvCallback_h recvCallback)
+{
+	//the response the tp has passed
+	gIoStats.recvNum++;
+	gIoStats.recvCallNum++;
+
+	if(!DNS_UDP_BATCH_IO)
+	{
+		return;
+	}
+
+	struct mmsghdr msg[DNS_UDP_BATCH_SIZE];
+	struct iovec iov[DNS_UDP_BATCH_SIZE];
+	int msgNum;
+	do
+	{
+		for(int i=0; i<DNS_UDP_BATCH_SIZE; i++)
+		{
+			iov[i].iov_base = &gpRecvBuf[i * DNS_UDP_RECV_BUF_SIZE];
+			iov[i].iov_len = DNS_UDP_RECV_BUF_SIZE;
+			memset(&msg[i].msg_hdr, 0, sizeof(msg[i].msg_hdr));
+			msg[i].msg_hdr.msg_iov = &iov[i];
+			msg[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		msgNum = recvmmsg(fd, msg, DNS_UDP_BATCH_SIZE, MSG_DONTWAIT, NULL);
+		gIoStats.recvCallNum++;
+		if(msgNum < 0)
+		{
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				logError("fails to recvmmsg, fd=%d, errno=%d.", fd, errno);
+			}
+			break;
+		}
+
+		for(int i=0; i<msgNum; i++)
+		{
+			//the socket is connected, only the server's datagrams are received
+			osMBuf_t mBuf = {.buf = &gpRecvBuf[i * DNS_UDP_RECV_BUF_SIZE], .size = msg[i].msg_len, .end = msg[i].msg_len, .pos = 0};
+			gIoStats.recvNum++;
+			recvCallback(fd, &mBuf);
+		}
+	} while(msgNum == DNS_UDP_BATCH_SIZE);
+}
+
+
+void dnsUdpPool_getStats(dnsUdpIoStats_t* pStats)
+{
+	*pStats = gIoStats;
+	pStats->sendCallNum += dnsUring_getSubmitNum();
+}
+
+
+uint32_t dnsUdpPool_getPendingNum()
+{
+	return gPendingNum;
+}
+
+
+osStatus_e dnsUdpPool_addPending(int fd, dnsQCacheInfo_t* pQCache, uint16_t* pTrId)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	//keep the load under 3/4
+	if((gPendingNum + 1) * 4 > (gPendingMask + 1) * 3)
+	{
+		status = dnsUdpPool_resizePending((gPendingMask + 1) * 2);
+		if(status != OS_STATUS_OK)
+		{
+			logError("fails to grow the pending query table.");
+			goto EXIT;
+		}
+	}
+
+	for(int i=0; i<DNS_UDP_TRID_MAX_TRY; i++)
+	{
+		uint16_t trId = dnsUdpPool_random();
+		uint32_t key = ((uint32_t)fd << 16) | trId;
+		uint32_t slot = dnsUdpPool_findPending(key);
+		if(gpPendingSlot[slot].pQCache)
+		{
+			continue;
+		}
+
+		gpPendingSlot[slot].key = key;
+		gpPendingSlot[slot].pQCache = pQCache;
+		gPendingNum++;
+
+		*pTrId = trId;
+		goto EXIT;
+	}
+
+	logError("fails to find a free trId for fd(%d) after %d tries.", fd, DNS_UDP_TRID_MAX_TRY);
+	status = OS_ERROR_INVALID_VALUE;
+
+EXIT:
+	return status;
+}
+
+
+dnsQCacheInfo_t* dnsUdpPool_lookupPending(int fd, uint16_t trId)
+{
+	return gpPendingSlot[dnsUdpPool_findPending(((uint32_t)fd << 16) | trId)].pQCache;
+}
+
+
+void dnsUdpPool_deletePending(int fd, uint16_t trId, dnsQCacheInfo_t* pQCache)
+{
+	uint32_t i = dnsUdpPool_findPending(((uint32_t)fd << 16) | trId);
+	if(!gpPendingSlot[i].pQCache || gpPendingSlot[i].pQCache != pQCache)
+	{
+		return;
+	}
+
+	gpPendingSlot[i].pQCache = NULL;
+	gPendingNum--;
+
+	//backward shift the following slots of the probe chain, so that no tombstone is needed
+	uint32_t j = i;
+	while(true)
+	{
+		j = (j + 1) & gPendingMask;
+		if(!gpPendingSlot[j].pQCache)
+		{
+			break;
+		}
+
+		//the slot j can move to i only if its home slot is not cyclically in (i, j]
+		uint32_t home = dnsUdpPool_hashPending(gpPendingSlot[j].key);
+		if(((j - home) & gPendingMask) >= ((j - i) & gPendingMask))
+		{
+			gpPendingSlot[i] = gpPendingSlot[j];
+			gpPendingSlot[j].pQCache = NULL;
+			i = j;
+		}
+	}
+}
+
+
+//the queries still pending on fd time out, their entries are removed, so that they can not match a response on a new
+//socket that gets the same fd number.  A query deletes its entry with its own pQCache, it does not delete an entry of the new socket
+void dnsUdpPool_purgePending(int fd)
+{
+	uint32_t i = 0;
+	while(i <= gPendingMask)
+	{
+		if(gpPendingSlot[i].pQCache && (gpPendingSlot[i].key >> 16) == (uint32_t)fd)
+		{
+			//the backward shift may move another entry into slot i, check it again
+			dnsUdpPool_deletePending(fd, gpPendingSlot[i].key & 0xffff, gpPendingSlot[i].pQCache);
+			continue;
+		}
+
+		i++;
+	}
+}
+
+
+static int dnsUdpPool_openFd(dnsServerInfo_t* pServerInfo)
+{
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if(fd < 0)
+	{
+		logError("fails to create udp socket, errno=%d.", errno);
+		goto EXIT;
+	}
+
+	//port 0, the kernel picks a random ephemeral port
+	struct sockaddr_in localAddr = dnsConfig_getLocalSockAddr();
+	localAddr.sin_family = AF_INET;
+	localAddr.sin_port = 0;
+	if(bind(fd, (struct sockaddr*)&localAddr, sizeof(localAddr)) != 0)
+	{
+		logError("fails to bind udp socket, errno=%d.", errno);
+		close(fd);
+		fd = -1;
+		goto EXIT;
+	}
+
+	if(connect(fd, (struct sockaddr*)&pServerInfo->socketAddr, sizeof(pServerInfo->socketAddr)) != 0)
+	{
+		logError("fails to connect udp socket to server(%A), errno=%d.", &pServerInfo->socketAddr, errno);
+		close(fd);
+		fd = -1;
+		goto EXIT;
+	}
+
+	debug("fd(%d) is opened for server(%A).", fd, &pServerInfo->socketAddr);
+
+EXIT:
+	return fd;
+}
+
+
+static void dnsUdpPool_retireFd(int fd, bool isUringArmed, bool isTpRegistered)
+{
+	dnsUdpRetiredFdInfo_t* pRetiredFd = oszalloc(sizeof(dnsUdpRetiredFdInfo_t), NULL);
+	if(!pRetiredFd)
+	{
+		//a late response on the fd is dropped, the query will time out and be retried
+		logError("fails to allocate pRetiredFd, close fd(%d) now.", fd);
+		dnsUdpPool_closeFd(fd, isUringArmed, isTpRegistered);
+		return;
+	}
+
+	pRetiredFd->fd = fd;
+	pRetiredFd->isUringArmed = isUringArmed;
+	pRetiredFd->isTpRegistered = isTpRegistered;
+	dnsTimerWheel_start(&pRetiredFd->closeTimer, DNS_WAIT_RESPONSE_TIMEOUT, dns_onUdpFdCloseTimeout, pRetiredFd);
+}
+
+
+static osStatus_e dnsUdpPool_resizePending(uint32_t slotNum)
+{
+	osStatus_e status = OS_STATUS_OK;
+
+	dnsUdpPendingSlot_t* pOldSlot = gpPendingSlot;
+	uint32_t oldSlotNum = pOldSlot ? gPendingMask + 1 : 0;
+
+	gpPendingSlot = oszalloc(sizeof(dnsUdpPendingSlot_t) * slotNum, NULL);
+	if(!gpPendingSlot)
+	{
+		logError("fails to allocate gpPendingSlot, slotNum=%d.", slotNum);
+		gpPendingSlot = pOldSlot;
+		status = OS_ERROR_MEMORY_ALLOC_FAILURE;
+		goto EXIT;
+	}
+
+	gPendingMask = slotNum - 1;
+	for(uint32_t i=0; i<oldSlotNum; i++)
+	{
+		if(pOldSlot[i].pQCache)
+		{
+			gpPendingSlot[dnsUdpPool_findPending(pOldSlot[i].key)] = pOldSlot[i];
+		}
+	}
+
+	osfree(pOldSlot);
+
+EXIT:
+	return status;
+}
+
+
+//the receivers of the fd are removed before it is closed, so that none of them passes a datagram of a new socket that gets
+//the same fd number as this one
+static void dnsUdpPool_closeFd(int fd, bool isUringArmed, bool isTpRegistered)
+{
+	debug("close fd(%d), isUringArmed=%d, isTpRegistered=%d.", fd, isUringArmed, isTpRegistered);
+	if(isUringArmed)
+	{
+		dnsUring_removeFd(fd);
+	}
+
+	if(isTpRegistered)
+	{
+		transport_localClosed(TRANSPORT_APP_TYPE_DNS, fd);
+	}
+
+	dnsUdpPool_purgePending(fd);
+	close(fd);
+}
+
+
+//returns the slot that has the key, or the empty slot where the key would be added
+static uint32_t dnsUdpPool_findPending(uint32_t key)
+{
+	uint32_t i = dnsUdpPool_hashPending(key);
+	while(gpPendingSlot[i].pQCache && gpPendingSlot[i].key != key)
+	{
+		i = (i + 1) & gPendingMask;
+	}
+
+	return i;
+}
+
+
+//the home slot of the key, fibonacci hashing spreads the fd bits over the whole table
+static inline uint32_t dnsUdpPool_hashPending(uint32_t key)
+{
+	return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> 32) & gPendingMask;
+}
+
+
+//the trId and the socket of a query shall not be guessable, use the kernel random source, refilled in batch
+static uint16_t dnsUdpPool_random()
+{
+	if(gRandomPos + sizeof(uint16_t) > sizeof(gRandomBuf))
+	{
+		if(getrandom(gRandomBuf, sizeof(gRandomBuf), 0) != sizeof(gRandomBuf))
+		{
+			logError("fails to getrandom, errno=%d, reuse the old random bytes.", errno);
+		}
+		gRandomPos = 0;
+	}
+
+	uint16_t value;
+	memcpy(&value, &gRandomBuf[gRandomPos], sizeof(value));
+	gRandomPos += sizeof(value);
+
+	return value;
+}
+
+
+//sends the queued messages, one sendmmsg() per socket.  A message that fails to be sent is dropped, its query times out and is retried
+static void dnsUdpPool_flush()
+{
+	struct mmsghdr msg[DNS_UDP_BATCH_SIZE];
+	struct iovec iov[DNS_UDP_BATCH_SIZE];
+	bool isSent[DNS_UDP_BATCH_SIZE] = {};
+
+	for(int i=0; i<gSendNum; i++)
+	{
+		if(isSent[i])
+		{
+			continue;
+		}
+
+		//collect the messages of the same socket
+		int fd = gpSendSlot[i].fd;
+		int msgNum = 0;
+		for(int j=i; j<gSendNum; j++)
+		{
+			if(isSent[j] || gpSendSlot[j].fd != fd)
+			{
+				continue;
+			}
+
+			iov[msgNum].iov_base = gpSendSlot[j].buf;
+			iov[msgNum].iov_len = gpSendSlot[j].len;
+			memset(&msg[msgNum].msg_hdr, 0, sizeof(msg[msgNum].msg_hdr));
+			msg[msgNum].msg_hdr.msg_iov = &iov[msgNum];
+			msg[msgNum].msg_hdr.msg_iovlen = 1;
+			msgNum++;
+			isSent[j] = true;
+		}
+
+		//the socket is connected, no destination address is needed
+		int sentNum = 0;
+		while(sentNum < msgNum)
+		{
+			int n = sendmmsg(fd, &msg[sentNum], msgNum - sentNum, MSG_DONTWAIT);
+			gIoStats.sendCallNum++;
+			if(n <= 0)
+			{
+				logError("fails to sendmmsg, fd=%d, errno=%d, %d messages dropped.", fd, errno, msgNum - sentNum);
+				break;
+			}
+			sentNum += n;
+		}
+
+		mdebug(LM_DNS, "%d messages are sent on fd(%d) in batch.", sentNum, fd);
+	}
+
+	gSendNum = 0;
+}
+
+
+static void dnsUdpPool_onUringRecv(int fd, osMBuf_t* pBuf)
+{
+	gIoStats.recvNum++;
+	gRecvCallback(fd, pBuf);
+}
+
+
+static void dns_onUdpFlushTimeout(uint64_t timerId, void* ptr)
+{
+	if(gFlushTimerId != timerId)
+	{
+		logError("gFlushTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", gFlushTimerId, timerId);
+		return;
+	}
+	gFlushTimerId = 0;
+
+	dnsUdpPool_flush();
+}
+
+
+static void dns_onUdpFdCloseTimeout(void* ptr)
+{
+	if(!ptr)
+	{
+		logError("null pointer, ptr.");
+		return;
+	}
+
+	dnsUdpRetiredFdInfo_t* pRetiredFd = ptr;
+
+	debug("close the retired fd(%d).", pRetiredFd->fd);
+	dnsUdpPool_closeFd(pRetiredFd->fd, pRetiredFd->isUringArmed, pRetiredFd->isTpRegistered);
+
+	osfree(pRetiredFd);
+}
@@ -0,0 +1,443 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * an optional io_uring engine for the udp sockets of the resolver, only built when DNS_IO_URING is defined, see
+ * the Makefile.  Each pooled socket has a multishot receive armed, the responses land in a per thread provided
+ * buffer ring, and the sends of one event loop iteration are submitted with one io_uring_submit().  The event
+ * loop belongs to the os library, so the completions are peeked after each submit, and the ring signals an eventfd,
+ * see io_uring_register_eventfd(), that is in the epoll set of the thread while there are queries pending, see
+ * dnsEvent.c.  Peeking the completion queue is not a syscall.
+ * If the library is not built with DNS_IO_URING, or the kernel does not support the provided buffer ring or the
+ * multishot receive, dnsUring_isActive() returns false, and the queries go through the tp.
+ */
+
+
+#include <string.h>
+#include <errno.h>
+
+#include "osMemory.h"
+#include "osMBuf.h"
+#include "osDebug.h"
+#include "osTimer.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsConfig.h"
+#include "dnsEvent.h"
+#include "dnsUdpPool.h"
+#include "dnsUring.h"
+
+
+#ifdef DNS_IO_URING
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <liburing.h>
+
+
+static __thread struct io_uring gRing;
+static __thread bool gIsRingInit;
+static __thread bool gIsActive;
+static __thread struct io_uring_buf_ring* gpBufRing;
+static __thread uint8_t* gpRecvBuf;						//DNS_URING_RECV_BUF_NUM buffers of DNS_UDP_RECV_BUF_SIZE
+static __thread dnsUdpSendSlot_t* gpSendSlot;				//DNS_URING_SEND_SLOT_NUM slots
+static __thread uint16_t gFreeSendSlot[DNS_URING_SEND_SLOT_NUM];
+static __thread uint32_t gFreeSendSlotNum;
+static __thread uint32_t gUnsubmittedNum;
+static __thread uint64_t gSubmitNum;
+static __thread uint64_t gSubmitTimerId;
+static __thread int gEventFd = -1;						//signaled by the ring when a completion is posted
+static __thread dnsEventHandler_t gEventHandler;			//gEventHandler.fd >= 0 when gEventFd is in the epoll set
+static __thread dnsUdpPool_recvCallback_h gRecvCallback;
+
+static struct io_uring_sqe* dnsUring_getSqe();
+static void dnsUring_schedSubmit();
+static void dnsUring_submit();
+static void dnsUring_reap();
+static void dnsUring_watch();
+static void dnsUring_onRecv(int fd, struct io_uring_cqe* pCqe);
+static inline uint64_t dnsUring_userData(dnsUringOp_e op, uint32_t value);
+static void dns_onUringSubmitTimeout(uint64_t timerId, void* ptr);
+static void dns_onUringEvent(int fd, uint32_t events, void* pData);
+
+
+
+bool dnsUring_init(dnsUdpPool_recvCallback_h recvCallback)
+{
+	gpRecvBuf = osmalloc(DNS_UDP_RECV_BUF_SIZE * DNS_URING_RECV_BUF_NUM, NULL);
+	gpSendSlot = osmalloc(sizeof(dnsUdpSendSlot_t) * DNS_URING_SEND_SLOT_NUM, NULL);
+	if(!gpRecvBuf || !gpSendSlot)
+	{
+		logError("fails to allocate the io_uring buffers.");
+		goto EXIT;
+	}
+
+	int ret = io_uring_queue_init(DNS_URING_QUEUE_DEPTH, &gRing, 0);
+	if(ret < 0)
+	{
+		logInfo("fails to io_uring_queue_init, ret=%d, fall back to the tp.", ret);
+		goto EXIT;
+	}
+	gIsRingInit = true;
+
+	gEventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(gEventFd < 0)
+	{
+		logError("fails to create the eventfd of the ring, errno=%d, fall back to the tp.", errno);
+		goto EXIT;
+	}
+
+	ret = io_uring_register_eventfd(&gRing, gEventFd);
+	if(ret < 0)
+	{
+		logInfo("fails to io_uring_register_eventfd, ret=%d, fall back to the tp.", ret);
+		goto EXIT;
+	}
+
+	gEventHandler.fd = -1;
+	gEventHandler.callback = dns_onUringEvent;
+	gEventHandler.pData = NULL;
+
+	//the provided buffer ring needs linux 5.19
+	gpBufRing = io_uring_setup_buf_ring(&gRing, DNS_URING_RECV_BUF_NUM, DNS_URING_BUF_GROUP_ID, 0, &ret);
+	if(!gpBufRing)
+	{
+		logInfo("fails to io_uring_setup_buf_ring, ret=%d, fall back to the tp.", ret);
+		goto EXIT;
+	}
+
+	for(int i=0; i<DNS_URING_RECV_BUF_NUM; i++)
+	{
+		io_uring_buf_ring_add(gpBufRing, &gpRecvBuf[i * DNS_UDP_RECV_BUF_SIZE], DNS_UDP_RECV_BUF_SIZE, i, io_uring_buf_ring_mask(DNS_URING_RECV_BUF_NUM), i);
+	}
+	io_uring_buf_ring_advance(gpBufRing, DNS_URING_RECV_BUF_NUM);
+
+	for(int i=0; i<DNS_URING_SEND_SLOT_NUM; i++)
+	{
+		gFreeSendSlot[i] = i;
+	}
+	gFreeSendSlotNum = DNS_URING_SEND_SLOT_NUM;
+
+	gRecvCallback = recvCallback;
+	gIsActive = true;
+
+EXIT:
+	if(!gIsActive)
+	{
+		if(gpBufRing)
+		{
+			io_uring_free_buf_ring(&gRing, gpBufRing, DNS_URING_RECV_BUF_NUM, DNS_URING_BUF_GROUP_ID);
+			gpBufRing = NULL;
+		}
+		if(gIsRingInit)
+		{
+			io_uring_queue_exit(&gRing);
+			gIsRingInit = false;
+		}
+		if(gEventFd >= 0)
+		{
+			close(gEventFd);
+			gEventFd = -1;
+		}
+		gpRecvBuf = osfree(gpRecvBuf);
+		gpSendSlot = osfree(gpSendSlot);
+	}
+
+	return gIsActive;
+}
+
+
+bool dnsUring_isActive()
+{
+	return gIsActive;
+}
+
+
+osStatus_e dnsUring_addFd(int fd)
+{
+	struct io_uring_sqe* pSqe = dnsUring_getSqe();
+	if(!pSqe)
+	{
+		logError("no sqe is available to receive on fd(%d).", fd);
+		return OS_ERROR_SYSTEM_FAILURE;
+	}
+
+	//the multishot receive needs linux 6.0, if it is not supported, the completion fails with -EINVAL, see dnsUring_onRecv()
+	io_uring_prep_recv_multishot(pSqe, fd, NULL, 0, 0);
+	pSqe->flags |= IOSQE_BUFFER_SELECT;
+	pSqe->buf_group = DNS_URING_BUF_GROUP_ID;
+	io_uring_sqe_set_data64(pSqe, dnsUring_userData(DNS_URING_OP_RECV, fd));
+
+	dnsUring_schedSubmit();
+	return OS_STATUS_OK;
+}
+
+
+void dnsUring_removeFd(int fd)
+{
+	struct io_uring_sqe* pSqe = dnsUring_getSqe();
+	if(!pSqe)
+	{
+		logError("no sqe is available to cancel the receive on fd(%d), the socket is not released until the ring exits.", fd);
+		return;
+	}
+
+	io_uring_prep_cancel_fd(pSqe, fd, 0);
+	io_uring_sqe_set_data64(pSqe, dnsUring_userData(DNS_URING_OP_CANCEL, fd));
+
+	//the cancel looks up the fd, it has to be submitted before the fd is closed
+	gUnsubmittedNum++;
+	dnsUring_submit();
+}
+
+
+osStatus_e dnsUring_send(int fd, osMBuf_t* pBuf)
+{
+	//the completions are not reaped here, as dnsUring_send() may be called from the recvCallback during a reap
+	if(!gFreeSendSlotNum)
+	{
+		logError("all %d send slots are in use, drop the message to fd(%d).", DNS_URING_SEND_SLOT_NUM, fd);
+		return OS_ERROR_NETWORK_FAILURE;
+	}
+
+	struct io_uring_sqe* pSqe = dnsUring_getSqe();
+	if(!pSqe)
+	{
+		logError("no sqe is available to send on fd(%d).", fd);
+		return OS_ERROR_NETWORK_FAILURE;
+	}
+
+	uint16_t slot = gFreeSendSlot[--gFreeSendSlotNum];
+	gpSendSlot[slot].fd = fd;
+	gpSendSlot[slot].len = pBuf->pos;
+	memcpy(gpSendSlot[slot].buf, pBuf->buf, pBuf->pos);
+
+	//the socket is connected, no destination address is needed
+	io_uring_prep_send(pSqe, fd, gpSendSlot[slot].buf, gpSendSlot[slot].len, 0);
+	io_uring_sqe_set_data64(pSqe, dnsUring_userData(DNS_URING_OP_SEND, slot));
+
+	dnsUring_schedSubmit();
+	return OS_STATUS_OK;
+}
+
+
+uint64_t dnsUring_getSubmitNum()
+{
+	return gSubmitNum;
+}
+
+
+static struct io_uring_sqe* dnsUring_getSqe()
+{
+	struct io_uring_sqe* pSqe = io_uring_get_sqe(&gRing);
+	if(!pSqe)
+	{
+		//the submission queue is full, submit what has been queued
+		dnsUring_submit();
+		pSqe = io_uring_get_sqe(&gRing);
+	}
+
+	return pSqe;
+}
+
+
+//submits in the next event loop iteration, after all sqe of this iteration have been queued
+static void dnsUring_schedSubmit()
+{
+	gUnsubmittedNum++;
+	if(!gSubmitTimerId)
+	{
+		gSubmitTimerId = osStartTimer(0, dns_onUringSubmitTimeout, NULL);
+	}
+}
+
+
+static void dnsUring_submit()
+{
+	if(!gUnsubmittedNum)
+	{
+		return;
+	}
+
+	int ret = io_uring_submit(&gRing);
+	gSubmitNum++;
+	if(ret < 0)
+	{
+		logError("fails to io_uring_submit, ret=%d, %d sqe are dropped.", ret, gUnsubmittedNum);
+	}
+	gUnsubmittedNum = 0;
+
+	//watch the completions while there are queries waiting for response
+	if(gEventHandler.fd < 0 && dnsUdpPool_getPendingNum())
+	{
+		dnsUring_watch();
+	}
+}
+
+
+//gEventFd is only in the epoll set while there are queries pending, so that the epoll fd is not polled for nothing
+//when the app does not watch it, see dnsEvent.c.  A completion posted while it is out of the set is reaped once it
+//is added again, as the eventfd stays readable
+static void dnsUring_watch()
+{
+	gEventHandler.fd = gEventFd;
+	if(dnsEvent_add(&gEventHandler, EPOLLIN) != OS_STATUS_OK)
+	{
+		//the completions are then only reaped after the submits, the queries that miss them time out
+		logError("fails to dnsEvent_add for the eventfd of the ring.");
+		gEventHandler.fd = -1;
+	}
+}
+
+
+static void dnsUring_reap()
+{
+	struct io_uring_cqe* pCqe[DNS_URING_QUEUE_DEPTH];
+	unsigned cqeNum;
+	while((cqeNum = io_uring_peek_batch_cqe(&gRing, pCqe, DNS_URING_QUEUE_DEPTH)) > 0)
+	{
+		for(int i=0; i<cqeNum; i++)
+		{
+			uint64_t userData = io_uring_cqe_get_data64(pCqe[i]);
+			uint32_t value = (uint32_t)userData;
+			switch(userData >> 32)
+			{
+				case DNS_URING_OP_RECV:
+					dnsUring_onRecv(value, pCqe[i]);
+					break;
+				case DNS_URING_OP_SEND:
+					//a message that fails to be sent is dropped, its query times out and is retried
+					if(pCqe[i]->res < 0)
+					{
+						logError("fails to send on fd(%d), res=%d.", gpSendSlot[value].fd, pCqe[i]->res);
+					}
+					gFreeSendSlot[gFreeSendSlotNum++] = value;
+					break;
+				default:
+					break;
+			}
+		}
+
+		io_uring_cq_advance(&gRing, cqeNum);
+	}
+}
+
+
+static void dnsUring_onRecv(int fd, struct io_uring_cqe* pCqe)
+{
+	if(pCqe->flags & IORING_CQE_F_BUFFER)
+	{
+		uint16_t bufId = pCqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		if(pCqe->res > 0)
+		{
+			osMBuf_t mBuf = {.buf = &gpRecvBuf[bufId * DNS_UDP_RECV_BUF_SIZE], .size = pCqe->res, .end = pCqe->res, .pos = 0};
+			gRecvCallback(fd, &mBuf);
+		}
+
+		//give the buffer back to the ring
+		io_uring_buf_ring_add(gpBufRing, &gpRecvBuf[bufId * DNS_UDP_RECV_BUF_SIZE], DNS_UDP_RECV_BUF_SIZE, bufId, io_uring_buf_ring_mask(DNS_URING_RECV_BUF_NUM), 0);
+		io_uring_buf_ring_advance(gpBufRing, 1);
+	}
+
+	if(pCqe->flags & IORING_CQE_F_MORE)
+	{
+		return;
+	}
+
+	//the multishot receive has terminated
+	switch(pCqe->res)
+	{
+		case -ECANCELED:
+			//by dnsUring_removeFd()
+			break;
+		case -EINVAL:
+			//the sockets that have been armed are sent through the tp from now on, see dnsUdpPool_send()
+			logError("the multishot receive is not supported, fall back to the tp.");
+			gIsActive = false;
+			break;
+		default:
+			//-ENOBUFS when all buffers are in use, the receive shall be armed again
+			debug("the receive on fd(%d) terminated, res=%d, arm it again.", fd, pCqe->res);
+			dnsUring_addFd(fd);
+			break;
+	}
+}
+
+
+static inline uint64_t dnsUring_userData(dnsUringOp_e op, uint32_t value)
+{
+	return ((uint64_t)op << 32) | value;
+}
+
+
+static void dns_onUringSubmitTimeout(uint64_t timerId, void* ptr)
+{
+	if(gSubmitTimerId != timerId)
+	{
+		logError("gSubmitTimerId(0x%lx) does not match with timerId(0x%lx), unexpected.", gSubmitTimerId, timerId);
+		return;
+	}
+	gSubmitTimerId = 0;
+
+	dnsUring_submit();
+	dnsUring_reap();
+}
+
+
+static void dns_onUringEvent(int fd, uint32_t events, void* pData)
+{
+	//read before the reap, a completion posted after the reap signals the eventfd again
+	uint64_t value;
+	if(read(fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+	{
+		logError("fails to read the eventfd(%d) of the ring, errno=%d.", fd, errno);
+	}
+
+	dnsUring_reap();
+
+	if(!dnsUdpPool_getPendingNum())
+	{
+		dnsEvent_remove(&gEventHandler);
+	}
+}
+
+
+#else	//DNS_IO_URING
+
+
+bool dnsUring_init(dnsUdpPool_recvCallback_h recvCallback)
+{
+	return false;
+}
+
+
+bool dnsUring_isActive()
+{
+	return false;
+}
+
+
+osStatus_e dnsUring_addFd(int fd)
+{
+	return OS_ERROR_SYSTEM_FAILURE;
+}
+
+
+void dnsUring_removeFd(int fd)
+{
+	return;
+}
+
+
+osStatus_e dnsUring_send(int fd, osMBuf_t* pBuf)
+{
+	return OS_ERROR_SYSTEM_FAILURE;
+}
+
+
+uint64_t dnsUring_getSubmitNum()
+{
+	return 0;
+}
+
+
+#endif	//DNS_IO_URING
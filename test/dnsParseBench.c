@@ -0,0 +1,167 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * microbenchmark of the response parser.  Each response given is parsed DNS_BENCH_LOOP_NUM times, then parsed and
+ * fully read, i.e., every section is decoded and every name is decoded, the same number of times.  The wall time,
+ * and the allocations and the parse time from dnsResolver_getParseStats(), are printed per response.  The name
+ * decoder is also timed on its own, build with make DNS_AVX2=true to compare the AVX2 and the SSE2 label copy.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "osMBuf.h"
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsName.h"
+
+
+#define DNS_BENCH_LOOP_NUM		1000000
+#define DNS_BENCH_MAX_INPUT_SIZE	65535
+
+
+static uint64_t dnsBench_getTime();
+static uint64_t dnsBench_readAll(dnsMessage_t* pDnsMsg);
+static void dnsBench_run(const char* fileName, uint8_t* data, size_t size);
+
+
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		printf("usage: %s corpus/*.bin\n", argv[0]);
+		return 1;
+	}
+
+	printf("%-28s %10s %10s %10s %10s %12s %12s\n", "response", "rr", "ns/parse", "ns/read", "alloc/msg", "alloc/answer", "ns/name");
+	uint8_t* data = malloc(DNS_BENCH_MAX_INPUT_SIZE);
+	for(int i=1; i<argc; i++)
+	{
+		FILE* fp = fopen(argv[i], "rb");
+		if(!fp)
+		{
+			printf("fails to open %s\n", argv[i]);
+			return 1;
+		}
+		size_t size = fread(data, 1, DNS_BENCH_MAX_INPUT_SIZE, fp);
+		fclose(fp);
+
+		dnsBench_run(argv[i], data, size);
+	}
+
+	free(data);
+	return 0;
+}
+
+
+static void dnsBench_run(const char* fileName, uint8_t* data, size_t size)
+{
+	const char* baseName = strrchr(fileName, '/') ? strrchr(fileName, '/') + 1 : fileName;
+	osMBuf_t mBuf = {.buf = data, .size = size, .end = size, .pos = 0};
+	dnsRcode_e replyCode;
+
+	//the malformed responses of the corpus are skipped
+	dnsMessage_t* pDnsMsg = dnsMessage_parse(&mBuf, NULL, &replyCode);
+	if(!pDnsMsg)
+	{
+		printf("%-28s fails to parse, skip\n", baseName);
+		return;
+	}
+	uint32_t rrNum = pDnsMsg->hdr.anCount + pDnsMsg->hdr.nsCount + pDnsMsg->hdr.arCount;
+	uint32_t answerNum = pDnsMsg->hdr.anCount;
+	dnsMessage_free(pDnsMsg);
+
+	//the header and the question are parsed, the rr are only indexed
+	dnsParseStats_t startStats, endStats;
+	dnsResolver_getParseStats(&startStats);
+	uint64_t startTime = dnsBench_getTime();
+	for(int i=0; i<DNS_BENCH_LOOP_NUM; i++)
+	{
+		mBuf.pos = 0;
+		dnsMessage_free(dnsMessage_parse(&mBuf, NULL, &replyCode));
+	}
+	uint64_t parseTime = dnsBench_getTime() - startTime;
+	dnsResolver_getParseStats(&endStats);
+
+	//what a resolver pays when the app reads every rr
+	uint64_t sum = 0;
+	startTime = dnsBench_getTime();
+	for(int i=0; i<DNS_BENCH_LOOP_NUM; i++)
+	{
+		mBuf.pos = 0;
+		pDnsMsg = dnsMessage_parse(&mBuf, NULL, &replyCode);
+		sum += dnsBench_readAll(pDnsMsg);
+		dnsMessage_free(pDnsMsg);
+	}
+	uint64_t readTime = dnsBench_getTime() - startTime;
+
+	//the question name, at the same place in every response
+	char name[DNS_MAX_NAME_SIZE];
+	startTime = dnsBench_getTime();
+	for(int i=0; i<DNS_BENCH_LOOP_NUM; i++)
+	{
+		size_t pos = sizeof(dnsHdr_t);
+		size_t nameLen = 0;
+		dnsName_decode(data, size, &pos, name, &nameLen);
+		sum += nameLen;
+	}
+	uint64_t nameTime = dnsBench_getTime() - startTime;
+
+	uint64_t msgNum = endStats.msgNum - startStats.msgNum;
+	uint64_t allocNum = endStats.allocNum - startStats.allocNum;
+	printf("%-28s %10d %10.1f %10.1f %10.2f %12.2f %12.1f\n", baseName, rrNum, (double)parseTime / DNS_BENCH_LOOP_NUM, (double)readTime / DNS_BENCH_LOOP_NUM,
+		msgNum ? (double)allocNum / msgNum : 0, answerNum && msgNum ? (double)allocNum / msgNum / answerNum : 0, (double)nameTime / DNS_BENCH_LOOP_NUM);
+
+	//keeps the compiler from dropping the loops
+	if(sum == 0x5a5a5a5a5a5a5a5a)
+	{
+		printf("\n");
+	}
+}
+
+
+static uint64_t dnsBench_readAll(dnsMessage_t* pDnsMsg)
+{
+	uint64_t sum = 0;
+	char name[DNS_MAX_NAME_SIZE];
+
+	for(int i=0; i<DNS_SECTION_NUM; i++)
+	{
+		dnsRR_t* pRR = NULL;
+		uint16_t rrNum = dnsMessage_getSection(pDnsMsg, i, &pRR);
+		for(int j=0; j<rrNum; j++)
+		{
+			sum += dnsRR_getName(pDnsMsg, &pRR[j], name).l;
+			switch(pRR[j].type)
+			{
+				case DNS_QTYPE_SRV:
+					sum += dnsRR_getSrvTarget(pDnsMsg, &pRR[j], name).l;
+					break;
+				case DNS_QTYPE_NAPTR:
+					sum += dnsRR_getNaptrReplacement(pDnsMsg, &pRR[j], name).l;
+					sum += dnsRR_getNaptrService(pDnsMsg, &pRR[j]).l;
+					break;
+				case DNS_QTYPE_A:
+					sum += pRR[j].ipAddr.s_addr;
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	return sum;
+}
+
+
+static uint64_t dnsBench_getTime()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}
@@ -0,0 +1,185 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * fuzz harness of the response parser, dnsMessage.c and dnsName.c.  Each input is parsed as a response, every
+ * section is decoded, and every name, string and rdata view of every rr is read, so that a malformed response that
+ * makes the parser read past the wire is caught by ASan.
+ * make fuzz CC=clang builds it with libFuzzer, LLVMFuzzerTestOneInput() is then driven by libFuzzer, with corpus/ as
+ * the seeds.  make builds it with a main() of its own, that runs each file given, then DNS_FUZZ_MUTATION_NUM random
+ * mutations of each, so that the corpus is replayed under ASan without libFuzzer.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osMBuf.h"
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsName.h"
+
+
+#define DNS_FUZZ_MUTATION_NUM	100000		//per corpus file, without libFuzzer
+#define DNS_FUZZ_MAX_INPUT_SIZE	65535		//the largest response over tcp
+
+
+static void dnsFuzz_readRR(dnsMessage_t* pDnsMsg, dnsRR_t* pRR);
+static void dnsFuzz_readName(const uint8_t* data, size_t size);
+
+
+
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+	if(size > DNS_FUZZ_MAX_INPUT_SIZE)
+	{
+		return 0;
+	}
+
+	dnsFuzz_readName(data, size);
+
+	//the parser reads pBuf->buf, it is not modified
+	osMBuf_t mBuf = {.buf = (uint8_t*)data, .size = size, .end = size, .pos = 0};
+	dnsRcode_e replyCode;
+	dnsMessage_t* pDnsMsg = dnsMessage_parse(&mBuf, NULL, &replyCode);
+	if(!pDnsMsg)
+	{
+		return 0;
+	}
+
+	for(int i=0; i<DNS_SECTION_NUM; i++)
+	{
+		dnsRR_t* pRR = NULL;
+		uint16_t rrNum = dnsMessage_getSection(pDnsMsg, i, &pRR);
+		for(int j=0; j<rrNum; j++)
+		{
+			dnsFuzz_readRR(pDnsMsg, &pRR[j]);
+		}
+	}
+
+	dnsMessage_free(pDnsMsg);
+	return 0;
+}
+
+
+//every view is read to its end, ASan reports it if it goes past the wire
+static void dnsFuzz_readRR(dnsMessage_t* pDnsMsg, dnsRR_t* pRR)
+{
+	char name[DNS_MAX_NAME_SIZE];
+	volatile uint8_t sum = 0;
+
+	osPointerLen_t pl = dnsRR_getName(pDnsMsg, pRR, name);
+	osPointerLen_t qName = {pDnsMsg->query.qName, strlen(pDnsMsg->query.qName)};
+	sum += dnsMessage_isNameEqual(pDnsMsg, pRR->nameOff, &qName) + pl.l;
+
+	switch(pRR->type)
+	{
+		case DNS_QTYPE_SRV:
+			pl = dnsRR_getSrvTarget(pDnsMsg, pRR, name);
+			sum += dnsMessage_isNameEqual(pDnsMsg, pRR->srv.targetOff, &qName) + pl.l;
+			break;
+		case DNS_QTYPE_NAPTR:
+			pl = dnsRR_getNaptrReplacement(pDnsMsg, pRR, name);
+			sum += pl.l;
+			pl = dnsRR_getNaptrService(pDnsMsg, pRR);
+			for(size_t i=0; i<pl.l; i++)
+			{
+				sum += pl.p[i];
+			}
+			pl = dnsRR_getNaptrRegexp(pDnsMsg, pRR);
+			for(size_t i=0; i<pl.l; i++)
+			{
+				sum += pl.p[i];
+			}
+			break;
+		case DNS_QTYPE_A:
+		case DNS_QTYPE_SOA:
+		case DNS_QTYPE_OPT:
+			break;
+		default:
+			pl = dnsRR_getRData(pDnsMsg, pRR);
+			for(size_t i=0; i<pl.l; i++)
+			{
+				sum += pl.p[i];
+			}
+			break;
+	}
+}
+
+
+//the decoder is also run from every position of the input, not only where the parser expects a name
+static void dnsFuzz_readName(const uint8_t* data, size_t size)
+{
+	char name[DNS_MAX_NAME_SIZE];
+	osPointerLen_t pName = {"example.com", sizeof("example.com")-1};
+
+	for(size_t i=0; i<size && i<DNS_MAX_MSG_SIZE; i++)
+	{
+		size_t pos = i;
+		dnsName_decode(data, size, &pos, NULL, NULL);
+		pos = i;
+		dnsName_decode(data, size, &pos, name, NULL);
+		dnsName_isEqual(data, size, i, &pName);
+	}
+}
+
+
+#ifndef DNS_LIBFUZZER
+
+//a copy of exactly size bytes, so that a read past the input is a heap overflow for ASan
+static void dnsFuzz_run(const uint8_t* data, size_t size)
+{
+	uint8_t* input = malloc(size ? size : 1);
+	memcpy(input, data, size);
+	LLVMFuzzerTestOneInput(input, size);
+	free(input);
+}
+
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		printf("usage: %s corpus/*.bin\n", argv[0]);
+		return 1;
+	}
+
+	srand(1);
+	uint8_t* data = malloc(DNS_FUZZ_MAX_INPUT_SIZE);
+	uint8_t* mutation = malloc(DNS_FUZZ_MAX_INPUT_SIZE);
+	for(int i=1; i<argc; i++)
+	{
+		FILE* fp = fopen(argv[i], "rb");
+		if(!fp)
+		{
+			printf("fails to open %s\n", argv[i]);
+			return 1;
+		}
+		size_t size = fread(data, 1, DNS_FUZZ_MAX_INPUT_SIZE, fp);
+		fclose(fp);
+
+		dnsFuzz_run(data, size);
+
+		//flip bytes, with a bias to the values that are special in the wire, and cut the tail
+		for(int j=0; j<DNS_FUZZ_MUTATION_NUM && size; j++)
+		{
+			memcpy(mutation, data, size);
+			int flipNum = 1 + rand() % 4;
+			for(int k=0; k<flipNum; k++)
+			{
+				static const uint8_t special[] = {0x00, 0x01, 0x3f, 0x40, 0x80, 0xc0, 0xff};
+				mutation[rand() % size] = rand() % 2 ? special[rand() % sizeof(special)] : rand();
+			}
+			dnsFuzz_run(mutation, rand() % 4 ? size : rand() % size);
+		}
+
+		printf("%s: %ld bytes, %d mutations\n", argv[i], size, DNS_FUZZ_MUTATION_NUM);
+	}
+
+	free(data);
+	free(mutation);
+	return 0;
+}
+
+#endif
@@ -0,0 +1,463 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * test of the next layer queries of dnsQuery() with isResolveAll, dnsRecurQuery.c.  dnsQueryInternal() is replaced
+ * by a fake that answers each qName the way the test case wants, from the rr cache, from a query still ongoing, or
+ * as a cached NXDOMAIN, so that no dns server is needed.  The responses are built in the wire format and parsed by
+ * dnsMessage_parse().  Build it with ASan, a response that is freed or a callback data that is used after the app is
+ * notified is then reported.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "osMemory.h"
+#include "osMBuf.h"
+#include "osList.h"
+#include "osPL.h"
+
+#include "dnsResolverIntf.h"
+#include "dnsResolver.h"
+#include "dnsRecurQuery.h"
+#include "dnsService.h"
+
+
+#define DNS_TEST_MAX_WIRE_SIZE	512
+#define DNS_TEST_MAX_NAME_NUM	4
+
+
+typedef enum {
+	DNS_TEST_ANSWER_MSG,			//from the rr cache
+	DNS_TEST_ANSWER_ONGOING,		//a query is sent, dnsInternalCallback() is called by the test later
+	DNS_TEST_ANSWER_NXDOMAIN,		//a cached NXDOMAIN
+} dnsTestAnswer_e;
+
+
+typedef struct {
+	const char* qName;
+	dnsTestAnswer_e answer;
+	dnsMessage_t* pDnsMsg;			//for DNS_TEST_ANSWER_MSG
+	void* pData;					//the pData dnsQueryInternal() is called with, for DNS_TEST_ANSWER_ONGOING
+} dnsTestName_t;
+
+
+typedef struct {
+	uint8_t wire[DNS_TEST_MAX_WIRE_SIZE];
+	size_t len;
+} dnsTestWire_t;
+
+
+static dnsTestName_t gTestName[DNS_TEST_MAX_NAME_NUM];
+static int gTestNameNum;
+static dnsQCacheInfo_t gTestQCache;
+static int gAppCallbackNum;
+static dnsResResponse_t* gpAppResponse;
+
+static void dnsTest_addU16(dnsTestWire_t* pWire, uint16_t value);
+static void dnsTest_addName(dnsTestWire_t* pWire, const char* name);
+static void dnsTest_addHdr(dnsTestWire_t* pWire, uint16_t flags, uint16_t anCount, uint16_t arCount, const char* qName, dnsQType_e qType);
+static void dnsTest_addRR(dnsTestWire_t* pWire, const char* name, dnsQType_e type, const uint8_t* rdata, uint16_t rdLen);
+static dnsMessage_t* dnsTest_parse(dnsTestWire_t* pWire);
+static dnsMessage_t* dnsTest_buildNaptr(const char* qName, const char* srvName1, const char* srvName2);
+static dnsMessage_t* dnsTest_buildSrv(const char* qName, const char* target);
+static void dnsTest_setName(const char* qName, dnsTestAnswer_e answer, dnsMessage_t* pDnsMsg);
+static dnsTestName_t* dnsTest_getName(const char* qName);
+static void dnsTest_respond(const char* qName, dnsResResponse_t* pRR);
+static void dnsTest_appCallback(dnsResResponse_t* pRR, void* pData);
+static int dnsTest_getMsgNum(dnsResResponse_t* pRR);
+static bool dnsTest_naptrCachedNxdomain();
+static bool dnsTest_naptrLiveNxdomain();
+static bool dnsTest_naptrLongTarget();
+
+
+
+int main(int argc, char* argv[])
+{
+	int failNum = 0;
+
+	if(!dnsTest_naptrCachedNxdomain())
+	{
+		failNum++;
+	}
+
+	if(!dnsTest_naptrLiveNxdomain())
+	{
+		failNum++;
+	}
+
+	if(!dnsTest_naptrLongTarget())
+	{
+		failNum++;
+	}
+
+	printf("%s\n", failNum ? "FAILED" : "PASSED");
+	return failNum ? 1 : 0;
+}
+
+
+/* a NAPTR whose first target is in flight and whose second target is a cached NXDOMAIN.  The second target is skipped,
+ * the app is notified once, when the first target's SRV comes, with the NAPTR and the SRV
+ */
+static bool dnsTest_naptrCachedNxdomain()
+{
+	bool isPass = false;
+
+	gTestNameNum = 0;
+	gAppCallbackNum = 0;
+	dnsTest_setName("example.com", DNS_TEST_ANSWER_MSG, dnsTest_buildNaptr("example.com", "_sip._udp.example.com", "_sip._tcp.example.com"));
+	dnsTest_setName("_sip._udp.example.com", DNS_TEST_ANSWER_ONGOING, NULL);
+	dnsTest_setName("_sip._tcp.example.com", DNS_TEST_ANSWER_NXDOMAIN, NULL);
+
+	osPointerLen_t qName = {"example.com", sizeof("example.com")-1};
+	dnsResResponse_t* pResResponse = NULL;
+	dnsQueryStatus_e qStatus = dnsQuery(&qName, DNS_QTYPE_NAPTR, true, true, &pResResponse, dnsTest_appCallback, NULL);
+	if(qStatus != DNS_QUERY_STATUS_ONGOING || pResResponse || gAppCallbackNum)
+	{
+		printf("%s: qStatus=%d, pResResponse=%p, gAppCallbackNum=%d, expect an ongoing query.\n", __func__, qStatus, pResResponse, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	dnsResResponse_t rr = {.rrType = DNS_RR_DATA_TYPE_MSG, .pDnsRsp = dnsTest_buildSrv("_sip._udp.example.com", "sip1.example.com")};
+	dnsTest_respond("_sip._udp.example.com", &rr);
+	if(gAppCallbackNum != 1 || gpAppResponse->rrType != DNS_RR_DATA_TYPE_MSGLIST || dnsTest_getMsgNum(gpAppResponse) != 2)
+	{
+		printf("%s: gAppCallbackNum=%d, expect the app is notified once with the NAPTR and the SRV.\n", __func__, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	isPass = true;
+
+EXIT:
+	printf("%s: %s\n", __func__, isPass ? "passed" : "failed");
+	gpAppResponse = osfree(gpAppResponse);
+	return isPass;
+}
+
+
+//both targets are in flight, the second one gets a NXDOMAIN from the dns server first, it is skipped the same as a cached one
+static bool dnsTest_naptrLiveNxdomain()
+{
+	bool isPass = false;
+
+	gTestNameNum = 0;
+	gAppCallbackNum = 0;
+	dnsTest_setName("example.com", DNS_TEST_ANSWER_MSG, dnsTest_buildNaptr("example.com", "_sip._udp.example.com", "_sip._tcp.example.com"));
+	dnsTest_setName("_sip._udp.example.com", DNS_TEST_ANSWER_ONGOING, NULL);
+	dnsTest_setName("_sip._tcp.example.com", DNS_TEST_ANSWER_ONGOING, NULL);
+
+	osPointerLen_t qName = {"example.com", sizeof("example.com")-1};
+	dnsResResponse_t* pResResponse = NULL;
+	dnsQueryStatus_e qStatus = dnsQuery(&qName, DNS_QTYPE_NAPTR, true, true, &pResResponse, dnsTest_appCallback, NULL);
+	if(qStatus != DNS_QUERY_STATUS_ONGOING || pResResponse || gAppCallbackNum)
+	{
+		printf("%s: qStatus=%d, pResResponse=%p, gAppCallbackNum=%d, expect an ongoing query.\n", __func__, qStatus, pResResponse, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	osPointerLen_t tcpName = {"_sip._tcp.example.com", sizeof("_sip._tcp.example.com")-1};
+	dnsResResponse_t statusRR = {.rrType = DNS_RR_DATA_TYPE_STATUS, .status = {&tcpName, DNS_RES_STATUS_OK, DNS_RCODE_NAME_ERROR}};
+	dnsTest_respond("_sip._tcp.example.com", &statusRR);
+	if(gAppCallbackNum)
+	{
+		printf("%s: gAppCallbackNum=%d, expect the app is not notified while the first target is in flight.\n", __func__, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	dnsResResponse_t rr = {.rrType = DNS_RR_DATA_TYPE_MSG, .pDnsRsp = dnsTest_buildSrv("_sip._udp.example.com", "sip1.example.com")};
+	dnsTest_respond("_sip._udp.example.com", &rr);
+	if(gAppCallbackNum != 1 || gpAppResponse->rrType != DNS_RR_DATA_TYPE_MSGLIST || dnsTest_getMsgNum(gpAppResponse) != 2)
+	{
+		printf("%s: gAppCallbackNum=%d, expect the app is notified once with the NAPTR and the SRV.\n", __func__, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	isPass = true;
+
+EXIT:
+	printf("%s: %s\n", __func__, isPass ? "passed" : "failed");
+	gpAppResponse = osfree(gpAppResponse);
+	return isPass;
+}
+
+
+//a NAPTR target longer than 125 octets is queried by its name, not as <Root>
+static bool dnsTest_naptrLongTarget()
+{
+	bool isPass = false;
+
+	//3 labels of 60 octets, 204 octets in all
+	static char longName[256];
+	char label[61];
+	memset(label, 'a', 60);
+	label[60] = 0;
+	snprintf(longName, sizeof(longName), "%s.%s.%s._sip._udp.example.com", label, label, label);
+
+	gTestNameNum = 0;
+	gAppCallbackNum = 0;
+	dnsTest_setName("example.com", DNS_TEST_ANSWER_MSG, dnsTest_buildNaptr("example.com", longName, "_sip._tcp.example.com"));
+	dnsTest_setName(longName, DNS_TEST_ANSWER_ONGOING, NULL);
+	dnsTest_setName("_sip._tcp.example.com", DNS_TEST_ANSWER_NXDOMAIN, NULL);
+
+	osPointerLen_t qName = {"example.com", sizeof("example.com")-1};
+	dnsResResponse_t* pResResponse = NULL;
+	dnsQueryStatus_e qStatus = dnsQuery(&qName, DNS_QTYPE_NAPTR, true, true, &pResResponse, dnsTest_appCallback, NULL);
+	if(qStatus != DNS_QUERY_STATUS_ONGOING || pResResponse || gAppCallbackNum)
+	{
+		printf("%s: qStatus=%d, pResResponse=%p, gAppCallbackNum=%d, expect the long target is queried.\n", __func__, qStatus, pResResponse, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	dnsResResponse_t rr = {.rrType = DNS_RR_DATA_TYPE_MSG, .pDnsRsp = dnsTest_buildSrv(longName, "sip1.example.com")};
+	dnsTest_respond(longName, &rr);
+	if(gAppCallbackNum != 1 || gpAppResponse->rrType != DNS_RR_DATA_TYPE_MSGLIST || dnsTest_getMsgNum(gpAppResponse) != 2)
+	{
+		printf("%s: gAppCallbackNum=%d, expect the app is notified once with the NAPTR and the SRV.\n", __func__, gAppCallbackNum);
+		goto EXIT;
+	}
+
+	isPass = true;
+
+EXIT:
+	printf("%s: %s\n", __func__, isPass ? "passed" : "failed");
+	gpAppResponse = osfree(gpAppResponse);
+	return isPass;
+}
+
+
+//the fake of the resolver, see dnsTestName_t
+dnsQueryStatus_e dnsQueryInternal(osPointerLen_t* qName, dnsQType_e qType, bool isCacheRR, dnsMessage_t** qResponse, dnsRcode_e* pNegRcode, dnsQCacheInfo_t** ppQCache, dnsResolver_callback_h rrCallback, void* pData)
+{
+	*qResponse = NULL;
+	*ppQCache = NULL;
+
+	for(int i=0; i<gTestNameNum; i++)
+	{
+		if(strlen(gTestName[i].qName) != qName->l || memcmp(gTestName[i].qName, qName->p, qName->l))
+		{
+			continue;
+		}
+
+		switch(gTestName[i].answer)
+		{
+			case DNS_TEST_ANSWER_MSG:
+				*qResponse = gTestName[i].pDnsMsg;
+				gTestName[i].pDnsMsg = NULL;
+				return DNS_QUERY_STATUS_DONE;
+			case DNS_TEST_ANSWER_ONGOING:
+				gTestName[i].pData = pData;
+				*ppQCache = &gTestQCache;
+				return DNS_QUERY_STATUS_ONGOING;
+			case DNS_TEST_ANSWER_NXDOMAIN:
+			default:
+				*pNegRcode = DNS_RCODE_NAME_ERROR;
+				return DNS_QUERY_STATUS_DONE;
+		}
+	}
+
+	printf("qName(%.*s) is not expected by the test.\n", (int)qName->l, qName->p);
+	return DNS_QUERY_STATUS_FAIL;
+}
+
+
+bool dnsService_isClient()
+{
+	return false;
+}
+
+
+dnsQueryStatus_e dnsService_query(osPointerLen_t* qName, dnsQType_e qType, bool isResolveAll, bool isCacheRR, dnsResolver_callback_h rrCallback, void* pData)
+{
+	return DNS_QUERY_STATUS_FAIL;
+}
+
+
+void dnsResResponse_memref(dnsResResponse_t* pDnsRsp)
+{
+	for(osListElement_t* pLE = pDnsRsp->dnsRspList.head; pDnsRsp->rrType == DNS_RR_DATA_TYPE_MSGLIST && pLE; pLE = pLE->next)
+	{
+		dnsMessage_ref(pLE->data);
+	}
+}
+
+
+void dnsResResponse_cleanup(void* pData)
+{
+	dnsResResponse_t* pRR = pData;
+	if(pRR->rrType == DNS_RR_DATA_TYPE_MSGLIST)
+	{
+		dnsMessage_freeList(&pRR->dnsRspList);
+	}
+	else if(pRR->rrType == DNS_RR_DATA_TYPE_MSG)
+	{
+		dnsMessage_free(pRR->pDnsRsp);
+	}
+}
+
+
+static void dnsTest_setName(const char* qName, dnsTestAnswer_e answer, dnsMessage_t* pDnsMsg)
+{
+	gTestName[gTestNameNum].qName = qName;
+	gTestName[gTestNameNum].answer = answer;
+	gTestName[gTestNameNum].pDnsMsg = pDnsMsg;
+	gTestName[gTestNameNum].pData = NULL;
+	gTestNameNum++;
+}
+
+
+static dnsTestName_t* dnsTest_getName(const char* qName)
+{
+	for(int i=0; i<gTestNameNum; i++)
+	{
+		if(!strcmp(gTestName[i].qName, qName))
+		{
+			return &gTestName[i];
+		}
+	}
+
+	return NULL;
+}
+
+
+//the response of a query that dnsQueryInternal() returned ongoing for
+static void dnsTest_respond(const char* qName, dnsResResponse_t* pRR)
+{
+	dnsTestName_t* pName = dnsTest_getName(qName);
+	if(!pName || !pName->pData)
+	{
+		printf("qName(%s) is not queried.\n", qName);
+		return;
+	}
+
+	dnsInternalCallback(pRR, pName->pData);
+}
+
+
+//the app takes the ownership of pRR
+static void dnsTest_appCallback(dnsResResponse_t* pRR, void* pData)
+{
+	gAppCallbackNum++;
+	osfree(gpAppResponse);
+	gpAppResponse = pRR;
+}
+
+
+static int dnsTest_getMsgNum(dnsResResponse_t* pRR)
+{
+	int msgNum = 0;
+	for(osListElement_t* pLE = pRR->dnsRspList.head; pLE; pLE = pLE->next)
+	{
+		msgNum++;
+	}
+
+	return msgNum;
+}
+
+
+//two NAPTR with the S flag, no additional rr
+static dnsMessage_t* dnsTest_buildNaptr(const char* qName, const char* srvName1, const char* srvName2)
+{
+	dnsTestWire_t wire = {};
+	dnsTest_addHdr(&wire, 0x8180, 2, 0, qName, DNS_QTYPE_NAPTR);
+
+	const char* srvName[2] = {srvName1, srvName2};
+	for(int i=0; i<2; i++)
+	{
+		dnsTestWire_t rdata = {};
+		dnsTest_addU16(&rdata, 10 * (i + 1));	//order
+		dnsTest_addU16(&rdata, 10);				//pref
+		const char naptrStr[] = "\x01S\x07SIP+D2U\x00";
+		memcpy(&rdata.wire[rdata.len], naptrStr, sizeof(naptrStr)-1);
+		rdata.len += sizeof(naptrStr)-1;
+		dnsTest_addName(&rdata, srvName[i]);
+		dnsTest_addRR(&wire, qName, DNS_QTYPE_NAPTR, rdata.wire, rdata.len);
+	}
+
+	return dnsTest_parse(&wire);
+}
+
+
+//one SRV, with the A of its target in the additional section
+static dnsMessage_t* dnsTest_buildSrv(const char* qName, const char* target)
+{
+	dnsTestWire_t wire = {};
+	dnsTest_addHdr(&wire, 0x8180, 1, 1, qName, DNS_QTYPE_SRV);
+
+	dnsTestWire_t rdata = {};
+	dnsTest_addU16(&rdata, 10);		//priority
+	dnsTest_addU16(&rdata, 60);		//weight
+	dnsTest_addU16(&rdata, 5060);	//port
+	dnsTest_addName(&rdata, target);
+	dnsTest_addRR(&wire, qName, DNS_QTYPE_SRV, rdata.wire, rdata.len);
+
+	const uint8_t ipAddr[4] = {192, 0, 2, 1};
+	dnsTest_addRR(&wire, target, DNS_QTYPE_A, ipAddr, sizeof(ipAddr));
+
+	return dnsTest_parse(&wire);
+}
+
+
+static dnsMessage_t* dnsTest_parse(dnsTestWire_t* pWire)
+{
+	osMBuf_t mBuf = {.buf = pWire->wire, .size = pWire->len, .end = pWire->len, .pos = 0};
+	dnsRcode_e replyCode;
+	dnsMessage_t* pDnsMsg = dnsMessage_parse(&mBuf, NULL, &replyCode);
+	if(!pDnsMsg)
+	{
+		printf("fails to dnsMessage_parse a response built by the test.\n");
+		exit(1);
+	}
+
+	return pDnsMsg;
+}
+
+
+static void dnsTest_addHdr(dnsTestWire_t* pWire, uint16_t flags, uint16_t anCount, uint16_t arCount, const char* qName, dnsQType_e qType)
+{
+	dnsTest_addU16(pWire, 0x1234);	//trId
+	dnsTest_addU16(pWire, flags);
+	dnsTest_addU16(pWire, 1);		//qdCount
+	dnsTest_addU16(pWire, anCount);
+	dnsTest_addU16(pWire, 0);		//nsCount
+	dnsTest_addU16(pWire, arCount);
+	dnsTest_addName(pWire, qName);
+	dnsTest_addU16(pWire, qType);
+	dnsTest_addU16(pWire, 1);		//class IN
+}
+
+
+static void dnsTest_addRR(dnsTestWire_t* pWire, const char* name, dnsQType_e type, const uint8_t* rdata, uint16_t rdLen)
+{
+	dnsTest_addName(pWire, name);
+	dnsTest_addU16(pWire, type);
+	dnsTest_addU16(pWire, 1);		//class IN
+	dnsTest_addU16(pWire, 0);		//ttl, 600 sec
+	dnsTest_addU16(pWire, 600);
+	dnsTest_addU16(pWire, rdLen);
+	memcpy(&pWire->wire[pWire->len], rdata, rdLen);
+	pWire->len += rdLen;
+}
+
+
+//no compression
+static void dnsTest_addName(dnsTestWire_t* pWire, const char* name)
+{
+	while(*name)
+	{
+		const char* dot = strchr(name, '.');
+		size_t labelLen = dot ? dot - name : strlen(name);
+		pWire->wire[pWire->len++] = labelLen;
+		memcpy(&pWire->wire[pWire->len], name, labelLen);
+		pWire->len += labelLen;
+		name += dot ? labelLen + 1 : labelLen;
+	}
+
+	pWire->wire[pWire->len++] = 0;
+}
+
+
+static void dnsTest_addU16(dnsTestWire_t* pWire, uint16_t value)
+{
+	pWire->wire[pWire->len++] = value >> 8;
+	pWire->wire[pWire->len++] = value & 0xff;
+}
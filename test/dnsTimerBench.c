@@ -0,0 +1,113 @@
+/* Copyright (c) 2020, Sean Dai
+ *
+ * microbenchmark of the query timers at DNS_BENCH_QUERY_NUM outstanding queries.  Each query starts a response
+ * timer and stops it when the response comes, once with the per thread timer wheel, see dnsTimerWheel.c, and once
+ * with one os timer per query, the way the resolver did before the wheel.  The timers are stopped in a random order,
+ * as the responses come back.  It runs in the main thread, the os timer of the thread shall be usable, see the os
+ * library.  The timers never expire during the run.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "osTimer.h"
+
+#include "dnsTimerWheel.h"
+
+
+#define DNS_BENCH_QUERY_NUM		50000
+#define DNS_BENCH_ROUND_NUM		20
+#define DNS_BENCH_TIMEOUT		3000	//msec, the default DNS_WAIT_RESPONSE_TIMEOUT
+
+
+static uint64_t dnsBench_getTime();
+static void dnsBench_onWheelTimeout(void* pData);
+static void dnsBench_onOsTimeout(uint64_t timerId, void* pData);
+
+
+
+int main(int argc, char* argv[])
+{
+	dnsTimerNode_t* pNode = calloc(DNS_BENCH_QUERY_NUM, sizeof(dnsTimerNode_t));
+	uint64_t* timerId = calloc(DNS_BENCH_QUERY_NUM, sizeof(uint64_t));
+	uint32_t* order = calloc(DNS_BENCH_QUERY_NUM, sizeof(uint32_t));
+
+	//the responses come back in a random order
+	srand(1);
+	for(uint32_t i=0; i<DNS_BENCH_QUERY_NUM; i++)
+	{
+		order[i] = i;
+	}
+	for(uint32_t i=DNS_BENCH_QUERY_NUM-1; i>0; i--)
+	{
+		uint32_t j = rand() % (i + 1);
+		uint32_t tmp = order[i];
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	uint64_t wheelStart = 0, wheelStop = 0, osStart = 0, osStop = 0;
+	for(int round=0; round<DNS_BENCH_ROUND_NUM; round++)
+	{
+		uint64_t time = dnsBench_getTime();
+		for(uint32_t i=0; i<DNS_BENCH_QUERY_NUM; i++)
+		{
+			dnsTimerWheel_start(&pNode[i], DNS_BENCH_TIMEOUT, dnsBench_onWheelTimeout, &pNode[i]);
+		}
+		wheelStart += dnsBench_getTime() - time;
+
+		time = dnsBench_getTime();
+		for(uint32_t i=0; i<DNS_BENCH_QUERY_NUM; i++)
+		{
+			dnsTimerWheel_stop(&pNode[order[i]]);
+		}
+		wheelStop += dnsBench_getTime() - time;
+
+		time = dnsBench_getTime();
+		for(uint32_t i=0; i<DNS_BENCH_QUERY_NUM; i++)
+		{
+			timerId[i] = osStartTimer(DNS_BENCH_TIMEOUT, dnsBench_onOsTimeout, &timerId[i]);
+		}
+		osStart += dnsBench_getTime() - time;
+
+		time = dnsBench_getTime();
+		for(uint32_t i=0; i<DNS_BENCH_QUERY_NUM; i++)
+		{
+			osStopTimer(timerId[order[i]]);
+		}
+		osStop += dnsBench_getTime() - time;
+	}
+
+	uint64_t opNum = (uint64_t)DNS_BENCH_QUERY_NUM * DNS_BENCH_ROUND_NUM;
+	printf("%d outstanding queries, %d rounds\n", DNS_BENCH_QUERY_NUM, DNS_BENCH_ROUND_NUM);
+	printf("%-12s %12s %12s %12s\n", "timer", "ns/start", "ns/stop", "os timers");
+	printf("%-12s %12.1f %12.1f %12d\n", "wheel", (double)wheelStart / opNum, (double)wheelStop / opNum, 1);
+	printf("%-12s %12.1f %12.1f %12d\n", "os timer", (double)osStart / opNum, (double)osStop / opNum, DNS_BENCH_QUERY_NUM);
+
+	free(pNode);
+	free(timerId);
+	free(order);
+	return 0;
+}
+
+
+static void dnsBench_onWheelTimeout(void* pData)
+{
+	printf("a wheel timer expires during the run, unexpected.\n");
+}
+
+
+static void dnsBench_onOsTimeout(uint64_t timerId, void* pData)
+{
+	printf("an os timer expires during the run, unexpected.\n");
+}
+
+
+static uint64_t dnsBench_getTime()
+{
+	struct timespec tp;
+	clock_gettime(CLOCK_MONOTONIC, &tp);
+	return (uint64_t)tp.tv_sec * 1000000000 + tp.tv_nsec;
+}